@@ -49,17 +49,24 @@
 #include "TTimer.h"
 #include <stdio.h>
 #include "hwdrivers/XRay.h"
+#include "hwdrivers/XRayManager.h"
+#include "hwdrivers/XRClock.h"
+#include "hwdrivers/XRayCommandDispatcher.h"
 #include "TSystem.h"
 #include "Vparams.h"
-#include "ipc/NamedPipeServer.h"
+#include "ipc/MultiPipeServer.h"
+#include <map>
 #include "TThread.h"
 #include <vector>
 
-// Global XRay instance (hardware driver). Created in WinMain.
+// Global XRay manager owning every tube, and the tube served on the pipe.
+// Created in WinMain.
+static XRayManager* gXRayManager = NULL;
 static XRay* gXRay = NULL;
 static FILE* gLogFile = NULL;
 static Bool_t gServerRunning = kFALSE;
 static TMutex gServerMutex;
+static MultiPipeServer* gPipeServer = NULL;
 static std::string gPipeName;
 
 // Read XRaySerialNumber "XXXXXXXX" from a simple key-value config file.
@@ -121,21 +128,12 @@ static double ReadNumericFromConfig(const char* path, const char* paramName, dou
 	return defaultVal;
 }
 
-// Helper to split strings for pipe server
-static void SplitPipeTokens(const std::string& s, char delim, std::vector<std::string>& out) {
-	out.clear();
-	size_t start = 0;
-	while (start <= s.size()) {
-		size_t pos = s.find(delim, start);
-		if (pos == std::string::npos) { out.push_back(s.substr(start)); break; }
-		out.push_back(s.substr(start, pos - start));
-		start = pos + 1;
-	}
-}
-
-// Named pipe server thread function
+// Named pipe server thread function. One event loop serves every client
+// (scan orchestrator, dashboards...) at the same time; commands that touch
+// a tube go through its command queue and are answered on completion, so
+// a client polling the state never waits behind the controlling one.
 static void* ServerThreadFunc(void* arg) {
-	XRay* xray = (XRay*)arg;
+	XRay* defaultTube = (XRay*)arg;
 	std::string pipeName = gPipeName.empty() ? std::string("\\\\.\\pipe\\XRayService") : gPipeName;
 	
 	if (gLogFile) {
@@ -146,143 +144,49 @@ static void* ServerThreadFunc(void* arg) {
 		fflush(gLogFile);
 	}
 	
-	NamedPipeServer server(pipeName);
-	if (!server.listen()) {
+	// Deleted by WinMain after the tubes, whose queued commands still reply
+	MultiPipeServer* server = new MultiPipeServer(pipeName, (Int_t)ReadNumericFromConfig("qsv.conf", "XRPipeClients", 8));
+	if (!server->listen()) {
 		if (gLogFile) {
 			fprintf(gLogFile, "ERROR: Failed to create named pipe: %s\n", pipeName.c_str());
 			fflush(gLogFile);
 		}
+		delete server;
 		return NULL;
 	}
+	gServerMutex.Lock();
+	gPipeServer = server;
+	Bool_t running = gServerRunning;
+	gServerMutex.UnLock();
+	if (!running) return NULL;
 	
 	if (gLogFile) {
 		fprintf(gLogFile, "SUCCESS: Named pipe server listening on: %s\n", pipeName.c_str());
-		fprintf(gLogFile, "Waiting for client connection...\n");
+		fprintf(gLogFile, "Waiting for client connections...\n");
 		fflush(gLogFile);
 	}
 	
-	Bool_t running;
-	gServerMutex.Lock();
-	running = gServerRunning;
-	gServerMutex.UnLock();
+	// Each client is served the default tube until INIT|<serial>; any
+	// request may address another tube of the manager with #<tube>|
+	XRayCommandDispatcher dispatcher(*server, gXRayManager, defaultTube);
+	dispatcher.SetShutdown([]() {
+		gServerMutex.Lock();
+		gServerRunning = kFALSE;
+		gServerMutex.UnLock();
+	});
 	
-	while (running) {
-		if (!server.accept()) {
-			if (gLogFile) {
-				fprintf(gLogFile, "ERROR: Failed to accept client connection\n");
-				fflush(gLogFile);
-			}
-			break;
-		}
-		
+	server->run([&](int client, const std::string& msg, const MultiPipeServer::Reply& reply) {
+		dispatcher.Handle(client, msg, reply);
+	}, [&](int client, bool connected) {
+		dispatcher.Connected(client, connected);
 		if (gLogFile) {
-			fprintf(gLogFile, "SUCCESS: Client connected to pipe server: %s\n", pipeName.c_str());
+			fprintf(gLogFile, "Client %d %s pipe server: %s, %d client(s)\n", client,
+				connected ? "connected to" : "disconnected from", pipeName.c_str(), server->clientCount());
 			fflush(gLogFile);
 		}
-		
-		// Handle client requests
-		gServerMutex.Lock();
-		running = gServerRunning;
-		gServerMutex.UnLock();
-		
-		while (running) {
-			std::string line;
-			if (!server.readLine(line)) break;
-			
-			std::vector<std::string> tok;
-			SplitPipeTokens(line, '|', tok);
-			if (tok.empty()) {
-				server.writeLine("ERR|empty");
-				continue;
-			}
-			
-			const std::string& cmd = tok[0];
-			
-			if (cmd == "GET_STATE") {
-				if (!xray) {
-					server.writeLine("ERR|noinst");
-					continue;
-				}
-				XRay::XRayState st = xray->GetXRayState();
-			char buf[256];
-			sprintf(buf, "OK|%d|%f|%f|%f|%f|%f|%f",
-				st.Power ? 1 : 0, st.VoltageToSet, st.ActualVoltage,
-					st.CurrentToSet, st.ActualCurrent, st.ActualPower, st.Temperature);
-				server.writeLine(buf);
-			}
-			else if (cmd == "SET_POWER") {
-				if (!xray) {
-					server.writeLine("ERR|noinst");
-					continue;
-				}
-				int p = (tok.size() >= 2) ? std::atoi(tok[1].c_str()) : 0;
-				if (tok.size() >= 3) xray->SetXRayVoltage((Float_t)std::atof(tok[2].c_str()));
-				if (tok.size() >= 4) xray->SetXRayCurrent((Float_t)std::atof(tok[3].c_str()));
-				xray->SetXRayState(p ? kTRUE : kFALSE);
-				server.writeLine("OK");
-			}
-			else if (cmd == "SET_VOLTAGE") {
-				if (!xray) {
-					server.writeLine("ERR|noinst");
-					continue;
-				}
-				if (tok.size() >= 2) xray->SetXRayVoltage((Float_t)std::atof(tok[1].c_str()));
-				server.writeLine("OK");
-			}
-			else if (cmd == "SET_CURRENT") {
-				if (!xray) {
-					server.writeLine("ERR|noinst");
-					continue;
-				}
-				if (tok.size() >= 2) xray->SetXRayCurrent((Float_t)std::atof(tok[1].c_str()));
-				server.writeLine("OK");
-			}
-			else if (cmd == "READ_DATA") {
-				if (!xray) {
-					server.writeLine("ERR|noinst");
-					continue;
-				}
-			xray->ReadXRayData();
-			XRay::XRayState st = xray->GetXRayState();
-			char buf[256];
-			sprintf(buf, "OK|%d|%f|%f|%f|%f|%f|%f",
-				st.Power ? 1 : 0, st.VoltageToSet, st.ActualVoltage,
-				st.CurrentToSet, st.ActualCurrent, st.ActualPower, st.Temperature);
-			server.writeLine(buf);
-			}
-			else if (cmd == "GET_SERIAL") {
-				if (!xray) {
-					server.writeLine("ERR|noinst");
-					continue;
-				}
-			const char* serial = xray->GetSerialNumber();
-			char buf[128];
-			sprintf(buf, "OK|%s", serial ? serial : "");
-			server.writeLine(buf);
-			}
-			else if (cmd == "SHUTDOWN") {
-				server.writeLine("OK");
-				gServerMutex.Lock();
-				gServerRunning = kFALSE;
-				gServerMutex.UnLock();
-				break;
-			}
-			else {
-				server.writeLine("ERR|unknown_cmd");
-			}
-			
-			gServerMutex.Lock();
-			running = gServerRunning;
-			gServerMutex.UnLock();
-		}
-		
-		if (gLogFile) fprintf(gLogFile, "Client disconnected from pipe server\n");
-		
-		gServerMutex.Lock();
-		running = gServerRunning;
-		gServerMutex.UnLock();
-	}
+	});
 	
+	dispatcher.Stop();
 	if (gLogFile) fprintf(gLogFile, "Named pipe server stopped\n");
 	return NULL;
 }
@@ -296,6 +200,9 @@ enum {
 	XR_TIMER  = 1004
 };
 
+// Period to poll the tube, msec of XRClock time
+const Long64_t kPollPeriod = 500;
+
 class XRayGui : public TGMainFrame {
 public:
 	XRayGui(const TGWindow* p, XRay* xr, UInt_t w=400, UInt_t h=300)
@@ -446,8 +353,10 @@ public:
 			numSetI_->SetNumber(setI_uA_);
 		}
 
-		// Start timer to poll hardware every 500ms
-		timer_ = new TTimer(this, 500);
+		// Start timer to poll hardware every kPollPeriod. With a virtual clock
+		// the timer ticks faster and HandleTimer() checks the clock instead.
+		nextPoll_ = XRClock::Get()->Now() + kPollPeriod;
+		timer_ = new TTimer(this, XRClock::Get()->IsVirtual() ? 20 : kPollPeriod);
 		timer_->TurnOn();
 
 		MapSubwindows();
@@ -482,6 +391,9 @@ public:
 
 	// Handle timer events to poll hardware
 	virtual Bool_t HandleTimer(TTimer* /*timer*/) {
+		Long64_t now = XRClock::Get()->Now();
+		if (now < nextPoll_) return kTRUE;
+		nextPoll_ = now + kPollPeriod;
 		if (xray_) {
 			PullHardwareState();
 			RefreshXRLabels();
@@ -625,6 +537,7 @@ private:
 	TGLabel *lblPowerState_, *lblMonV_, *lblMonI_, *lblPower_mW_, *lblTempC_;
 	TGStatusBar *status_;
 	TTimer *timer_;
+	Long64_t nextPoll_;
 
 	// Colors
 	Pixel_t white_, black_, green_, red_;
@@ -700,25 +613,39 @@ int APIENTRY _tWinMain(HINSTANCE hInstance,
 		fflush(gLogFile);
 	}
 
-	// Create XRay hardware instance before GUI
-	// Connect to first available device (device 0) regardless of serial number
-	if (gLogFile) fprintf(gLogFile, "Creating XRay connection to first available device\n");
-	gXRay = new XRay(nullptr);
+	// Create every XRay hardware instance before GUI. The manager opens the
+	// MiniX DLL once and serializes device selection between the tubes.
+	if (gLogFile) fprintf(gLogFile, "Creating XRay manager for all attached devices\n");
+	gXRayManager = new XRayManager();
+	// The pipe serves the tube named in the config, else the first one
+	std::string configSerial = ReadXRaySerialFromConfig("qsv.conf");
+	gXRay = configSerial.empty() ? NULL : gXRayManager->GetTube(configSerial.c_str());
+	if (!gXRay) gXRay = gXRayManager->GetTube(0);
 	
-	// Log the connected device serial number
-	if (gXRay && gLogFile) {
-		const char* serial = gXRay->GetSerialNumber();
-		fprintf(gLogFile, "Connected to device with serial: %s\n", serial ? serial : "(none)");
+	// Log the connected device serial numbers
+	if (gLogFile) {
+		for (Int_t i = 0; i < gXRayManager->GetNTubes(); i++) {
+			const char* serial = gXRayManager->GetTube(i)->GetSerialNumber();
+			fprintf(gLogFile, "Tube %d connected to device with serial: %s\n", i, serial ? serial : "(none)");
+		}
 	}
 	
 	// Set default values from config immediately after connecting
-	if (gXRay) {
-		double defaultV = ReadNumericFromConfig("qsv.conf", "XRVoltageToSet", 10.0);
-		double defaultI = ReadNumericFromConfig("qsv.conf", "XRCurrentToSet", 5.0);
-		if (gLogFile) fprintf(gLogFile, "Setting defaults: V=%.1f kV, I=%.1f uA\n", defaultV, defaultI);
-		gXRay->SetXRayVoltage((Float_t)defaultV);
-		gXRay->SetXRayCurrent((Float_t)defaultI);
-		gXRay->SetXRayHVAndCurrent();
+	double defaultV = ReadNumericFromConfig("qsv.conf", "XRVoltageToSet", 10.0);
+	double defaultI = ReadNumericFromConfig("qsv.conf", "XRCurrentToSet", 5.0);
+	double acqPeriod = ReadNumericFromConfig("qsv.conf", "XRAcquisitionPeriod", 0.0);
+	if (gLogFile) fprintf(gLogFile, "Setting defaults: V=%.1f kV, I=%.1f uA\n", defaultV, defaultI);
+	for (Int_t i = 0; i < gXRayManager->GetNTubes(); i++) {
+		XRay* xr = gXRayManager->GetTube(i);
+		xr->SetXRayVoltage((Float_t)defaultV);
+		xr->SetXRayCurrent((Float_t)defaultI);
+		xr->SetXRayHVAndCurrent();
+
+		// Optional background telemetry acquisition (lock-free state reads)
+		if (acqPeriod > 0) {
+			if (gLogFile) fprintf(gLogFile, "Starting X-ray acquisition thread for tube %d: period=%.0f ms\n", i, acqPeriod);
+			xr->StartAcquisition((Int_t)acqPeriod);
+		}
 	}
 	
 	// Start named pipe server in background thread
@@ -730,8 +657,9 @@ int APIENTRY _tWinMain(HINSTANCE hInstance,
 	serverThread->Run();
 	if (gLogFile) fprintf(gLogFile, "Named pipe server thread started\n");
 	
-	// Create and show GUI, passing hardware driver pointer
-	new XR::XRayGui(gClient->GetRoot(), gXRay, 420, 340);
+	// Create and show one GUI panel per tube, passing hardware driver pointer
+	for (Int_t i = 0; i < gXRayManager->GetNTubes(); i++)
+		new XR::XRayGui(gClient->GetRoot(), gXRayManager->GetTube(i), 420, 340);
 
 	// Run GUI event loop
 	app.Run();
@@ -740,6 +668,7 @@ int APIENTRY _tWinMain(HINSTANCE hInstance,
 	if (gLogFile) fprintf(gLogFile, "GUI closed, shutting down server...\n");
 	gServerMutex.Lock();
 	gServerRunning = kFALSE;
+	if (gPipeServer) gPipeServer->stop();
 	gServerMutex.UnLock();
 	
 	if (serverThread) {
@@ -747,7 +676,9 @@ int APIENTRY _tWinMain(HINSTANCE hInstance,
 		delete serverThread;
 	}
 	
-	if (gXRay) { delete gXRay; gXRay = NULL; }
+	gXRay = NULL;
+	if (gXRayManager) { delete gXRayManager; gXRayManager = NULL; }
+	if (gPipeServer) { delete gPipeServer; gPipeServer = NULL; }
 	if (gLogFile) { 
 		fprintf(gLogFile, "=== Application Shutdown ===\n");
 		fclose(gLogFile); 
@@ -133,6 +133,36 @@
 // Minimum XRay voltage and current to set, kiloVolts, microAmps
 #define MINXRAYVOLTAGE 10
 #define MINXRAYCURRENT 5
+// Maximum anode power of XRay tube, milliWatts (kV * uA)
+#define MAXXRAYPOWER 4000
+// Default setpoint ramp: kiloVolts/sec, microAmps/sec, step period msec
+#define XRRAMPVOLTAGERATE 2
+#define XRRAMPCURRENTRATE 20
+#define XRRAMPSTEP 250
+// Deadline to bring up a MiniX controller, msec
+#define XRSTARTUPTIMEOUT 10000
+// Telemetry subscriptions: change check period, sampling period, msec
+#define XRSUBSCRIBETICK 20
+#define XRSUBSCRIBESAMPLE 200
+// Control lease of a tube by a pipe client, msec
+#define XRLEASE 10000
+// Settle of sequence programs (EXEC): voltage and current tolerance, kV, uA,
+// deadline and poll period, msec
+#define XRSETTLEVOLTAGE 0.5
+#define XRSETTLECURRENT 2
+#define XRSETTLETIMEOUT 10000
+#define XRSETTLEPOLL 100
+// Telemetry history: raw samples, 1 sec, 10 sec and 1 min rollups kept
+#define XRHISTORYRAW 36000
+#define XRHISTORYSEC 3600
+#define XRHISTORY10SEC 8640
+#define XRHISTORYMIN 10080
+// Points of a HISTORY reply unless the request asks for another number
+#define XRHISTORYPOINTS 500
+// Freshness window of the readings of a remote tube, msec
+#define XRREMOTECACHE 50
+// Wait of a remote tube for a restarted service, msec
+#define XRREMOTERECONNECT 2000
 
 // ******************************* Scanner *************************
 
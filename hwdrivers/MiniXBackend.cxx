@@ -0,0 +1,333 @@
+#include "stdafx.h"
+#include "MiniXBackend.h"
+
+#include <string.h>
+#include "XRClock.h"
+#include "MiniXCommandPlan.h"
+#include "MiniXDeviceMap.h"
+#include "MiniXScheduler.h"
+#include "XRLog.h"
+
+//---------------------------------------------------------------------------
+// Controller connected: commands are accepted from now on
+static Bool_t IsReadyStatus(byte status)
+{
+  return status == mxstMiniXControllerReady || status == mxstMiniXReady ||
+         status == mxstUpdatingSettings || status == mxstRequestedVoltageOutOfRange ||
+         status == mxstRequestedCurrentOutOfRange;
+}
+//---------------------------------------------------------------------------
+// No point in waiting any longer
+static Bool_t IsFailedStatus(byte status)
+{
+  return status == mxstDriversNotLoaded || status == mxstNoDevicesAttached ||
+         status == mxstMiniXControllerFailedToOpen || status == mxstNoDeviceSelected;
+}
+//---------------------------------------------------------------------------
+MiniXBackend::MiniXBackend(MiniXScheduler *scheduler, long deviceIndex, const char *serialNumber)
+{
+  debug = Vparams::getParams()->verbose;
+  fScheduler = scheduler;
+  fOwnsMiniX = scheduler ? kFALSE : kTRUE;
+  fOpened = kFALSE;
+  fDeviceIndex = deviceIndex;
+  if (serialNumber)
+    fSerialNumber = serialNumber;
+  fPlan = new MiniXCommandPlan(deviceIndex);
+  LevelParameter *p1 = Vparams::getParams()->conf->GetParameter<LevelParameter>("XRStartupTimeout");
+  fStartupTimeout = p1 ? (Int_t)p1->Level : XRSTARTUPTIMEOUT;
+  memset(&fMonitor, 0, sizeof(fMonitor));
+  memset(&fSettings, 0, sizeof(fSettings));
+}
+//---------------------------------------------------------------------------
+MiniXBackend::~MiniXBackend()
+{
+  RunOnDevice([&]() {
+    if (fDeviceIndex >= 0 && isMiniXDlg())
+    {
+      fPlan->SendCommand(mxcExit, kFALSE);
+      XRClock::Get()->Sleep(100);
+    }
+  });
+  // A managed tube leaves the DLL to XRayManager. A standalone one closes
+  // the application it started, up or not by now
+  if (fOwnsMiniX && fOpened)
+  {
+    MiniXDeviceMap::Instance()->Invalidate();
+    CloseMiniX();
+    MiniXCommandPlan::ForgetSelection();
+    XRClock::Get()->Sleep(100);
+  }
+  delete fPlan;
+  fPlan = 0;
+}
+//---------------------------------------------------------------------------
+Bool_t MiniXBackend::Open()
+{
+  if (!fOwnsMiniX)
+    return fDeviceIndex >= 0;
+
+  printf("\n\t***** Start MiniX X-Ray tube controller application *****\n");
+  XRClock *clock = XRClock::Get();
+  Long64_t t0 = clock->Now();
+  OpenMiniX();
+  MiniXCommandPlan::ForgetSelection();
+  fOpened = kTRUE;
+  // The controller application needs a variable time to come up
+  Bool_t up = clock->PollUntil([]() { return isMiniXDlg() ? kTRUE : kFALSE; }, fStartupTimeout);
+  Long64_t t1 = clock->Now();
+  printf("Startup: MiniX application %s after %lld ms\n", up ? "up" : "NOT up", (long long)(t1 - t0));
+  if (!up)
+    return kFALSE;
+
+  // Bind the requested tube, device 0 if none; the enumeration is cached
+  MiniXDeviceMap *devices = MiniXDeviceMap::Instance();
+  if (!devices->IsValid())
+    devices->Refresh();
+  long deviceIndex = fSerialNumber.empty() ? 0 : devices->Lookup(fSerialNumber.c_str());
+  printf("Found %ld MiniX device(s)\n", devices->GetCount());
+  printf("Startup: device lookup %lld ms\n", (long long)(clock->Now() - t1));
+  if (devices->GetCount() <= 0)
+  {
+    printf("No X-ray devices found. Running in SIMULATION mode\n");
+    return kFALSE;
+  }
+  if (deviceIndex < 0)
+  {
+    printf("No X-ray device with serial number %s. Running in SIMULATION mode\n", fSerialNumber.c_str());
+    return kFALSE;
+  }
+
+  printf("Attempting to connect to device %ld...\n", deviceIndex);
+  fSerialNumber = devices->GetSerial(deviceIndex);
+  fDeviceIndex = deviceIndex;
+  fPlan->SetDeviceIndex(fDeviceIndex);
+  fPlan->SelectDevice();
+  printf("Successfully connected to device %ld with serial number: %s\n", fDeviceIndex, fSerialNumber.c_str());
+  return kTRUE;
+}
+//---------------------------------------------------------------------------
+Bool_t MiniXBackend::Startup()
+{
+  XRClock *clock = XRClock::Get();
+  Long64_t t0 = clock->Now();
+  Long64_t tStart = -1; // mxcStartMiniX sent
+  Int_t polls = 0;
+  fPlan->BeginOperation("Startup");
+  // Poll the status with backoff: start the controller once the
+  // application is ready, then wait for it to connect. Every poll is a
+  // separate scheduler job, so tubes brought up in parallel interleave
+  // their DLL calls while they wait
+  clock->PollUntil([&]() {
+    Bool_t done = kFALSE;
+    RunOnDevice([&]() {
+      fMonitor = fPlan->ReadMonitor(0);
+      polls++;
+      if (fMonitor.mxmStatusInd == mxstMiniXApplicationReady && tStart < 0)
+      {
+        fPlan->SendCommand(mxcStartMiniX, kFALSE);
+        tStart = clock->Now();
+      }
+      done = IsReadyStatus(fMonitor.mxmStatusInd) || IsFailedStatus(fMonitor.mxmStatusInd);
+    });
+    return done;
+  }, fStartupTimeout);
+  Long64_t tReady = clock->Now();
+
+  Bool_t ready = IsReadyStatus(fMonitor.mxmStatusInd);
+  RunOnDevice([&]() {
+    if (ready)
+    {
+      fSettings = fPlan->ReadSettings();
+      long mxserial = ReadMiniXSerialNumber();
+      printf("MiniX Serial Number %ld connected\n", mxserial);
+    }
+    printf(" MiniX status: %s\n", GetMiniXStatusString(fMonitor.mxmStatusInd));
+  });
+  fPlan->EndOperation();
+  PrintDllCalls();
+  if (ready)
+    printf(" MiniX X-Ray tube is in REAL_TIME operation mode!\n");
+  else
+    printf("WARNING: MiniX X-Ray tube is in SIMULATION operation mode!\n");
+  printf("Startup of device %ld: %s after %lld ms (start command at %lld ms, connect %lld ms, %d status polls)\n",
+         fDeviceIndex, ready ? "ready" : "NOT ready", (long long)(tReady - t0),
+         (long long)(tStart < 0 ? -1 : tStart - t0), (long long)(tStart < 0 ? -1 : tReady - tStart), polls);
+  return ready;
+}
+//---------------------------------------------------------------------------
+Bool_t MiniXBackend::SetPower(XRayState_t &st, Bool_t power)
+{
+  Bool_t sent = kFALSE;
+  if (debug > 0)
+    printf("XRay real mode\n");
+  RunOnDevice([&]() {
+    if (!isMiniXDlg())
+    {
+      printf(" MiniX status: no MiniXDlg\n");
+      return;
+    }
+    if (power)
+    { // turn ON XRay
+      if (debug > 0)
+        printf("\n       ********* X-Ray tube will be powered ON *********\n");
+      fPlan->BeginOperation("SetXRayState(ON)");
+      if (!fPlan->CommitHVAndCurrent((double)st.VoltageToSet, (double)st.CurrentToSet))
+        printf(" MiniX status: %s\n", GetMiniXStatusString(fPlan->ReadMonitor().mxmStatusInd));
+
+      fSettings = fPlan->ReadSettings();
+      printf(" Corrected MiniX settings:\n XRayVMon=%.0f, XRayImon=%.0f\n", fSettings.HighVoltage_kV, fSettings.Current_uA);
+
+      sent = fPlan->SendCommand(mxcHVOn);
+      if (!sent)
+        printf(" MiniX status: %s\n", GetMiniXStatusString(fPlan->ReadMonitor().mxmStatusInd));
+      fMonitor = fPlan->ReadMonitor();
+      fPlan->EndOperation();
+      PrintDllCalls();
+    }
+    else
+    { // turn OFF XRay
+      fPlan->BeginOperation("SetXRayState(OFF)");
+      // Never judge HV off by a cached frame: one taken just after HV on
+      // may not enable mxcHVOff yet
+      fPlan->ReadMonitor(0);
+      sent = fPlan->SendCommand(mxcHVOff);
+      if (!sent)
+        printf(" MiniX status: %s\n", GetMiniXStatusString(fPlan->ReadMonitor().mxmStatusInd));
+      fPlan->EndOperation();
+      PrintDllCalls();
+      if (sent)
+      {
+        st.ActualVoltage = 0.0;
+        st.ActualCurrent = 0.0;
+      }
+    }
+  }, !power); // HV off jumps the queues of the other tubes
+  return sent;
+}
+//---------------------------------------------------------------------------
+void MiniXBackend::Commit(XRayState_t &st, const char *operation)
+{
+  RunOnDevice([&]() {
+    if (!isMiniXDlg())
+      return;
+    fPlan->BeginOperation(operation);
+    if (!fPlan->CommitHVAndCurrent((double)st.VoltageToSet, (double)st.CurrentToSet))
+      printf(" MiniX status: %s\n", GetMiniXStatusString(fPlan->ReadMonitor().mxmStatusInd));
+    fPlan->EndOperation();
+    PrintDllCalls();
+  });
+}
+//---------------------------------------------------------------------------
+void MiniXBackend::ReadData(XRayState_t &st, UInt_t fields)
+{
+  RunOnDevice([&]() {
+    if (!isMiniXDlg())
+      return;
+    // Power and temperature alone are served from the last frame
+    if (fields & (kXRVoltage | kXRCurrent))
+      fMonitor = fPlan->ReadMonitor(0);
+    // A full read only accepts a refreshed frame
+    if (fields == kXRAllFields && !fMonitor.mxmRefreshed)
+      return;
+    if (fields & kXRVoltage)
+      st.ActualVoltage = (Float_t)fMonitor.mxmHighVoltage_kV;
+    if (fields & kXRCurrent)
+      st.ActualCurrent = (Float_t)fMonitor.mxmCurrent_uA;
+    if (fields & kXRPower)
+      st.ActualPower = (Float_t)fMonitor.mxmPower_mW;
+    if (fields & kXRTemperature)
+      st.Temperature = (Float_t)fMonitor.mxmTemperatureC;
+  });
+  if (debug > 1 && fields == kXRAllFields)
+  {
+    printf("MiniX status: %s\n", GetMiniXStatusString(fMonitor.mxmStatusInd));
+    printf("fXRayMonitor.mxmOutOfRange=%d\n", fMonitor.mxmOutOfRange ? 1 : 0);
+    printf("fXRayMonitor.mxmInterLock=%d\n", fMonitor.mxmInterLock ? 1 : 0);
+    printf("fXRayMonitor.mxmRefreshed=%d\n", fMonitor.mxmRefreshed ? 1 : 0);
+  }
+}
+//---------------------------------------------------------------------------
+void MiniXBackend::PrintStatus()
+{
+  for (Int_t i = 0; i < MiniXCommandPlan::kNDllCalls; i++)
+  {
+    MiniXCommandPlan::DllCall_t call = (MiniXCommandPlan::DllCall_t)i;
+    printf("DLL %s: %lld calls, %lld skipped\n", MiniXCommandPlan::GetCallName(call), (long long)fPlan->GetTotalCalls(call), (long long)fPlan->GetTotalSkipped(call));
+  }
+}
+//---------------------------------------------------------------------------
+void MiniXBackend::GetDeviceList()
+{
+  RunOnDevice([&]() {
+    if (isMiniXDlg())
+      ::GetDeviceList();
+  });
+}
+//---------------------------------------------------------------------------
+long MiniXBackend::GetDeviceCount()
+{
+  long count = 0;
+  RunOnDevice([&]() {
+    if (isMiniXDlg())
+      count = ::GetDeviceCount();
+  });
+  return count;
+}
+//---------------------------------------------------------------------------
+long MiniXBackend::GetDeviceSerialNumberByIndex(long lDeviceIndex, char *strSerialNumber)
+{
+  long ret = -1;
+  RunOnDevice([&]() {
+    if (isMiniXDlg())
+      ret = ::GetDeviceSerialNumberByIndex(lDeviceIndex, strSerialNumber);
+  });
+  return ret;
+}
+//---------------------------------------------------------------------------
+void MiniXBackend::SetDevice(long lDeviceIndex)
+{
+  // Rebinding a managed tube would bypass XRayManager's enumeration
+  if (fScheduler && lDeviceIndex != fDeviceIndex)
+  {
+    printf("Cannot set device - tube is managed by XRayManager\n");
+    return;
+  }
+  RunOnDevice([&]() {
+    if (isMiniXDlg())
+    {
+      fDeviceIndex = lDeviceIndex;
+      fPlan->SetDeviceIndex(fDeviceIndex);
+      fPlan->SelectDevice();
+      if (debug > 0)
+        printf("Set MiniX device to index %ld\n", lDeviceIndex);
+    }
+    else
+    {
+      printf("Cannot set device - MiniX dialog not available\n");
+    }
+  });
+}
+//---------------------------------------------------------------------------
+void MiniXBackend::RunOnDevice(const std::function<void()> &job, Bool_t urgent)
+{
+  if (fScheduler)
+    fScheduler->Run(fDeviceIndex, job, urgent);
+  else
+    job();
+}
+//---------------------------------------------------------------------------
+void MiniXBackend::PrintDllCalls()
+{
+  if (debug <= 0)
+    return;
+  char buf[512];
+  Int_t n = snprintf(buf, sizeof(buf), " %s: %lld ms, DLL calls:", fPlan->GetOperationName(), (long long)fPlan->GetOperationTime());
+  for (Int_t i = 0; i < MiniXCommandPlan::kNDllCalls && n > 0 && n < (Int_t)sizeof(buf); i++)
+  {
+    MiniXCommandPlan::DllCall_t call = (MiniXCommandPlan::DllCall_t)i;
+    if (fPlan->GetOperationCalls(call) || fPlan->GetOperationSkipped(call))
+      n += snprintf(buf + n, sizeof(buf) - n, " %s=%d(%d skipped)", MiniXCommandPlan::GetCallName(call), fPlan->GetOperationCalls(call), fPlan->GetOperationSkipped(call));
+  }
+  printf("%s\n", buf);
+}
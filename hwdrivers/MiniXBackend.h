@@ -0,0 +1,67 @@
+#ifndef MINIXBACKEND_H
+#define MINIXBACKEND_H
+
+#include <functional>
+#include "XRayBackend.h"
+#ifdef _WIN32
+#include "hwdrivers/miniX/MiniXAPI.h"
+#else
+#include "hwdrivers/miniX/MiniXAPI_Linux.h"
+#endif
+
+class MiniXCommandPlan;
+class MiniXScheduler;
+
+//===========================================
+// Tube driven through the MiniX DLL.
+// A standalone backend opens the DLL itself and binds its device (Open);
+// a backend created by XRayManager is handed its device index and the
+// shared scheduler that serializes all DLL calls of the process.
+class MiniXBackend : public XRayBackend
+{
+ public:
+  MiniXBackend(MiniXScheduler *scheduler = 0, long deviceIndex = -1, const char *serialNumber = 0);
+  virtual ~MiniXBackend();
+
+  // Standalone only: open the DLL and bind the device with the serial
+  // number given at construction (device 0 if none) from the cached
+  // enumeration. Returns kFALSE if the DLL or the device is not available
+  Bool_t Open();
+  // Start the MiniX controller and poll its status until it is connected;
+  // kFALSE if it fails or is not ready within XRStartupTimeout
+  Bool_t Startup();
+
+  virtual const char *GetName() {return "MiniX";};
+  virtual HWmode_t GetMode() {return REAL_TIME;};
+  virtual const char *GetSerialNumber() {return fSerialNumber.c_str();};
+  long GetDeviceIndex() {return fDeviceIndex;};
+
+  virtual Bool_t SetPower(XRayState_t &st, Bool_t power);
+  virtual void SetVoltage(XRayState_t &st) {Commit(st, "SetXRayVoltage");};
+  virtual void SetCurrent(XRayState_t &st) {Commit(st, "SetXRayCurrent");};
+  virtual void SetHVAndCurrent(XRayState_t &st) {Commit(st, "SetXRayHVAndCurrent");};
+  virtual void ReadData(XRayState_t &st, UInt_t fields);
+  virtual void PrintStatus();
+
+  virtual void GetDeviceList();
+  virtual long GetDeviceCount();
+  virtual long GetDeviceSerialNumberByIndex(long lDeviceIndex, char *strSerialNumber);
+  virtual void SetDevice(long lDeviceIndex);
+
+ private:
+  void Commit(XRayState_t &st, const char *operation);
+  void RunOnDevice(const std::function<void()> &job, Bool_t urgent = kFALSE);
+  void PrintDllCalls();
+
+  Int_t debug;
+  MiniXScheduler *fScheduler; // shared DLL scheduler, 0 for a standalone tube
+  Bool_t fOwnsMiniX;          // standalone tube opens and closes the MiniX DLL
+  Bool_t fOpened;
+  long fDeviceIndex;
+  std::string fSerialNumber;
+  MiniXCommandPlan *fPlan;    // skips redundant DLL calls, counts the rest
+  Int_t fStartupTimeout;      // msec, Open and Startup deadline
+  MiniX_Monitor fMonitor;
+  MiniX_Settings fSettings;
+};
+#endif //MINIXBACKEND_H
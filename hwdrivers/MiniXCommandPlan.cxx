@@ -0,0 +1,174 @@
+#include "stdafx.h"
+#include "MiniXCommandPlan.h"
+
+#include <string.h>
+#include "XRClock.h"
+
+long MiniXCommandPlan::fgSelectedDevice = -1;
+
+//---------------------------------------------------------------------------
+MiniXCommandPlan::MiniXCommandPlan(long deviceIndex)
+{
+  fDeviceIndex = deviceIndex;
+  fMonitorMaxAge = 100;
+  fOpName = "";
+  fOpStart = 0;
+  fOpTime = 0;
+  for (Int_t i = 0; i < kNDllCalls; i++)
+  {
+    fOpCalls[i] = fOpSkipped[i] = 0;
+    fTotalCalls[i] = fTotalSkipped[i] = 0;
+  }
+  memset(&fMonitor, 0, sizeof(fMonitor));
+  memset(&fSettings, 0, sizeof(fSettings));
+  Invalidate();
+}
+//---------------------------------------------------------------------------
+void MiniXCommandPlan::SetDeviceIndex(long deviceIndex)
+{
+  if (deviceIndex == fDeviceIndex)
+    return;
+  fDeviceIndex = deviceIndex;
+  Invalidate();
+}
+//---------------------------------------------------------------------------
+void MiniXCommandPlan::Invalidate()
+{
+  fMonitorValid = kFALSE;
+  fMonitorTime = 0;
+  fSettingsValid = kFALSE;
+  fCommitted = kFALSE;
+  fCommittedHV = fCommittedCurrent = 0;
+}
+//---------------------------------------------------------------------------
+void MiniXCommandPlan::SelectDevice()
+{
+  if (fgSelectedDevice == fDeviceIndex)
+  {
+    Skip(kSetDevice);
+    return;
+  }
+  ::SetDevice(fDeviceIndex);
+  Count(kSetDevice);
+  fgSelectedDevice = fDeviceIndex;
+}
+//---------------------------------------------------------------------------
+const MiniX_Monitor &MiniXCommandPlan::ReadMonitor(Int_t maxAgeMs)
+{
+  if (maxAgeMs < 0)
+    maxAgeMs = fMonitorMaxAge;
+  if (fMonitorValid && NowMs() - fMonitorTime <= maxAgeMs)
+  {
+    Skip(kReadMonitor);
+    return fMonitor;
+  }
+  SelectDevice();
+  ::ReadMiniXMonitor(&fMonitor);
+  Count(kReadMonitor);
+  fMonitorValid = kTRUE;
+  fMonitorTime = NowMs();
+  return fMonitor;
+}
+//---------------------------------------------------------------------------
+const MiniX_Settings &MiniXCommandPlan::ReadSettings()
+{
+  if (fSettingsValid)
+  {
+    Skip(kReadSettings);
+    return fSettings;
+  }
+  SelectDevice();
+  ::ReadMiniXSettings(&fSettings);
+  Count(kReadSettings);
+  fSettingsValid = kTRUE;
+  return fSettings;
+}
+//---------------------------------------------------------------------------
+Bool_t MiniXCommandPlan::CommitHVAndCurrent(double kV, double uA)
+{
+  if (fCommitted && fCommittedHV == kV && fCommittedCurrent == uA)
+  {
+    Skip(kSetHV);
+    Skip(kSetCurrent);
+    Skip(kSendCommand);
+    return kTRUE;
+  }
+  SelectDevice();
+  ::SetMiniXHV(kV);
+  Count(kSetHV);
+  ::SetMiniXCurrent(uA);
+  Count(kSetCurrent);
+  if (!SendCommand(mxcSetHVandCurrent))
+    return kFALSE;
+  fCommitted = kTRUE;
+  fCommittedHV = kV;
+  fCommittedCurrent = uA;
+  fSettingsValid = kFALSE; // controller may have corrected the request
+  return kTRUE;
+}
+//---------------------------------------------------------------------------
+Bool_t MiniXCommandPlan::SendCommand(MiniX_Commands cmd, Bool_t checkEnabled)
+{
+  if (checkEnabled && !(ReadMonitor().mxmEnabledCmds & cmd))
+    return kFALSE;
+  SelectDevice();
+  ::SendMiniXCommand((byte)cmd);
+  Count(kSendCommand);
+  // The command changes the controller state: the frame is stale now
+  fMonitorValid = kFALSE;
+  if (cmd == mxcStartMiniX || cmd == mxcExit)
+    Invalidate();
+  return kTRUE;
+}
+//---------------------------------------------------------------------------
+void MiniXCommandPlan::BeginOperation(const char *name)
+{
+  fOpName = name ? name : "";
+  fOpStart = NowMs();
+  fOpTime = 0;
+  for (Int_t i = 0; i < kNDllCalls; i++)
+    fOpCalls[i] = fOpSkipped[i] = 0;
+}
+//---------------------------------------------------------------------------
+void MiniXCommandPlan::EndOperation()
+{
+  fOpTime = NowMs() - fOpStart;
+}
+//---------------------------------------------------------------------------
+const char *MiniXCommandPlan::GetCallName(DllCall_t call)
+{
+  switch (call)
+  {
+  case kSetDevice:
+    return "SetDevice";
+  case kReadMonitor:
+    return "ReadMiniXMonitor";
+  case kReadSettings:
+    return "ReadMiniXSettings";
+  case kSetHV:
+    return "SetMiniXHV";
+  case kSetCurrent:
+    return "SetMiniXCurrent";
+  case kSendCommand:
+    return "SendMiniXCommand";
+  default:
+    return "";
+  }
+}
+//---------------------------------------------------------------------------
+void MiniXCommandPlan::Count(DllCall_t call)
+{
+  fOpCalls[call]++;
+  fTotalCalls[call]++;
+}
+//---------------------------------------------------------------------------
+void MiniXCommandPlan::Skip(DllCall_t call)
+{
+  fOpSkipped[call]++;
+  fTotalSkipped[call]++;
+}
+//---------------------------------------------------------------------------
+Long64_t MiniXCommandPlan::NowMs()
+{
+  return XRClock::Get()->Now();
+}
@@ -0,0 +1,89 @@
+#ifndef MINIXCOMMANDPLAN_H
+#define MINIXCOMMANDPLAN_H
+
+#include <Rtypes.h>
+#ifdef _WIN32
+#include "hwdrivers/miniX/MiniXAPI.h"
+#else
+#include "hwdrivers/miniX/MiniXAPI_Linux.h"
+#endif
+
+//===========================================
+// Thin layer between XRay and the MiniX DLL for one tube.
+// It remembers which device the (process-global) DLL currently has
+// selected, the last monitor frame with its age, the last settings read
+// and the HV/current pair last committed with mxcSetHVandCurrent, and
+// skips every DLL call whose result is already known. All DLL calls are
+// counted per operation and in total.
+// Not thread safe: the caller serializes access (XRay holds fXRayMutex).
+class MiniXCommandPlan
+{
+ public:
+  enum DllCall_t {
+    kSetDevice = 0,
+    kReadMonitor,
+    kReadSettings,
+    kSetHV,
+    kSetCurrent,
+    kSendCommand,
+    kNDllCalls
+  };
+
+  MiniXCommandPlan(long deviceIndex = 0);
+
+  void SetDeviceIndex(long deviceIndex);
+  long GetDeviceIndex() {return fDeviceIndex;};
+  // Maximum age (msec) of a monitor frame reused by command checks
+  void SetMonitorMaxAge(Int_t ms) {fMonitorMaxAge = ms;};
+
+  void SelectDevice();
+  // The DLL selection is unknown again: call when the DLL is opened or
+  // closed and after its device list was rebuilt
+  static void ForgetSelection() {fgSelectedDevice = -1;};
+  // Returns the last frame if it is not older than maxAgeMs and no command
+  // was sent since; maxAgeMs < 0 uses the configured default
+  const MiniX_Monitor &ReadMonitor(Int_t maxAgeMs = -1);
+  const MiniX_Settings &ReadSettings();
+  // SetMiniXHV + SetMiniXCurrent + mxcSetHVandCurrent. Nothing is sent if
+  // this pair is already committed. Returns kFALSE if the command is disabled
+  Bool_t CommitHVAndCurrent(double kV, double uA);
+  // Sends cmd if it is enabled in the (possibly cached) monitor frame
+  Bool_t SendCommand(MiniX_Commands cmd, Bool_t checkEnabled = kTRUE);
+  // Forget everything known about the device (e.g. after start or exit)
+  void Invalidate();
+
+  // Per-operation accounting
+  void BeginOperation(const char *name);
+  void EndOperation();
+  const char *GetOperationName() {return fOpName;};
+  Int_t GetOperationCalls(DllCall_t call) {return fOpCalls[call];};
+  Int_t GetOperationSkipped(DllCall_t call) {return fOpSkipped[call];};
+  Long64_t GetOperationTime() {return fOpTime;}; // msec
+  Long64_t GetTotalCalls(DllCall_t call) {return fTotalCalls[call];};
+  Long64_t GetTotalSkipped(DllCall_t call) {return fTotalSkipped[call];};
+  static const char *GetCallName(DllCall_t call);
+
+ private:
+  void Count(DllCall_t call);
+  void Skip(DllCall_t call);
+  static Long64_t NowMs();
+
+  long fDeviceIndex;
+  Int_t fMonitorMaxAge;
+  MiniX_Monitor fMonitor;
+  Bool_t fMonitorValid;
+  Long64_t fMonitorTime;
+  MiniX_Settings fSettings;
+  Bool_t fSettingsValid;
+  Bool_t fCommitted;
+  double fCommittedHV, fCommittedCurrent;
+
+  const char *fOpName;
+  Long64_t fOpStart, fOpTime;
+  Int_t fOpCalls[kNDllCalls], fOpSkipped[kNDllCalls];
+  Long64_t fTotalCalls[kNDllCalls], fTotalSkipped[kNDllCalls];
+
+  // Device currently selected in the DLL; shared by all plans
+  static long fgSelectedDevice;
+};
+#endif //MINIXCOMMANDPLAN_H
@@ -0,0 +1,116 @@
+#include "stdafx.h"
+#include "MiniXDeviceMap.h"
+
+#include "XRClock.h"
+#include "MiniXCommandPlan.h"
+#ifdef _WIN32
+#include "hwdrivers/miniX/MiniXAPI.h"
+#else
+#include "hwdrivers/miniX/MiniXAPI_Linux.h"
+#endif
+#include "XRLog.h"
+
+MiniXDeviceMap *MiniXDeviceMap::fgInstance = 0;
+
+//---------------------------------------------------------------------------
+MiniXDeviceMap *MiniXDeviceMap::Instance()
+{
+  if (fgInstance == 0)
+    fgInstance = new MiniXDeviceMap();
+  return fgInstance;
+}
+//---------------------------------------------------------------------------
+MiniXDeviceMap::MiniXDeviceMap()
+{
+  debug = Vparams::getParams()->verbose;
+  fValid = kFALSE;
+  fRefreshCount = 0;
+  fLastRefresh = 0;
+  fMinRefreshMs = 1000;
+}
+//---------------------------------------------------------------------------
+void MiniXDeviceMap::Refresh()
+{
+  std::vector<std::string> serials;
+  Long64_t start = XRClock::Get()->Now();
+  if (isMiniXDlg())
+  {
+    ClearDeviceList();
+    GetDeviceList();
+    // The list rebuilt, the DLL may select another device or none
+    MiniXCommandPlan::ForgetSelection();
+    long deviceCount = GetDeviceCount();
+    for (long i = 0; i < deviceCount; i++)
+    {
+      char serialNumber[256] = {0};
+      GetDeviceSerialNumberByIndex(i, serialNumber);
+      serials.push_back(std::string(serialNumber));
+    }
+  }
+
+  fMutex.Lock();
+  fSerials = serials;
+  fIndex.clear();
+  for (size_t i = 0; i < fSerials.size(); i++)
+    fIndex[fSerials[i]] = (long)i;
+  fValid = kTRUE;
+  fRefreshCount++;
+  fLastRefresh = XRClock::Get()->Now();
+  fMutex.UnLock();
+  if (debug > 0)
+    printf("MiniX device map: %d device(s) enumerated in %lld ms\n", (Int_t)serials.size(),
+           (long long)(fLastRefresh - start));
+}
+//---------------------------------------------------------------------------
+void MiniXDeviceMap::Invalidate()
+{
+  fMutex.Lock();
+  fValid = kFALSE;
+  fMutex.UnLock();
+}
+//---------------------------------------------------------------------------
+long MiniXDeviceMap::Find(const char *serialNumber)
+{
+  if (!serialNumber)
+    return -1;
+  long index = -1;
+  fMutex.Lock();
+  std::unordered_map<std::string, long>::const_iterator it = fIndex.find(serialNumber);
+  if (fValid && it != fIndex.end())
+    index = it->second;
+  fMutex.UnLock();
+  return index;
+}
+//---------------------------------------------------------------------------
+long MiniXDeviceMap::Lookup(const char *serialNumber)
+{
+  if (!fValid)
+    Refresh();
+  long index = Find(serialNumber);
+  if (index < 0 && serialNumber && XRClock::Get()->Now() - fLastRefresh >= fMinRefreshMs)
+  {
+    if (debug > 0)
+      printf("MiniX device %s not in the device map, enumerating again\n", serialNumber);
+    Refresh();
+    index = Find(serialNumber);
+  }
+  return index;
+}
+//---------------------------------------------------------------------------
+long MiniXDeviceMap::GetCount()
+{
+  fMutex.Lock();
+  long count = fValid ? (long)fSerials.size() : 0;
+  fMutex.UnLock();
+  return count;
+}
+//---------------------------------------------------------------------------
+std::string MiniXDeviceMap::GetSerial(long index)
+{
+  std::string serial;
+  fMutex.Lock();
+  if (fValid && index >= 0 && index < (long)fSerials.size())
+    serial = fSerials[index];
+  fMutex.UnLock();
+  return serial;
+}
@@ -0,0 +1,53 @@
+#ifndef MINIXDEVICEMAP_H
+#define MINIXDEVICEMAP_H
+
+#include <Rtypes.h>
+#include <TMutex.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+//===========================================
+// Cached enumeration of the MiniX devices of the process.
+// ClearDeviceList/GetDeviceList rescans the USB bus and is slow, so the
+// serial number -> device index map is built once (first lookup or
+// Refresh) and reused by every tube, INIT and config lookup. It is
+// rebuilt on demand and when a serial number is not found, which is how
+// a failed selection shows up after a device was plugged in or replaced.
+// Refresh and Lookup call the DLL: the caller serializes DLL access
+// (MiniXScheduler job or standalone XRay). Find does not and may be
+// called from any thread.
+class MiniXDeviceMap
+{
+ public:
+  static MiniXDeviceMap *Instance();
+
+  // Enumerate the devices again
+  void Refresh();
+  // Forget the enumeration, e.g. after the DLL was closed
+  void Invalidate();
+  Bool_t IsValid() {return fValid;};
+
+  // Device index of serialNumber from the cache, -1 if unknown
+  long Find(const char *serialNumber);
+  // As Find, but enumerates first if the cache is not built yet and once
+  // more (at most every fMinRefreshMs) if serialNumber is not in it
+  long Lookup(const char *serialNumber);
+  long GetCount();
+  std::string GetSerial(long index);
+  Long64_t GetRefreshCount() {return fRefreshCount;};
+
+ private:
+  MiniXDeviceMap();
+
+  static MiniXDeviceMap *fgInstance;
+  Int_t debug;
+  TMutex fMutex;                                // guards the cache
+  std::vector<std::string> fSerials;            // by device index
+  std::unordered_map<std::string, long> fIndex; // serial -> device index
+  Bool_t fValid;
+  Long64_t fRefreshCount;
+  Long64_t fLastRefresh;                        // msec of XRClock
+  Int_t fMinRefreshMs;                          // between refreshes on a miss
+};
+#endif //MINIXDEVICEMAP_H
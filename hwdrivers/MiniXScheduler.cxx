@@ -0,0 +1,136 @@
+#include "stdafx.h"
+#include "MiniXScheduler.h"
+
+#include "XRClock.h"
+#include <TThread.h>
+
+//---------------------------------------------------------------------------
+MiniXScheduler::MiniXScheduler(Int_t maxBatch)
+    : fWork(&fMutex), fDone(&fMutex)
+{
+  fPending = 0;
+  fCurrentDevice = -1;
+  fBatch = 0;
+  fMaxBatch = maxBatch > 0 ? maxBatch : 1;
+  fJobCount = fSwitchCount = fMaxWait = 0;
+  fThreadId = 0;
+  fRunning = kTRUE;
+  fThread = new TThread("MiniXSchedulerThread", ThreadFunc, (void *)this);
+  fThread->Run();
+}
+//---------------------------------------------------------------------------
+MiniXScheduler::~MiniXScheduler()
+{
+  fMutex.Lock();
+  fRunning = kFALSE;
+  fWork.Signal();
+  fMutex.UnLock();
+  if (fThread)
+  {
+    fThread->Join();
+    delete fThread;
+    fThread = 0;
+  }
+}
+//---------------------------------------------------------------------------
+void MiniXScheduler::Run(long deviceIndex, const std::function<void()> &job, Bool_t urgent)
+{
+  if (TThread::SelfId() == fThreadId)
+  {
+    job();
+    return;
+  }
+  Job j;
+  j.device = deviceIndex;
+  j.fn = &job;
+  j.submitted = XRClock::Get()->Now();
+  j.done = kFALSE;
+  fMutex.Lock();
+  if (urgent)
+    fUrgent.push_back(&j);
+  else
+    fQueues[deviceIndex].push_back(&j);
+  fPending++;
+  fWork.Signal();
+  while (!j.done)
+    fDone.Wait();
+  fMutex.UnLock();
+}
+//---------------------------------------------------------------------------
+Int_t MiniXScheduler::GetPendingCount()
+{
+  fMutex.Lock();
+  Int_t n = fPending;
+  fMutex.UnLock();
+  return n;
+}
+//---------------------------------------------------------------------------
+void *MiniXScheduler::ThreadFunc(void *arg)
+{
+  ((MiniXScheduler *)arg)->Loop();
+  return 0;
+}
+//---------------------------------------------------------------------------
+void MiniXScheduler::Loop()
+{
+  fThreadId = TThread::SelfId();
+  fMutex.Lock();
+  while (kTRUE)
+  {
+    // Pending jobs are drained before exit so that no caller is left waiting
+    if (fPending == 0)
+    {
+      if (!fRunning)
+        break;
+      fWork.Wait();
+      continue;
+    }
+    Job *j = NextJob();
+    Long64_t wait = XRClock::Get()->Now() - j->submitted;
+    if (wait > fMaxWait)
+      fMaxWait = wait;
+    fMutex.UnLock();
+    (*j->fn)();
+    fMutex.Lock();
+    fJobCount++;
+    j->done = kTRUE;
+    fDone.Broadcast();
+  }
+  fMutex.UnLock();
+}
+//---------------------------------------------------------------------------
+MiniXScheduler::Job *MiniXScheduler::NextJob()
+{
+  // Called with fMutex held and fPending > 0
+  std::deque<Job *> *q = 0;
+  std::map<long, std::deque<Job *> >::iterator cur = fQueues.find(fCurrentDevice);
+  if (!fUrgent.empty())
+    q = &fUrgent;
+  else if (cur != fQueues.end() && !cur->second.empty() && fBatch < fMaxBatch)
+    q = &cur->second;
+  else
+  {
+    // Round robin: first device after the current one with pending work
+    std::map<long, std::deque<Job *> >::iterator it = fQueues.upper_bound(fCurrentDevice);
+    for (size_t n = 0; n < fQueues.size() && !q; n++, ++it)
+    {
+      if (it == fQueues.end())
+        it = fQueues.begin();
+      if (!it->second.empty())
+        q = &it->second;
+    }
+  }
+  Job *j = q->front();
+  q->pop_front();
+  fPending--;
+  if (j->device != fCurrentDevice)
+  {
+    fCurrentDevice = j->device;
+    fSwitchCount++;
+    fBatch = 0;
+  }
+  else if (fBatch >= fMaxBatch)
+    fBatch = 0; // no other device was waiting
+  fBatch++;
+  return j;
+}
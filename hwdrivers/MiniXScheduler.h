@@ -0,0 +1,62 @@
+#ifndef MINIXSCHEDULER_H
+#define MINIXSCHEDULER_H
+
+#include <Rtypes.h>
+#include <TMutex.h>
+#include <TCondition.h>
+#include <functional>
+#include <deque>
+#include <map>
+
+class TThread;
+
+//===========================================
+// Serializes all MiniX DLL traffic of one process.
+// The DLL selects the active tube with a process-global SetDevice(), so
+// every hardware access of every tube runs as a job on a single worker
+// thread. Pending jobs are queued per device; the worker keeps serving
+// the device that is already selected (up to fMaxBatch jobs in a row)
+// before it moves on to the next device with pending work, which keeps
+// SetDevice switches low while bounding the latency seen by each tube.
+class MiniXScheduler
+{
+ public:
+  MiniXScheduler(Int_t maxBatch = 8);
+  ~MiniXScheduler();
+
+  // Runs job on the DLL thread for deviceIndex and waits for completion.
+  // Called from the DLL thread itself the job runs inline. Urgent jobs
+  // (HV off) are served before the queued jobs of every device.
+  void Run(long deviceIndex, const std::function<void()> &job, Bool_t urgent = kFALSE);
+
+  Long64_t GetJobCount() {return fJobCount;};
+  Long64_t GetSwitchCount() {return fSwitchCount;};
+  Long64_t GetMaxWait() {return fMaxWait;}; // msec from submit to start
+  Int_t GetPendingCount();
+
+ private:
+  struct Job {
+    long device;
+    const std::function<void()> *fn;
+    Long64_t submitted;
+    Bool_t done;
+  };
+
+  static void *ThreadFunc(void *arg);
+  void Loop();
+  Job *NextJob();
+
+  TMutex fMutex;
+  TCondition fWork;
+  TCondition fDone;
+  std::map<long, std::deque<Job *> > fQueues;
+  std::deque<Job *> fUrgent;
+  Int_t fPending;
+  long fCurrentDevice;
+  Int_t fBatch, fMaxBatch;
+  Bool_t fRunning;
+  TThread *fThread;
+  Long_t fThreadId;
+  Long64_t fJobCount, fSwitchCount, fMaxWait;
+};
+#endif //MINIXSCHEDULER_H
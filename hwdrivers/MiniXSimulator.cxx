@@ -0,0 +1,362 @@
+#include "stdafx.h"
+#include "MiniXSimulator.h"
+
+#include <stdio.h>
+#include <string.h>
+#include "XRClock.h"
+#include "../Vparams.h"
+
+MiniXSimulator *MiniXSimulator::fgInstance = 0;
+
+//---------------------------------------------------------------------------
+MiniXSimulator *MiniXSimulator::Instance()
+{
+  if (fgInstance == 0)
+  {
+    fgInstance = new MiniXSimulator();
+    fgInstance->ReadConfig();
+  }
+  return fgInstance;
+}
+//---------------------------------------------------------------------------
+MiniXSimulator::MiniXSimulator(Int_t nDevices)
+{
+  fOpen = kFALSE;
+  fEnumerated = kFALSE;
+  fSelected = 0;
+  fConnectTime = 1500;
+  fUpdateTime = 200;
+  // Typical timing of the MiniX DLL over USB, msec
+  const Int_t latency[kNSimCalls] = {100, 2, 15, 5, 5, 5, 20, 50};
+  for (Int_t i = 0; i < kNSimCalls; i++)
+  {
+    fLatency[i] = latency[i];
+    fCalls[i] = 0;
+  }
+  fBusyTime = 0;
+  Resize(nDevices);
+}
+//---------------------------------------------------------------------------
+void MiniXSimulator::ReadConfig()
+{
+  AnalysisConfig *conf = Vparams::getParams()->conf;
+  LevelParameter *p1 = conf->GetParameter<LevelParameter>("XRSimDevices");
+  if (p1)
+    Resize((Int_t)p1->Level);
+  VectorParameter *p2 = conf->GetParameter<VectorParameter>("XRSimLatency");
+  if (p2)
+    for (Int_t i = 0; i < kNSimCalls && i < (Int_t)p2->Vector.size(); i++)
+      fLatency[i] = (Int_t)p2->Vector[i];
+  LevelParameter *p3 = conf->GetParameter<LevelParameter>("XRSimConnectTime");
+  if (p3)
+    fConnectTime = (Int_t)p3->Level;
+  LevelParameter *p4 = conf->GetParameter<LevelParameter>("XRSimUpdateTime");
+  if (p4)
+    fUpdateTime = (Int_t)p4->Level;
+  for (size_t i = 0; i < fDevices.size(); i++)
+    fDevices[i].tube.ReadConfig();
+}
+//---------------------------------------------------------------------------
+void MiniXSimulator::Resize(Int_t nDevices)
+{
+  if (nDevices < 0)
+    nDevices = 0;
+  size_t old = fDevices.size();
+  fDevices.resize(nDevices);
+  for (size_t i = old; i < fDevices.size(); i++)
+  {
+    Device &d = fDevices[i];
+    char serial[32];
+    sprintf(serial, "SIM%09ld", 123456789L + (long)i);
+    d.serial = serial;
+    d.started = kFALSE;
+    d.commanded = kFALSE;
+    d.readyAt = 0;
+    d.busyStatus = mxstNoStatus;
+    d.lastStatus = mxstNoStatus;
+    d.reqHV = d.settings.HighVoltage_kV = d.tube.GetRequestedHV();
+    d.reqCurrent = d.settings.Current_uA = d.tube.GetRequestedCurrent();
+  }
+}
+//---------------------------------------------------------------------------
+void MiniXSimulator::Open()
+{
+  Call(kSimOpen);
+  fMutex.Lock();
+  fOpen = kTRUE;
+  fMutex.UnLock();
+}
+//---------------------------------------------------------------------------
+byte MiniXSimulator::IsOpen()
+{
+  return fOpen ? 1 : 0;
+}
+//---------------------------------------------------------------------------
+void MiniXSimulator::Close()
+{
+  fMutex.Lock();
+  Long64_t now = NowMs();
+  for (size_t i = 0; i < fDevices.size(); i++)
+  {
+    fDevices[i].tube.Advance(now);
+    fDevices[i].tube.SetHVOn(kFALSE);
+    fDevices[i].started = kFALSE;
+  }
+  fOpen = kFALSE;
+  fEnumerated = kFALSE;
+  fMutex.UnLock();
+}
+//---------------------------------------------------------------------------
+void MiniXSimulator::SendCommand(byte cmd)
+{
+  Call(kSimSendCommand);
+  fMutex.Lock();
+  Device *d = Selected();
+  Long64_t now = NowMs();
+  // Like the controller, ignore commands that are not enabled right now
+  if (!d || !(EnabledCmds(d, now) & cmd))
+  {
+    fMutex.UnLock();
+    return;
+  }
+  d->tube.Advance(now);
+  switch (cmd)
+  {
+  case mxcStartMiniX:
+    d->started = kTRUE;
+    d->commanded = kFALSE;
+    d->busyStatus = mxstConnectingToMiniX;
+    d->readyAt = now + fConnectTime;
+    d->lastStatus = mxstNoStatus;
+    break;
+  case mxcHVOn:
+    d->tube.SetHVOn(kTRUE);
+    d->commanded = kTRUE;
+    break;
+  case mxcHVOff:
+    d->tube.SetHVOn(kFALSE);
+    d->commanded = kTRUE;
+    break;
+  case mxcSetHVandCurrent:
+  {
+    Bool_t inRange = d->tube.SetRequest(d->reqHV, d->reqCurrent);
+    d->settings.HighVoltage_kV = d->tube.GetRequestedHV();
+    d->settings.Current_uA = d->tube.GetRequestedCurrent();
+    if (inRange)
+      d->lastStatus = mxstNoStatus;
+    else if (d->settings.HighVoltage_kV != d->reqHV)
+      d->lastStatus = mxstRequestedVoltageOutOfRange;
+    else
+      d->lastStatus = mxstRequestedCurrentOutOfRange;
+    d->busyStatus = mxstUpdatingSettings;
+    d->readyAt = now + fUpdateTime;
+    d->commanded = kTRUE;
+    break;
+  }
+  case mxcExit:
+    d->tube.SetHVOn(kFALSE);
+    d->started = kFALSE;
+    break;
+  default:
+    break;
+  }
+  fMutex.UnLock();
+}
+//---------------------------------------------------------------------------
+void MiniXSimulator::ReadMonitor(MiniX_Monitor *monitor)
+{
+  Call(kSimReadMonitor);
+  memset(monitor, 0, sizeof(MiniX_Monitor));
+  monitor->mxmReserved = 123.456;
+  fMutex.Lock();
+  Device *d = Selected();
+  Long64_t now = NowMs();
+  monitor->mxmStatusInd = Status(d, now);
+  if (d)
+  {
+    d->tube.Advance(now);
+    monitor->mxmInterLock = d->tube.IsInterlockClosed() ? 1 : 0;
+    monitor->mxmEnabledCmds = EnabledCmds(d, now);
+    if (d->started && now >= d->readyAt)
+    {
+      monitor->mxmRefreshed = 1;
+      monitor->mxmHighVoltage_kV = d->tube.GetHV();
+      monitor->mxmCurrent_uA = d->tube.GetCurrent();
+      monitor->mxmPower_mW = d->tube.GetPower();
+      monitor->mxmTemperatureC = d->tube.GetTemperature();
+      monitor->mxmHVOn = d->tube.IsHVOn() ? 1 : 0;
+      monitor->mxmOutOfRange = d->lastStatus != mxstNoStatus ? 1 : 0;
+    }
+  }
+  fMutex.UnLock();
+}
+//---------------------------------------------------------------------------
+void MiniXSimulator::SetHV(double kV)
+{
+  Call(kSimSetHV);
+  fMutex.Lock();
+  Device *d = Selected();
+  if (d)
+    d->reqHV = kV;
+  fMutex.UnLock();
+}
+//---------------------------------------------------------------------------
+void MiniXSimulator::SetCurrent(double uA)
+{
+  Call(kSimSetCurrent);
+  fMutex.Lock();
+  Device *d = Selected();
+  if (d)
+    d->reqCurrent = uA;
+  fMutex.UnLock();
+}
+//---------------------------------------------------------------------------
+void MiniXSimulator::ReadSettings(MiniX_Settings *settings)
+{
+  Call(kSimReadSettings);
+  fMutex.Lock();
+  Device *d = Selected();
+  if (d)
+    *settings = d->settings;
+  else
+    memset(settings, 0, sizeof(MiniX_Settings));
+  fMutex.UnLock();
+}
+//---------------------------------------------------------------------------
+long MiniXSimulator::ReadSerialNumber()
+{
+  return fOpen && Selected() ? 123456789L + fSelected : 0;
+}
+//---------------------------------------------------------------------------
+void MiniXSimulator::ClearDeviceList()
+{
+  fMutex.Lock();
+  fEnumerated = kFALSE;
+  fMutex.UnLock();
+}
+//---------------------------------------------------------------------------
+void MiniXSimulator::EnumerateDevices()
+{
+  Call(kSimEnumerate);
+  fMutex.Lock();
+  fEnumerated = fOpen;
+  fMutex.UnLock();
+}
+//---------------------------------------------------------------------------
+long MiniXSimulator::GetDeviceCount()
+{
+  return fEnumerated ? (long)fDevices.size() : 0;
+}
+//---------------------------------------------------------------------------
+long MiniXSimulator::GetDeviceSerialNumberByIndex(long index, char *serialNumber)
+{
+  if (!fEnumerated || index < 0 || index >= (long)fDevices.size())
+    return -1;
+  strcpy(serialNumber, fDevices[index].serial.c_str());
+  return 0;
+}
+//---------------------------------------------------------------------------
+void MiniXSimulator::SetDevice(long index)
+{
+  Call(kSimSelect);
+  fMutex.Lock();
+  fSelected = index;
+  fMutex.UnLock();
+}
+//---------------------------------------------------------------------------
+void MiniXSimulator::SetInterlock(long index, Bool_t closed)
+{
+  fMutex.Lock();
+  if (index >= 0 && index < (long)fDevices.size())
+  {
+    fDevices[index].tube.Advance(NowMs());
+    fDevices[index].tube.SetInterlock(closed);
+  }
+  fMutex.UnLock();
+}
+//---------------------------------------------------------------------------
+const char *MiniXSimulator::GetCallName(SimCall_t call)
+{
+  switch (call)
+  {
+  case kSimOpen:
+    return "OpenMiniX";
+  case kSimSelect:
+    return "SetDevice";
+  case kSimReadMonitor:
+    return "ReadMiniXMonitor";
+  case kSimReadSettings:
+    return "ReadMiniXSettings";
+  case kSimSetHV:
+    return "SetMiniXHV";
+  case kSimSetCurrent:
+    return "SetMiniXCurrent";
+  case kSimSendCommand:
+    return "SendMiniXCommand";
+  case kSimEnumerate:
+    return "GetDeviceList";
+  default:
+    return "";
+  }
+}
+//---------------------------------------------------------------------------
+void MiniXSimulator::PrintStatus()
+{
+  printf("MiniX simulator: %d device(s), %lld ms in DLL latencies\n", GetNDevices(), (long long)fBusyTime);
+  for (Int_t i = 0; i < kNSimCalls; i++)
+    printf("  %s: %lld calls, %d ms each\n", GetCallName((SimCall_t)i), (long long)fCalls[i], fLatency[i]);
+}
+//---------------------------------------------------------------------------
+void MiniXSimulator::Call(SimCall_t call)
+{
+  // The real DLL blocks the calling thread for the USB round trip
+  if (fLatency[call] > 0)
+    XRClock::Get()->Sleep(fLatency[call]);
+  fMutex.Lock();
+  fCalls[call]++;
+  fBusyTime += fLatency[call];
+  fMutex.UnLock();
+}
+//---------------------------------------------------------------------------
+MiniXSimulator::Device *MiniXSimulator::Selected()
+{
+  if (!fOpen || !fEnumerated || fSelected < 0 || fSelected >= (long)fDevices.size())
+    return 0;
+  return &fDevices[fSelected];
+}
+//---------------------------------------------------------------------------
+byte MiniXSimulator::Status(Device *d, Long64_t now)
+{
+  if (!fOpen)
+    return mxstNoStatus;
+  if (fDevices.empty())
+    return mxstNoDevicesAttached;
+  if (!d)
+    return mxstNoDeviceSelected;
+  if (!d->started)
+    return mxstMiniXApplicationReady;
+  if (now < d->readyAt)
+    return (byte)d->busyStatus;
+  if (d->lastStatus != mxstNoStatus)
+    return (byte)d->lastStatus;
+  return d->commanded ? mxstMiniXReady : mxstMiniXControllerReady;
+}
+//---------------------------------------------------------------------------
+byte MiniXSimulator::EnabledCmds(Device *d, Long64_t now)
+{
+  if (!d->started)
+    return mxcStartMiniX | mxcExit;
+  if (now < d->readyAt && d->busyStatus == mxstConnectingToMiniX)
+    return mxcExit;
+  byte cmds = mxcSetHVandCurrent | mxcExit;
+  if (d->tube.IsHVOn())
+    cmds |= mxcHVOff;
+  else if (d->tube.IsInterlockClosed())
+    cmds |= mxcHVOn;
+  return cmds;
+}
+//---------------------------------------------------------------------------
+Long64_t MiniXSimulator::NowMs()
+{
+  return XRClock::Get()->Now();
+}
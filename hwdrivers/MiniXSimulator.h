@@ -0,0 +1,97 @@
+#ifndef MINIXSIMULATOR_H
+#define MINIXSIMULATOR_H
+
+#include <Rtypes.h>
+#include <TMutex.h>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include "hwdrivers/miniX/MiniXAPI.h"
+#else
+#include "hwdrivers/miniX/MiniXAPI_Linux.h"
+#endif
+#include "XRayTubeModel.h"
+
+//===========================================
+// Simulated MiniX controller application with N attached tubes.
+// Implements the DLL API (see miniX/MiniXAPI_Linux.cxx) on top of one
+// XRayTubeModel per device, including the controller status sequence
+// (ApplicationReady -> ConnectingToMiniX -> ControllerReady -> MiniXReady,
+// UpdatingSettings after a new setpoint), the enabled command mask and
+// the interlock. Every DLL call blocks for a configurable latency so the
+// scheduling, polling and IPC paths see realistic timing.
+class MiniXSimulator
+{
+ public:
+  enum SimCall_t {
+    kSimOpen, kSimSelect, kSimReadMonitor, kSimReadSettings,
+    kSimSetHV, kSimSetCurrent, kSimSendCommand, kSimEnumerate,
+    kNSimCalls
+  };
+
+  static MiniXSimulator *Instance();
+  MiniXSimulator(Int_t nDevices = 1);
+
+  // Read XRSimDevices, XRSimLatency, XRSimConnectTime, XRSimUpdateTime
+  // and the tube model parameters from params.conf
+  void ReadConfig();
+
+  // DLL API
+  void Open();
+  byte IsOpen();
+  void Close();
+  void SendCommand(byte cmd);
+  void ReadMonitor(MiniX_Monitor *monitor);
+  void SetHV(double kV);
+  void SetCurrent(double uA);
+  void ReadSettings(MiniX_Settings *settings);
+  long ReadSerialNumber();
+  void ClearDeviceList();
+  void EnumerateDevices();
+  long GetDeviceCount();
+  long GetDeviceSerialNumberByIndex(long index, char *serialNumber);
+  void SetDevice(long index);
+
+  // Simulation control
+  void SetLatency(SimCall_t call, Int_t ms) {fLatency[call] = ms;};
+  Int_t GetLatency(SimCall_t call) {return fLatency[call];};
+  void SetInterlock(long index, Bool_t closed);
+  Int_t GetNDevices() {return (Int_t)fDevices.size();};
+  Long64_t GetCallCount(SimCall_t call) {return fCalls[call];};
+  Long64_t GetBusyTime() {return fBusyTime;}; // msec spent in latencies
+  static const char *GetCallName(SimCall_t call);
+  void PrintStatus();
+
+ private:
+  struct Device {
+    std::string serial;
+    XRayTubeModel tube;
+    Bool_t started;
+    Bool_t commanded;   // a command was accepted after the connection
+    Long64_t readyAt;   // msec, end of connecting/updating phase
+    Int_t busyStatus;   // status reported until readyAt
+    Int_t lastStatus;   // status of an out of range request
+    MiniX_Settings settings;
+    double reqHV, reqCurrent;
+  };
+
+  void Resize(Int_t nDevices);
+  void Call(SimCall_t call);
+  Device *Selected();
+  byte Status(Device *d, Long64_t now);
+  byte EnabledCmds(Device *d, Long64_t now);
+  Long64_t NowMs();
+
+  static MiniXSimulator *fgInstance;
+  TMutex fMutex;
+  std::vector<Device> fDevices;
+  Bool_t fOpen;
+  Bool_t fEnumerated;
+  long fSelected;
+  Int_t fConnectTime;  // msec in mxstConnectingToMiniX after StartMiniX
+  Int_t fUpdateTime;   // msec in mxstUpdatingSettings after a new setpoint
+  Int_t fLatency[kNSimCalls];
+  Long64_t fCalls[kNSimCalls];
+  Long64_t fBusyTime;
+};
+#endif //MINIXSIMULATOR_H
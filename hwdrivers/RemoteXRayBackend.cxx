@@ -0,0 +1,513 @@
+#include "stdafx.h"
+#include "RemoteXRayBackend.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <cstdlib>
+#include <vector>
+#include "XRClock.h"
+#include "XRaySequence.h"
+#include "ipc/CommandLine.h"
+#include "ipc/TransportClient.h"
+#include "ipc/XRayProtocol.h"
+#include "XRLog.h"
+
+//---------------------------------------------------------------------------
+RemoteXRayBackend::RemoteXRayBackend(const char *serialNumber)
+{
+  debug = Vparams::getParams()->verbose;
+  if (serialNumber)
+    fSerialNumber = serialNumber;
+  fPipeClient = 0;
+  fProtocol = 0;
+  fNextId = 0;
+  memset(&fCache, 0, sizeof(fCache));
+  fCacheTime = 0;
+  fCacheValid = kFALSE;
+  fCacheGen = 0;
+  fReads = fCacheHits = 0;
+  LevelParameter *p1 = Vparams::getParams()->conf->GetParameter<LevelParameter>("XRRemoteCache");
+  fCacheMs = p1 ? (Int_t)p1->Level : XRREMOTECACHE;
+  LevelParameter *p2 = Vparams::getParams()->conf->GetParameter<LevelParameter>("XRRemoteReconnect");
+  fReconnectMs = p2 ? (Int_t)p2->Level : XRREMOTERECONNECT;
+  memset(&fLink, 0, sizeof(fLink));
+  fDownSince = -1;
+  fGaveUp = kFALSE;
+}
+//---------------------------------------------------------------------------
+// Fill st from a binary state reply: an XRayMsgState, followed by its
+// XRayMsgVersion from version 5 on; kFALSE if it is neither
+static Bool_t FromStateReply(const std::string &resp, XRayState_t &st)
+{
+  XRayMsgState m;
+  if (resp.size() != sizeof(m) && resp.size() != sizeof(m) + sizeof(XRayMsgVersion))
+    return kFALSE;
+  memcpy(&m, resp.data(), sizeof(m));
+  st.Power = m.power != 0;
+  st.VoltageToSet = m.voltageToSet;
+  st.ActualVoltage = m.actualVoltage;
+  st.CurrentToSet = m.currentToSet;
+  st.ActualCurrent = m.actualCurrent;
+  st.ActualPower = m.actualPower;
+  st.Temperature = m.temperature;
+  return kTRUE;
+}
+//---------------------------------------------------------------------------
+RemoteXRayBackend::~RemoteXRayBackend()
+{
+  if (fPipeClient)
+  {
+    std::string resp;
+    if (fPipeClient->isConnected())
+      Send("SHUTDOWN", &resp); // optional
+    fPipeMutex.Lock();
+    fPipeClient->disconnect();
+    delete fPipeClient;
+    fPipeClient = 0;
+    fPipeMutex.UnLock();
+  }
+}
+//---------------------------------------------------------------------------
+Bool_t RemoteXRayBackend::Connect(const std::string &address, unsigned long timeoutMs)
+{
+  fAddress = address;
+  fPipeClient = createClientTransport(address);
+  if (!fPipeClient || !fPipeClient->connect(timeoutMs))
+  {
+    if (debug > 0)
+      printf("Could not connect to XRayService at %s. Falling back to local.\n", address.c_str());
+    delete fPipeClient;
+    fPipeClient = 0;
+    return kFALSE;
+  }
+  if (!Handshake())
+  {
+    if (debug > 0)
+      printf("Failed to INIT remote XRay service, falling back to local.\n");
+    delete fPipeClient;
+    fPipeClient = 0;
+    return kFALSE;
+  }
+  if (debug > 0)
+    printf("XRay running in REMOTE mode via %s, %s protocol\n", address.c_str(),
+           fProtocol > 0 ? "binary" : "text");
+  return kTRUE;
+}
+//---------------------------------------------------------------------------
+Bool_t RemoteXRayBackend::Handshake()
+{
+  // INIT|<serialNumber or empty>|PROTO|<binary version we speak>, as text
+  fProtocol = 0;
+  fPipeClient->setBinary(kFALSE);
+  std::string resp;
+  char proto[32];
+  sprintf(proto, "|PROTO|%d", (Int_t)kXRayProtoVersion);
+  if (!fPipeClient->call(std::string("INIT|") + fSerialNumber + proto, resp) || resp.rfind("OK", 0) != 0)
+  {
+    if (debug > 0)
+      printf("RemoteXRayBackend: INIT failed. Resp='%s'\n", resp.c_str());
+    fPipeClient->disconnect();
+    return kFALSE;
+  }
+  // OK|<serial>|PROTO|<version>; without it the service speaks text only
+  CommandLine tok(resp);
+  if (tok[2].is("PROTO"))
+    fProtocol = (Int_t)tok[3].integer();
+  fPipeClient->setBinary(fProtocol > 0);
+  return kTRUE;
+}
+//---------------------------------------------------------------------------
+Bool_t RemoteXRayBackend::Reconnect()
+{
+  // The first call that finds the service gone waits up to fReconnectMs for
+  // it to come back, retrying at a doubling interval; while it stays away,
+  // every later call tries once
+  XRClock *clock = XRClock::Get();
+  if (fDownSince < 0)
+  {
+    fDownSince = clock->Now();
+    fLink.Drops++;
+    printf("RemoteXRayBackend: lost XRayService at %s, reconnecting\n", fAddress.c_str());
+  }
+  Bool_t ok = clock->PollUntil([this]() { return fPipeClient->connect(0) && Handshake(); },
+                               fGaveUp ? 0 : fReconnectMs);
+  if (!ok)
+  {
+    fGaveUp = kTRUE;
+    return kFALSE;
+  }
+  Long64_t down = clock->Now() - fDownSince;
+  fLink.Reconnects++;
+  fLink.DowntimeMs += down;
+  if (down > fLink.MaxDowntimeMs)
+    fLink.MaxDowntimeMs = down;
+  fDownSince = -1;
+  fGaveUp = kFALSE;
+  Invalidate();
+  printf("RemoteXRayBackend: reconnected to XRayService after %lld ms\n", (long long)down);
+  return kTRUE;
+}
+//---------------------------------------------------------------------------
+// Read-only commands: repeated after a reconnect if the connection broke
+// before the reply came
+static Bool_t IsIdempotent(const std::string &req)
+{
+  CommandLine tok(req);
+  switch (tok[0].hash())
+  {
+  case CommandHash("GET_STATE"):
+  case CommandHash("READ_DATA"):
+  case CommandHash("GET_SERIAL"):
+  case CommandHash("QUEUE_STATS"):
+  case CommandHash("RAMP_STATUS"):
+  case CommandHash("PRINT_STATUS"):
+  case CommandHash("GET_DEVICE_LIST"):
+  case CommandHash("GET_DEVICE_COUNT"):
+  case CommandHash("GET_DEVICE_SERIAL"):
+    return kTRUE;
+  default:
+    return kFALSE;
+  }
+}
+//---------------------------------------------------------------------------
+Bool_t RemoteXRayBackend::Retry(const std::function<Bool_t()> &exchange, Bool_t idempotent, const char *what)
+{
+  // One request at a time on the connection, whichever thread sends it
+  fPipeMutex.Lock();
+  if (!fPipeClient)
+  {
+    fPipeMutex.UnLock();
+    return kFALSE;
+  }
+  for (Int_t attempt = 0;; attempt++)
+  {
+    if (!fPipeClient->isConnected() && !Reconnect())
+      break;
+    if (exchange())
+    {
+      fPipeMutex.UnLock();
+      return kTRUE;
+    }
+    // Connection broke: a command the service may have applied is not sent again
+    if (attempt > 0 || !idempotent)
+      break;
+    fLink.Retries++;
+  }
+  fLink.Failed++;
+  fPipeMutex.UnLock();
+  printf("RemoteXRayBackend: %s not answered, XRayService %s\n", what,
+         idempotent ? "unreachable" : "connection lost, command not repeated");
+  return kFALSE;
+}
+//---------------------------------------------------------------------------
+void RemoteXRayBackend::Resync(XRayState_t &st)
+{
+  // A command that did not go through: show the state of the service
+  // rather than the setpoints it did not get
+  RefreshState(st);
+}
+//---------------------------------------------------------------------------
+Bool_t RemoteXRayBackend::SetPower(XRayState_t &st, Bool_t power)
+{
+  Invalidate();
+  if (fProtocol > 0)
+  {
+    XRayMsgSetpoints m;
+    memset(&m, 0, sizeof(m));
+    m.power = power ? 1 : 0;
+    m.voltage = st.VoltageToSet;
+    m.current = st.CurrentToSet;
+    if (SendBinary(XRayOpSetPower, &m, sizeof(m), 0))
+      return kTRUE;
+    Resync(st);
+    return kFALSE;
+  }
+  char buf[128];
+  sprintf(buf, "SET_POWER|%d|%.6f|%.6f", power ? 1 : 0, (double)st.VoltageToSet, (double)st.CurrentToSet);
+  std::string resp;
+  if (Send(buf, &resp))
+    return kTRUE;
+  // The service's power state stands, not the one asked for
+  Resync(st);
+  return kFALSE;
+}
+//---------------------------------------------------------------------------
+void RemoteXRayBackend::SetVoltage(XRayState_t &st)
+{
+  Invalidate();
+  char buf[64];
+  sprintf(buf, "SET_VOLTAGE|%.6f", (double)st.VoltageToSet);
+  std::string resp;
+  if (!Send(buf, &resp))
+    Resync(st);
+}
+//---------------------------------------------------------------------------
+void RemoteXRayBackend::SetCurrent(XRayState_t &st)
+{
+  Invalidate();
+  char buf[64];
+  sprintf(buf, "SET_CURRENT|%.6f", (double)st.CurrentToSet);
+  std::string resp;
+  if (!Send(buf, &resp))
+    Resync(st);
+}
+//---------------------------------------------------------------------------
+void RemoteXRayBackend::SetHVAndCurrent(XRayState_t &st)
+{
+  Invalidate();
+  // The service commits both setpoints in one step
+  if (fProtocol > 0)
+  {
+    XRayMsgSetpoints m;
+    memset(&m, 0, sizeof(m));
+    m.voltage = st.VoltageToSet;
+    m.current = st.CurrentToSet;
+    if (!SendBinary(XRayOpSetSetpoints, &m, sizeof(m), 0))
+      Resync(st);
+    return;
+  }
+  char buf[96];
+  sprintf(buf, "SET_HV_I|%.6f|%.6f", (double)st.VoltageToSet, (double)st.CurrentToSet);
+  std::string resp;
+  if (!Send(buf, &resp))
+    Resync(st);
+}
+//---------------------------------------------------------------------------
+void RemoteXRayBackend::ReadData(XRayState_t &st, UInt_t fields)
+{
+  // The service always answers with the full state, so a fresh reading
+  // serves any fields
+  XRClock *clock = XRClock::Get();
+  fCacheMutex.Lock();
+  fReads++;
+  if (fCacheValid && clock->Now() - fCacheTime < fCacheMs)
+  {
+    fCacheHits++;
+    st = fCache;
+    fCacheMutex.UnLock();
+    return;
+  }
+  ULong64_t gen = fCacheGen;
+  fCacheMutex.UnLock();
+
+  XRayState_t fresh = st;
+  Bool_t ok = FetchData(fresh);
+
+  fCacheMutex.Lock();
+  // Not if a command changed the tube meanwhile
+  fCacheValid = ok && gen == fCacheGen;
+  if (fCacheValid)
+  {
+    fCache = fresh;
+    fCacheTime = clock->Now();
+  }
+  fCacheMutex.UnLock();
+  if (ok)
+    st = fresh;
+  if (debug > 1 && fields == kXRAllFields)
+  {
+    printf("(remote) VoltageToSet: %f\n", st.VoltageToSet);
+    printf("(remote) CurrentToSet: %f\n", st.CurrentToSet);
+  }
+}
+//---------------------------------------------------------------------------
+Bool_t RemoteXRayBackend::FetchData(XRayState_t &st)
+{
+  std::string resp;
+  if (fProtocol > 0)
+    return SendBinary(XRayOpReadData, 0, 0, &resp) && FromStateReply(resp, st);
+  return Send("READ_DATA", &resp) && ParseState(resp, st);
+}
+//---------------------------------------------------------------------------
+void RemoteXRayBackend::Invalidate()
+{
+  fCacheMutex.Lock();
+  fCacheValid = kFALSE;
+  fCacheGen++;
+  fCacheMutex.UnLock();
+}
+//---------------------------------------------------------------------------
+void RemoteXRayBackend::RefreshState(XRayState_t &st)
+{
+  std::string resp;
+  if (fProtocol > 0)
+  {
+    if (SendBinary(XRayOpGetState, 0, 0, &resp))
+      FromStateReply(resp, st);
+  }
+  else if (Send("GET_STATE", &resp))
+    ParseState(resp, st);
+}
+//---------------------------------------------------------------------------
+void RemoteXRayBackend::PrintStatus()
+{
+  fCacheMutex.Lock();
+  printf("Remote reads: %llu, %llu served from the %d ms cache\n", (unsigned long long)fReads,
+         (unsigned long long)fCacheHits, fCacheMs);
+  fCacheMutex.UnLock();
+  XRayLinkStats_t link;
+  GetLinkStats(link);
+  printf("Service link: %s, %lld drops, %lld reconnects, %lld retries, %lld failed, down %lld ms (max %lld)\n",
+         link.Down ? "down" : "up", link.Drops, link.Reconnects, link.Retries, link.Failed,
+         link.DowntimeMs, link.MaxDowntimeMs);
+  std::string resp;
+  Send("PRINT_STATUS", &resp);
+}
+//---------------------------------------------------------------------------
+void RemoteXRayBackend::GetDeviceList()
+{
+  std::string resp;
+  Send("GET_DEVICE_LIST", &resp);
+}
+//---------------------------------------------------------------------------
+long RemoteXRayBackend::GetDeviceCount()
+{
+  std::string resp;
+  if (Send("GET_DEVICE_COUNT", &resp) && resp.rfind("OK|", 0) == 0)
+  {
+    CommandLine tok(resp);
+    if (tok.size() >= 2)
+      return tok[1].integer();
+  }
+  return 0;
+}
+//---------------------------------------------------------------------------
+long RemoteXRayBackend::GetDeviceSerialNumberByIndex(long lDeviceIndex, char *strSerialNumber)
+{
+  char buf[64];
+  sprintf(buf, "GET_DEVICE_SERIAL|%ld", lDeviceIndex);
+  std::string resp;
+  if (Send(buf, &resp) && resp.rfind("OK|", 0) == 0)
+  {
+    CommandLine tok(resp);
+    if (tok.size() >= 3)
+    {
+      if (strSerialNumber)
+      {
+        size_t n = tok[2].n < 255 ? tok[2].n : 255;
+        memcpy(strSerialNumber, tok[2].p, n);
+        strSerialNumber[n] = 0;
+      }
+      return tok[1].integer();
+    }
+  }
+  return -1;
+}
+//---------------------------------------------------------------------------
+void RemoteXRayBackend::SetDevice(long lDeviceIndex)
+{
+  Invalidate();
+  char buf[64];
+  sprintf(buf, "SET_DEVICE|%ld", lDeviceIndex);
+  std::string resp;
+  Send(buf, &resp);
+}
+//---------------------------------------------------------------------------
+Bool_t RemoteXRayBackend::ExecCommand(const std::string &cmdstr, std::string *result)
+{
+  // Compiled here first: a program with a new line would reach the
+  // service in part, as two request lines
+  std::vector<XRaySeqInstr_t> prog;
+  std::string error;
+  if (!XRaySequence::Compile(cmdstr, prog, error))
+  {
+    *result = "ERR|" + error;
+    return kTRUE;
+  }
+  Invalidate();
+  // The service answers once the program is over: it runs on a connection
+  // of its own, so reads and commands of this backend go on meanwhile.
+  // That connection needs the control of the tube this one may hold.
+  std::string resp;
+  Send("RELEASE", &resp);
+  ClientTransport *client = fAddress.empty() ? 0 : createClientTransport(fAddress);
+  *result = "ERR";
+  if (client && client->connect() && client->call(std::string("INIT|") + fSerialNumber, resp))
+  {
+    // A refusal (ERR|busy, ERR|leased...) is passed on as it came
+    if (resp.rfind("OK", 0) != 0 || client->call(std::string("EXEC|") + cmdstr, resp))
+      *result = resp.rfind("OK|", 0) == 0 ? resp.substr(3) : resp;
+  }
+  if (client)
+    client->disconnect();
+  delete client;
+  Invalidate();
+  return kTRUE;
+}
+//---------------------------------------------------------------------------
+Bool_t RemoteXRayBackend::Send(const std::string &req, std::string *resp)
+{
+  std::string reply;
+  Bool_t ok = kFALSE;
+  // Text command in a frame on a binary connection
+  if (!Retry([&]() {
+        return fProtocol > 0 ? Exchange(XRayOpText, req.data(), req.size(), &reply, ok)
+                             : (ok = fPipeClient->call(req, reply));
+      }, IsIdempotent(req), req.c_str()))
+    return kFALSE;
+  if (resp)
+    *resp = reply;
+  // The service answers OK or OK|..., anything else (ERR|leased,
+  // ERR|readonly...) was refused, whichever the protocol
+  return ok && reply.compare(0, 2, "OK") == 0;
+}
+//---------------------------------------------------------------------------
+Bool_t RemoteXRayBackend::SendBinary(Int_t op, const void *body, size_t size, std::string *respBody)
+{
+  Bool_t ok = kFALSE;
+  char what[32];
+  sprintf(what, "binary op %d", op);
+  Bool_t idempotent = op == XRayOpPing || op == XRayOpGetState || op == XRayOpReadData;
+  return Retry([&]() { return Exchange(op, body, size, respBody, ok); }, idempotent, what) && ok;
+}
+//---------------------------------------------------------------------------
+Bool_t RemoteXRayBackend::Exchange(Int_t op, const void *body, size_t size, std::string *respBody, Bool_t &ok)
+{
+  ok = kFALSE;
+  UInt_t id = ++fNextId;
+  std::string reply;
+  if (!fPipeClient->callFrame(XRayEncode((uint16_t)op, 0, id, body, size), reply))
+    return kFALSE;
+  XRayMsgHeader h;
+  const char *replyBody;
+  size_t replySize;
+  if (!XRayDecode(reply, h, replyBody, replySize) || h.op != op || h.id != id)
+  {
+    if (debug > 0)
+      printf("RemoteXRayBackend: unexpected binary reply to op %d\n", op);
+    return kTRUE;
+  }
+  if (respBody)
+    respBody->assign(replyBody, replySize);
+  if (h.status != XRayStatusOk && debug > 0)
+    printf("RemoteXRayBackend: op %d failed with status %d\n", op, (Int_t)h.status);
+  ok = h.status == XRayStatusOk;
+  return kTRUE;
+}
+//---------------------------------------------------------------------------
+void RemoteXRayBackend::GetLinkStats(XRayLinkStats_t &stats)
+{
+  fPipeMutex.Lock();
+  stats = fLink;
+  stats.Down = fDownSince >= 0;
+  if (stats.Down)
+    stats.DowntimeMs += XRClock::Get()->Now() - fDownSince;
+  fPipeMutex.UnLock();
+}
+//---------------------------------------------------------------------------
+Bool_t RemoteXRayBackend::ParseState(const std::string &resp, XRayState_t &st)
+{
+  if (resp.rfind("OK|", 0) != 0)
+    return kFALSE;
+  CommandLine tok(resp);
+  if (tok.size() < 8)
+    return kFALSE;
+  st.Power = tok[1].integer() != 0;
+  st.VoltageToSet = (Float_t)tok[2].number();
+  st.ActualVoltage = (Float_t)tok[3].number();
+  st.CurrentToSet = (Float_t)tok[4].number();
+  st.ActualCurrent = (Float_t)tok[5].number();
+  st.ActualPower = (Float_t)tok[6].number();
+  st.Temperature = (Float_t)tok[7].number();
+  return kTRUE;
+}
@@ -0,0 +1,107 @@
+#ifndef REMOTEXRAYBACKEND_H
+#define REMOTEXRAYBACKEND_H
+
+#include <TMutex.h>
+#include <functional>
+#include <vector>
+#include "XRayBackend.h"
+
+class ClientTransport;
+
+// Connection to the service over the life of a RemoteXRayBackend, msec
+typedef struct {
+  Long64_t Drops;          // connection found broken
+  Long64_t Reconnects;     // back with INIT redone
+  Long64_t Retries;        // read-only commands sent again
+  Long64_t Failed;         // commands that got no answer
+  Long64_t DowntimeMs, MaxDowntimeMs;
+  Bool_t Down;
+} XRayLinkStats_t;
+
+//===========================================
+// Tube served by a separate XRayService process: every call is forwarded
+// as one request over the service transport, a named pipe, Unix-domain
+// socket or loopback TCP connection (see main.cxx for the protocol).
+// The binary protocol is negotiated at INIT; state polls and setpoints
+// then go as fixed-layout frames, other calls as text in a frame. An
+// older service keeps the connection on text lines.
+// Readings are cached for a freshness window (XRRemoteCache): one
+// READ_DATA answers every field read within it. XRay reads a tube under
+// its own lock, so there is never a second read in flight to wait for.
+// Any command that changes the tube drops the cached reading.
+// A broken connection is reconnected and INIT redone, the first call
+// waiting up to XRRemoteReconnect msec for a restarted service. A
+// read-only command is then sent again; a command that may have been
+// applied is not: it fails, is reported, and the tube state is read back.
+// Calls from several threads take turns on the connection; EXEC, which
+// lasts the whole program, opens a connection of its own.
+class RemoteXRayBackend : public XRayBackend
+{
+ public:
+  RemoteXRayBackend(const char *serialNumber = 0);
+  virtual ~RemoteXRayBackend();
+
+  // Connect and send INIT|<serial>|PROTO|<version>; kFALSE if the service
+  // is not reachable. address as in ipc/Transport.h: pipe name,
+  // unix:<path> or tcp:[host:]port
+  Bool_t Connect(const std::string &address, unsigned long timeoutMs = 5000);
+
+  virtual const char *GetName() {return "Remote";};
+  virtual HWmode_t GetMode() {return REAL_TIME;};
+  virtual const char *GetSerialNumber() {return fSerialNumber.c_str();};
+
+  virtual Bool_t SetPower(XRayState_t &st, Bool_t power);
+  virtual void SetVoltage(XRayState_t &st);
+  virtual void SetCurrent(XRayState_t &st);
+  virtual void SetHVAndCurrent(XRayState_t &st);
+  virtual void ReadData(XRayState_t &st, UInt_t fields);
+  virtual void RefreshState(XRayState_t &st);
+  virtual void PrintStatus();
+
+  virtual void GetDeviceList();
+  virtual long GetDeviceCount();
+  virtual long GetDeviceSerialNumberByIndex(long lDeviceIndex, char *strSerialNumber);
+  virtual void SetDevice(long lDeviceIndex);
+  virtual Bool_t ExecCommand(const std::string &cmdstr, std::string *result);
+  Int_t GetProtocol() {return fProtocol;};
+  void GetLinkStats(XRayLinkStats_t &stats);
+
+ private:
+  Bool_t Send(const std::string &req, std::string *resp);
+  // One binary request; kTRUE if answered XRayStatusOk, with its body
+  Bool_t SendBinary(Int_t op, const void *body, size_t size, std::string *respBody);
+  // One frame round trip; kFALSE if the connection broke, ok as SendBinary
+  Bool_t Exchange(Int_t op, const void *body, size_t size, std::string *respBody, Bool_t &ok);
+  // exchange() on a live connection, again after a reconnect if idempotent
+  Bool_t Retry(const std::function<Bool_t()> &exchange, Bool_t idempotent, const char *what);
+  // INIT on a new connection
+  Bool_t Handshake();
+  Bool_t Reconnect();
+  void Resync(XRayState_t &st);
+  // Fill st from an OK|power|V|Vact|I|Iact|P|T reply
+  static Bool_t ParseState(const std::string &resp, XRayState_t &st);
+  // One READ_DATA round trip
+  Bool_t FetchData(XRayState_t &st);
+  // Cached reading outdated by a command sent to the tube
+  void Invalidate();
+
+  Int_t debug;
+  std::string fSerialNumber;
+  std::string fAddress;
+  ClientTransport *fPipeClient;
+  TMutex fPipeMutex;      // fPipeClient, fProtocol, fNextId, fLink: one request at a time
+  Int_t fProtocol;        // negotiated binary version, 0 = text
+  UInt_t fNextId;         // of binary requests
+  TMutex fCacheMutex;     // guards the read cache
+  XRayState_t fCache;     // last reading
+  Long64_t fCacheTime;    // msec of XRClock
+  Bool_t fCacheValid;
+  ULong64_t fCacheGen;    // Invalidate() calls
+  Int_t fCacheMs;         // freshness window
+  ULong64_t fReads, fCacheHits;
+  Int_t fReconnectMs;     // wait for the service to come back
+  XRayLinkStats_t fLink;
+  Long64_t fDownSince;    // msec of XRClock, -1 while connected
+  Bool_t fGaveUp;         // waited fReconnectMs already
+};
+#endif //REMOTEXRAYBACKEND_H
@@ -0,0 +1,55 @@
+#include "stdafx.h"
+#include "SimXRayBackend.h"
+
+#include <stdio.h>
+#include "XRClock.h"
+#include "XRLog.h"
+
+//---------------------------------------------------------------------------
+SimXRayBackend::SimXRayBackend(const char *serialNumber)
+{
+  debug = Vparams::getParams()->verbose;
+  fSerialNumber = serialNumber ? serialNumber : "SIM_MODE";
+  fTube.ReadConfig();
+  fTube.Advance(XRClock::Get()->Now());
+}
+//---------------------------------------------------------------------------
+Bool_t SimXRayBackend::SetPower(XRayState_t &st, Bool_t power)
+{
+  if (debug > 0)
+    printf("XRay in simulation mode!\n");
+  fTube.Advance(XRClock::Get()->Now());
+  fTube.SetRequest(st.VoltageToSet, st.CurrentToSet);
+  fTube.SetHVOn(power);
+  if (!power)
+  {
+    st.ActualVoltage = 0.0;
+    st.ActualCurrent = 0.0;
+  }
+  return kTRUE;
+}
+//---------------------------------------------------------------------------
+void SimXRayBackend::Apply(XRayState_t &st)
+{
+  fTube.Advance(XRClock::Get()->Now());
+  fTube.SetRequest(st.VoltageToSet, st.CurrentToSet);
+}
+//---------------------------------------------------------------------------
+void SimXRayBackend::ReadData(XRayState_t &st, UInt_t fields)
+{
+  fTube.Advance(XRClock::Get()->Now());
+  if (fields & kXRVoltage)
+    st.ActualVoltage = (Float_t)fTube.GetHV();
+  if (fields & kXRCurrent)
+    st.ActualCurrent = (Float_t)fTube.GetCurrent();
+  if (fields & kXRPower)
+    st.ActualPower = (Float_t)fTube.GetPower();
+  if (fields & kXRTemperature)
+    st.Temperature = (Float_t)fTube.GetTemperature();
+}
+//---------------------------------------------------------------------------
+void SimXRayBackend::SetDevice(long)
+{
+  if (debug > 0)
+    printf("SetDevice in simulation mode - no action taken\n");
+}
@@ -0,0 +1,37 @@
+#ifndef SIMXRAYBACKEND_H
+#define SIMXRAYBACKEND_H
+
+#include "XRayBackend.h"
+#include "XRayTubeModel.h"
+
+//===========================================
+// Tube without hardware: measured values come from XRayTubeModel, so
+// HV and current ramp to the setpoints and the anode warms up with the
+// power draw instead of jumping to the requested values
+class SimXRayBackend : public XRayBackend
+{
+ public:
+  SimXRayBackend(const char *serialNumber = "SIM_MODE");
+  virtual ~SimXRayBackend() {};
+
+  virtual const char *GetName() {return "Simulation";};
+  virtual HWmode_t GetMode() {return SIMULATION;};
+  virtual const char *GetSerialNumber() {return fSerialNumber.c_str();};
+
+  virtual Bool_t SetPower(XRayState_t &st, Bool_t power);
+  virtual void SetVoltage(XRayState_t &st) {Apply(st);};
+  virtual void SetCurrent(XRayState_t &st) {Apply(st);};
+  virtual void SetHVAndCurrent(XRayState_t &st) {Apply(st);};
+  virtual void ReadData(XRayState_t &st, UInt_t fields);
+  virtual void SetDevice(long);
+
+  XRayTubeModel *GetTube() {return &fTube;};
+
+ private:
+  void Apply(XRayState_t &st);
+
+  Int_t debug;
+  std::string fSerialNumber;
+  XRayTubeModel fTube;
+};
+#endif //SIMXRAYBACKEND_H
@@ -0,0 +1,116 @@
+#include "stdafx.h"
+#include "XRClock.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <TSystem.h>
+
+XRClock *XRClock::fgClock = 0;
+
+//---------------------------------------------------------------------------
+XRClock *XRClock::Get()
+{
+  if (fgClock == 0)
+  {
+    const char *env = getenv("XRAY_CLOCK");
+    if (env && strcmp(env, "virtual") == 0)
+      fgClock = new XRVirtualClock();
+    else
+      fgClock = new XRSystemClock();
+  }
+  return fgClock;
+}
+//---------------------------------------------------------------------------
+void XRClock::Set(XRClock *clock)
+{
+  fgClock = clock;
+}
+//---------------------------------------------------------------------------
+Bool_t XRClock::PollUntil(const std::function<Bool_t()> &done, Long64_t timeoutMs,
+                          Int_t firstDelayMs, Int_t maxDelayMs)
+{
+  Long64_t deadline = Now() + timeoutMs;
+  Long64_t delay = firstDelayMs;
+  while (!done())
+  {
+    Long64_t left = deadline - Now();
+    if (left <= 0)
+      return kFALSE;
+    Sleep(delay < left ? delay : left);
+    delay = delay * 2 < maxDelayMs ? delay * 2 : maxDelayMs;
+  }
+  return kTRUE;
+}
+//---------------------------------------------------------------------------
+Long64_t XRSystemClock::Now()
+{
+  return (Long64_t)gSystem->Now();
+}
+//---------------------------------------------------------------------------
+void XRSystemClock::Sleep(Long64_t ms)
+{
+  if (ms > 0)
+    gSystem->Sleep((UInt_t)ms);
+}
+//---------------------------------------------------------------------------
+XRVirtualClock::XRVirtualClock(Long64_t startMs, Int_t settleMs)
+    : fCond(&fMutex)
+{
+  // Start at wall time so that timestamps stay plausible
+  fNow = startMs > 0 ? startMs : (Long64_t)gSystem->Now();
+  fSettleMs = settleMs > 0 ? settleMs : 1;
+}
+//---------------------------------------------------------------------------
+Long64_t XRVirtualClock::Now()
+{
+  fMutex.Lock();
+  Long64_t now = fNow;
+  fMutex.UnLock();
+  return now;
+}
+//---------------------------------------------------------------------------
+void XRVirtualClock::Sleep(Long64_t ms)
+{
+  if (ms <= 0)
+    return;
+  fMutex.Lock();
+  Long64_t wake = fNow + ms;
+  fWakeups.insert(wake);
+  fCond.Broadcast(); // a former earliest sleeper has to re-check
+  while (fNow < wake)
+  {
+    if (*fWakeups.begin() == wake)
+    {
+      // Earliest sleeper: jump once nobody registered an earlier wake-up
+      // within the settle period
+      if (fCond.TimedWaitRelative(fSettleMs) != 0 && fNow < wake && *fWakeups.begin() == wake)
+      {
+        fNow = wake;
+        fCond.Broadcast();
+      }
+    }
+    else
+      fCond.Wait();
+  }
+  fWakeups.erase(fWakeups.find(wake));
+  fCond.Broadcast(); // next sleeper becomes the earliest
+  fMutex.UnLock();
+}
+//---------------------------------------------------------------------------
+void XRVirtualClock::Advance(Long64_t ms)
+{
+  if (ms <= 0)
+    return;
+  fMutex.Lock();
+  fNow += ms;
+  fCond.Broadcast();
+  fMutex.UnLock();
+}
+//---------------------------------------------------------------------------
+Int_t XRVirtualClock::GetSleepers()
+{
+  fMutex.Lock();
+  Int_t n = (Int_t)fWakeups.size();
+  fMutex.UnLock();
+  return n;
+}
@@ -0,0 +1,73 @@
+#ifndef XRCLOCK_H
+#define XRCLOCK_H
+
+#include <Rtypes.h>
+#include <TMutex.h>
+#include <TCondition.h>
+#include <set>
+#include <functional>
+
+//===========================================
+// Time source of the X-ray drivers.
+// Every sleep, timeout and timestamp in hwdrivers goes through
+// XRClock::Get(), which is the system clock unless another clock was
+// installed with XRClock::Set() or XRAY_CLOCK=virtual is set in the
+// environment. All times are in msec.
+class XRClock
+{
+ public:
+  virtual ~XRClock() {};
+
+  virtual Long64_t Now() = 0;
+  virtual void Sleep(Long64_t ms) = 0;
+  virtual Bool_t IsVirtual() {return kFALSE;};
+  // Call done() until it returns kTRUE or timeoutMs passed, sleeping
+  // firstDelayMs after the first miss and doubling up to maxDelayMs.
+  // Returns the last result of done()
+  Bool_t PollUntil(const std::function<Bool_t()> &done, Long64_t timeoutMs,
+                   Int_t firstDelayMs = 10, Int_t maxDelayMs = 250);
+
+  static XRClock *Get();
+  // Install a clock before any driver object is created; not owned
+  static void Set(XRClock *clock);
+
+ private:
+  static XRClock *fgClock;
+};
+
+//===========================================
+// Wall clock: gSystem->Now() / gSystem->Sleep()
+class XRSystemClock : public XRClock
+{
+ public:
+  virtual Long64_t Now();
+  virtual void Sleep(Long64_t ms);
+};
+
+//===========================================
+// Discrete-event clock for simulated runs.
+// Time only moves when threads sleep: the sleeper with the earliest
+// wake-up time waits a short real-time settle period (so that threads
+// still running can register their own sleeps), then the clock jumps
+// straight to its wake-up time. Hours of simulated operation therefore
+// take about one real msec per sleep. Advance() moves time by hand for
+// single-threaded tests.
+class XRVirtualClock : public XRClock
+{
+ public:
+  XRVirtualClock(Long64_t startMs = 0, Int_t settleMs = 1);
+
+  virtual Long64_t Now();
+  virtual void Sleep(Long64_t ms);
+  virtual Bool_t IsVirtual() {return kTRUE;};
+  void Advance(Long64_t ms);
+  Int_t GetSleepers();
+
+ private:
+  TMutex fMutex;
+  TCondition fCond;
+  Long64_t fNow;
+  Int_t fSettleMs;
+  std::multiset<Long64_t> fWakeups; // pending wake-up times
+};
+#endif //XRCLOCK_H
@@ -0,0 +1,22 @@
+#ifndef XRLOG_H
+#define XRLOG_H
+
+// Hardware driver sources include this last: on Windows every printf()
+// is mirrored into the Vparams log file (qscanner_log.*.txt).
+#include <stdio.h>
+#include "../Vparams.h"
+
+#ifdef _WIN32
+// Save original printf before redefining
+#undef printf
+extern "C" int printf(const char *format, ...);
+static int (*original_printf)(const char *, ...) = printf;
+#define printf(fmt, ...)                                          \
+  do                                                              \
+  {                                                               \
+    original_printf(fmt, __VA_ARGS__);                            \
+    fprintf(Vparams::getParams()->fLog, fmt, __VA_ARGS__);        \
+    fflush(Vparams::getParams()->fLog);                           \
+  } while (0)
+#endif
+#endif //XRLOG_H
@@ -2,64 +2,95 @@
 #include "XRay.h"
 
 #include <stdio.h>
-#include <TSystem.h>
-#include <TRandom.h>
+#include "XRClock.h"
 #include <string.h>
-#ifdef _WIN32
-#include "ipc/NamedPipeClient.h"
-#include <vector>
+#include <TThread.h>
+#include <TTimeStamp.h>
 #include <cstdlib>
-#endif
+#include "MiniXBackend.h"
+#include "SimXRayBackend.h"
+#include "RemoteXRayBackend.h"
+#include "XRLog.h"
 
 static Vparams &params = *Vparams::getParams();
 
-#ifdef _WIN32
-// Save original printf before redefining
-#undef printf
-extern "C" int printf(const char *format, ...);
-static int (*original_printf)(const char *, ...) = printf;
-#define printf(fmt, ...)                    \
-  do                                        \
-  {                                         \
-    original_printf(fmt, __VA_ARGS__);      \
-    fprintf(params.fLog, fmt, __VA_ARGS__); \
-    fflush(params.fLog);                    \
-  } while (0)
+//---------------------------------------------------------------------------
+XRay::XRay(const char *serialNumber)
+{
+  XRInit(serialNumber);
+  XRayBackend *backend = 0;
+  // No serial number given: the tube named in the configuration
+  if (fSerialNumber.empty())
+  {
+    StringParameter *p1 = params.conf->GetParameter<StringParameter>("XRaySerialNumber");
+    if (p1)
+      fSerialNumber = p1->StrVal;
+  }
+
+  // Optional remote mode via the service transport. Enable by setting
+  // XRAY_REMOTE=1; XRAY_PIPE_NAME may also be unix:<path> or tcp:[host:]port
+  const char *remoteEnv = getenv("XRAY_REMOTE");
+  if (remoteEnv && remoteEnv[0] == '1')
+  {
+    const char *pipeEnv = getenv("XRAY_PIPE_NAME");
+    std::string pipeName = pipeEnv && pipeEnv[0] ? std::string(pipeEnv) : std::string("\\\\.\\pipe\\XRayService");
+    RemoteXRayBackend *remote = new RemoteXRayBackend(fSerialNumber.c_str());
+    if (remote->Connect(pipeName))
+      backend = remote;
+    else
+      delete remote;
+  }
+
+#ifndef VIEWER_ONLY
+  if (!backend)
+  {
+    MiniXBackend *minix = new MiniXBackend(0, -1, fSerialNumber.empty() ? 0 : fSerialNumber.c_str());
+    if (minix->Open() && minix->Startup())
+      backend = minix;
+    else
+      delete minix;
+  }
 #endif
 
-// --- IPC helpers (Windows only) ---
-#ifdef _WIN32
-bool XRay::IPC_Send(const string& req, string* resp)
-{
-  if (!fPipeClient) return false;
-  std::string reply;
-  if (!fPipeClient->call(req, reply)) return false;
-  if (resp) *resp = reply;
-  return true;
+  XRFinishInit(backend);
 }
-
-void XRay::SplitTokens(const string& s, char delim, vector<string>& out)
+//---------------------------------------------------------------------------
+XRay::XRay(MiniXScheduler *scheduler, long deviceIndex, const char *serialNumber)
 {
-  out.clear();
-  size_t start = 0;
-  while (start <= s.size())
+  // Tube owned by XRayManager: the DLL is already open and enumerated,
+  // and every hardware access goes through the shared scheduler
+  XRInit(serialNumber);
+  XRayBackend *backend = 0;
+
+#ifndef VIEWER_ONLY
+  if (deviceIndex < 0)
+    printf("No X-ray device for this tube. Running in SIMULATION mode\n");
+  else
   {
-    size_t pos = s.find(delim, start);
-    if (pos == string::npos) { out.push_back(s.substr(start)); break; }
-    out.push_back(s.substr(start, pos - start));
-    start = pos + 1;
+    printf("Tube bound to MiniX device %ld, serial number: %s\n", deviceIndex, fSerialNumber.c_str());
+    MiniXBackend *minix = new MiniXBackend(scheduler, deviceIndex, serialNumber);
+    if (minix->Startup())
+      backend = minix;
+    else
+      delete minix;
   }
-}
 #endif
 
+  XRFinishInit(backend);
+}
 //---------------------------------------------------------------------------
-XRay::XRay(const char *serialNumber)
+void XRay::XRInit(const char *serialNumber)
 {
   debug = params.verbose;
-#ifdef _WIN32
-  fUseRemote = false;
-  fPipeClient = 0;
-#endif
+  fAcqThread = 0;
+  fAcqRunning = false;
+  fAcqPeriodMs = 0;
+  fVersionBase = (ULong64_t)TTimeStamp().GetSec() * 1000000;
+  fBackend = 0;
+  fQueue = new XRayCommandQueue();
+  fRamp = new XRayRamp(this);
+  fSequence = new XRaySequence(this);
+  fHistory = new XRayHistory();
   if (serialNumber)
   {
     fSerialNumber = string(serialNumber);
@@ -77,132 +108,31 @@ XRay::XRay(const char *serialNumber)
 
   fXRayMutex = new TMutex;
 
-  SetXRayState(kFALSE);
+  fXRayState.Power = kFALSE;
   fXRayState.ActualVoltage = 0.0;
   fXRayState.ActualCurrent = 0.0;
   fXRayState.ActualPower = 0.0;
   fXRayState.Temperature = 0.0;
   fXRayMode = REAL_TIME;
-  fDeviceIndex = -1;
-#ifndef _WIN32
-  fXRReady = 0;
-#endif
-
-#ifdef _WIN32
-  // Optional remote mode via named pipe. Enable by setting XRAY_REMOTE=1
-  const char *remoteEnv = getenv("XRAY_REMOTE");
-  if (remoteEnv && remoteEnv[0] == '1')
-  {
-    const char *pipeEnv = getenv("XRAY_PIPE_NAME");
-    std::string pipeName = pipeEnv && pipeEnv[0] ? std::string(pipeEnv) : std::string("\\\\.\\pipe\\XRayService");
-    fPipeClient = new NamedPipeClient(pipeName);
-    if (fPipeClient->connect(5000))
-    {
-      // Handshake: INIT|<serialNumber or empty>
-      std::string req = std::string("INIT|") + fSerialNumber;
-      std::string resp;
-      if (IPC_Send(req, &resp) && resp.rfind("OK", 0) == 0)
-      {
-        fUseRemote = true;
-        if (debug > 0) printf("XRay running in REMOTE mode via %s\n", pipeName.c_str());
-      }
-      else
-      {
-        if (debug > 0) printf("Failed to INIT remote XRay service, falling back to local. Resp='%s'\n", resp.c_str());
-        delete fPipeClient; fPipeClient = 0; fUseRemote = false;
-      }
-    }
-    else
-    {
-      if (debug > 0) printf("Could not connect to XRayService pipe. Falling back to local.\n");
-      delete fPipeClient; fPipeClient = 0; fUseRemote = false;
-    }
-  }
-#endif
-
-#ifndef VIEWER_ONLY
-  if (!
-#ifdef _WIN32
-      fUseRemote
-#else
-      false
-#endif
-  )
-  {
-  // Define operation mode (Real or Simulated)
-  printf("\n\t***** Start MiniX X-Ray tube controller application *****\n");
-  OpenMiniX();
-  gSystem->Sleep(100);
-
-  if (isMiniXDlg())
-  {
-    // Enumerate and list available MiniX devices
-	  ClearDeviceList();
-    GetDeviceList();
-    long deviceCount = GetDeviceCount();
-    printf("Found %ld MiniX device(s)\n", deviceCount);
-
-    if (deviceCount > 0)
-    {
-   
-      // Try to connect to first device (device 0) and retrieve its serial number
-      printf("Attempting to connect to device 0...\n");
-	  char serialNumber[256];
-	  GetDeviceSerialNumberByIndex(0, serialNumber);
-      fSerialNumber = string(serialNumber);
-      SetDevice(0);
-      printf("Successfully connected to device 0 with serial number: %s\n", fSerialNumber.c_str());
-    
-    }
-    else
-    {
-      // No devices found - run in simulation mode
-      printf("No X-ray devices found. Running in SIMULATION mode\n");
-      fXRayMode = SIMULATION;
-      fDeviceIndex = -1;
-      fSerialNumber = "SIM_MODE";
-    }
-
-    if (fXRayMode != SIMULATION)
-    {
-      SetDevice(fDeviceIndex);
-      ReadMiniXMonitor(&fXRayMonitor);
-      ReadMiniXSettings(&fXRaySettings);
-      if (fXRayMonitor.mxmStatusInd == mxstMiniXApplicationReady)
-      {
-
-        SendMiniXCommand((byte)mxcStartMiniX);
-        gSystem->Sleep(100);
-        SetDevice(fDeviceIndex);
-        ReadMiniXMonitor(&fXRayMonitor);
-
-        long mxserial = ReadMiniXSerialNumber();
-        printf("MiniX Serial Number %ld connected\n", mxserial);
-        printf(" MiniX status: %s\n", GetMiniXStatusString(fXRayMonitor.mxmStatusInd));
-        if (fXRayMonitor.mxmStatusInd == mxstMiniXControllerReady || fXRayMonitor.mxmStatusInd == mxstConnectingToMiniX)
-        {
-          fXRayMode = REAL_TIME;
-          printf(" MiniX X-Ray tube is in REAL_TIME operation mode!\n");
-        }
-        else
-        {
-          fXRayMode = SIMULATION;
-          printf("WARNING: MiniX X-Ray tube is in SIMULATION operation mode!\n");
-        }
-      }
-      else
-      {
-        fXRayMode = SIMULATION;
-        printf("WARNING: MiniX  X-Ray tube is in SIMULATION operation mode!\n");
-      } // endif mxstMiniXApplicationReady
-    } // endif fXRayMode != SIMULATION
-  } // endif isMiniXDlg
-  //  }
+}
+//---------------------------------------------------------------------------
+void XRay::XRFinishInit(XRayBackend *backend)
+{
+  // The backend is chosen once here; no hardware left means simulation
+  if (!backend)
+    backend = new SimXRayBackend(fSerialNumber.empty() ? "SIM_MODE" : fSerialNumber.c_str());
+  fBackend = backend;
+  fXRayMode = fBackend->GetMode();
+  if (fSerialNumber.empty() || fXRayMode == REAL_TIME)
+    fSerialNumber = fBackend->GetSerialNumber();
+  if (debug > 0)
+    printf("XRay %s uses the %s backend\n", fSerialNumber.c_str(), fBackend->GetName());
 
-#else // VIEWER_ONLY
-  fXRayMode = SIMULATION;
-#endif
-  }
+  fXRayMutex->Lock();
+  PublishState();
+  fXRayMutex->UnLock();
+  if (fAcqPeriodMs > 0)
+    StartAcquisition(fAcqPeriodMs);
 }
 //-----------------------------------------------------------------------------
 void XRay::XRReadConfig()
@@ -212,6 +142,9 @@ void XRay::XRReadConfig()
 
   LevelParameter *p2 = params.conf->GetParameter<LevelParameter>("XRCurrentToSet");
   fXRayState.CurrentToSet = p2 ? (Float_t)p2->Level : XRCURRENTDEFAULT;
+
+  LevelParameter *p3 = params.conf->GetParameter<LevelParameter>("XRAcquisitionPeriod");
+  fAcqPeriodMs = p3 ? (Int_t)p3->Level : 0;
 }
 //-----------------------------------------------------------------------------
 void XRay::SetXRayState(Bool_t power)
@@ -219,107 +152,10 @@ void XRay::SetXRayState(Bool_t power)
   if (debug > 0)
     printf("In XRay::SetXRayState\n");
   fXRayMutex->Lock();
-
-#ifdef _WIN32
-  if (fUseRemote)
-  {
+  // A command that did not get through leaves the power as it was
+  if (fBackend->SetPower(fXRayState, power))
     fXRayState.Power = power;
-    char buf[128];
-    sprintf(buf, "SET_POWER|%d|%.6f|%.6f", power ? 1 : 0, (double)fXRayState.VoltageToSet, (double)fXRayState.CurrentToSet);
-    std::string resp; IPC_Send(buf, &resp);
-    fXRayMutex->UnLock();
-    return;
-  }
-#endif
-
-  if (fXRayMode == REAL_TIME)
-  {
-    if (debug > 0)
-      printf("XRay real mode\n");
-    if (isMiniXDlg())
-    {
-      if (power)
-      { // turn ON XRay
-        if (debug > 0)
-          printf("\n       ********* X-Ray tube will be powered ON *********\n");
-        SetMiniXHV((double)fXRayState.VoltageToSet);
-        //	gSystem->Sleep(100);
-        SetMiniXCurrent((double)fXRayState.CurrentToSet);
-        //	gSystem->Sleep(100);
-
-        SetDevice(fDeviceIndex);
-        ReadMiniXMonitor(&fXRayMonitor);
-        if (debug > 0)
-          printf(" MiniX status: %s\n", GetMiniXStatusString(fXRayMonitor.mxmStatusInd));
-        if (fXRayMonitor.mxmEnabledCmds & mxcSetHVandCurrent)
-        {
-          SendMiniXCommand((byte)mxcSetHVandCurrent);
-        }
-        else
-        {
-          SetDevice(fDeviceIndex);
-          ReadMiniXMonitor(&fXRayMonitor);
-          printf(" MiniX status: %s\n", GetMiniXStatusString(fXRayMonitor.mxmStatusInd));
-        }
-
-        //	gSystem->Sleep(100);
-        ReadMiniXSettings(&fXRaySettings);
-        printf(" Corrected MiniX settings:\n XRayVMon=%.0f, XRayImon=%.0f\n", fXRaySettings.HighVoltage_kV, fXRaySettings.Current_uA);
-
-        SetDevice(fDeviceIndex);
-        ReadMiniXMonitor(&fXRayMonitor);
-        if (fXRayMonitor.mxmEnabledCmds & mxcHVOn)
-        {
-          SendMiniXCommand((byte)mxcHVOn);
-        }
-        else
-        {
-          SetDevice(fDeviceIndex);
-          ReadMiniXMonitor(&fXRayMonitor);
-          printf(" MiniX status: %s\n", GetMiniXStatusString(fXRayMonitor.mxmStatusInd));
-        }
-      }
-      else
-      { // turn OFF XRay
-        SetDevice(fDeviceIndex);
-        ReadMiniXMonitor(&fXRayMonitor);
-        if (fXRayMonitor.mxmEnabledCmds & mxcHVOff)
-        {
-          SendMiniXCommand((byte)mxcHVOff);
-        }
-        else
-        {
-          SetDevice(fDeviceIndex);
-          ReadMiniXMonitor(&fXRayMonitor);
-          printf(" MiniX status: %s\n", GetMiniXStatusString(fXRayMonitor.mxmStatusInd));
-        }
-        fXRayState.ActualVoltage = 0.0;
-        fXRayState.ActualCurrent = 0.0;
-      } // end turn OFF XRay
-    }
-    else
-    {
-      printf(" MiniX status: no MiniXDlg\n");
-    }
-  }
-
-  if (fXRayMode == SIMULATION)
-  {
-    if (debug > 0)
-      printf("XRay in simulation mode!\n");
-    if (power)
-    {
-      fXRayState.ActualVoltage = 0.99f * fXRayState.VoltageToSet + 0.02f * fXRayState.VoltageToSet * (Float_t)gRandom->Rndm();
-      fXRayState.ActualCurrent = 0.99f * fXRayState.CurrentToSet + 0.02f * fXRayState.CurrentToSet * (Float_t)gRandom->Rndm();
-    }
-    else
-    {
-      fXRayState.ActualVoltage = 0.0;
-      fXRayState.ActualCurrent = 0.0;
-    }
-  }
-
-  fXRayState.Power = power;
+  RecordState();
   fXRayMutex->UnLock();
 }
 //---------------------------------------------------------------------------
@@ -327,32 +163,14 @@ XRay::XRayState XRay::GetXRayState()
 {
   if (debug > 1)
     printf("In XRay::GetXRayState\n");
+  // Acquisition thread keeps the snapshot fresh: no lock, no hardware access
+  if (fAcqRunning.load())
+    return fSnapshot.Read();
   XRayState myXRayState;
   fXRayMutex->Lock();
-#ifdef _WIN32
-  if (fUseRemote)
-  {
-    std::string resp;
-    if (IPC_Send("GET_STATE", &resp) && resp.rfind("OK|", 0) == 0)
-    {
-      std::vector<std::string> tok; SplitTokens(resp, '|', tok);
-      if (tok.size() >= 8)
-      {
-        fXRayState.Power = atoi(tok[1].c_str()) != 0;
-        fXRayState.VoltageToSet = (Float_t)atof(tok[2].c_str());
-        fXRayState.ActualVoltage = (Float_t)atof(tok[3].c_str());
-        fXRayState.CurrentToSet = (Float_t)atof(tok[4].c_str());
-        fXRayState.ActualCurrent = (Float_t)atof(tok[5].c_str());
-        fXRayState.ActualPower = (Float_t)atof(tok[6].c_str());
-        fXRayState.Temperature = (Float_t)atof(tok[7].c_str());
-      }
-    }
-    myXRayState = fXRayState;
-    fXRayMutex->UnLock();
-    return myXRayState;
-  }
-#endif
+  fBackend->RefreshState(fXRayState);
   myXRayState = fXRayState;
+  PublishState();
   fXRayMutex->UnLock();
   return myXRayState;
 }
@@ -361,12 +179,6 @@ void XRay::PrintStatus()
 {
   if (debug > 0)
     printf("In XRay::PrintStatus\n");
-#ifdef _WIN32
-  if (fUseRemote)
-  {
-    std::string resp; IPC_Send("PRINT_STATUS", &resp);
-  }
-#endif
   printf("********* X-ray status: *********\n");
   fXRayMutex->Lock();
   if (fXRayState.Power)
@@ -379,7 +191,10 @@ void XRay::PrintStatus()
   printf("ActualCurrent: %f\n", fXRayState.ActualCurrent);
   printf("ActualPower: %f\n", fXRayState.ActualPower);
   printf("ActualTemperature: %f, C\n", fXRayState.Temperature);
+  printf("Backend: %s\n", fBackend->GetName());
+  fBackend->PrintStatus();
   fXRayMutex->UnLock();
+  fQueue->PrintStats();
 }
 //---------------------------------------------------------------------------
 void XRay::SetXRayVoltage(Float_t xVoltage)
@@ -388,38 +203,8 @@ void XRay::SetXRayVoltage(Float_t xVoltage)
     printf("In XRay::SetXRayVoltage\n");
   fXRayMutex->Lock();
   fXRayState.VoltageToSet = xVoltage;
-#ifdef _WIN32
-  if (fUseRemote)
-  {
-    char buf[64]; sprintf(buf, "SET_VOLTAGE|%.6f", (double)xVoltage);
-    std::string resp; IPC_Send(buf, &resp);
-    fXRayMutex->UnLock();
-    return;
-  }
-#endif
-  if (fXRayMode == REAL_TIME)
-  {
-    if (isMiniXDlg())
-    {
-      // Inline the hardware calls to avoid deadlock
-      SetMiniXHV((double)fXRayState.VoltageToSet);
-      SetMiniXCurrent((double)fXRayState.CurrentToSet);
-      SetDevice(fDeviceIndex);
-      ReadMiniXMonitor(&fXRayMonitor);
-      if (fXRayMonitor.mxmEnabledCmds & mxcSetHVandCurrent)
-      {
-        SendMiniXCommand((byte)mxcSetHVandCurrent);
-      }
-      else
-      {
-        SetDevice(fDeviceIndex);
-        ReadMiniXMonitor(&fXRayMonitor);
-        printf(" MiniX status: %s\n", GetMiniXStatusString(fXRayMonitor.mxmStatusInd));
-      }
-    }
-  }
-  else if (fXRayMode == SIMULATION)
-    fXRayState.ActualVoltage = 0.95f * fXRayState.VoltageToSet + 0.1f * fXRayState.VoltageToSet * (Float_t)gRandom->Rndm();
+  fBackend->SetVoltage(fXRayState);
+  PublishState();
   fXRayMutex->UnLock();
 }
 //---------------------------------------------------------------------------
@@ -429,72 +214,27 @@ void XRay::SetXRayCurrent(Float_t xCurrent)
     printf("In XRay::SetXRayCurrent\n");
   fXRayMutex->Lock();
   fXRayState.CurrentToSet = xCurrent;
-#ifdef _WIN32
-  if (fUseRemote)
-  {
-    char buf[64]; sprintf(buf, "SET_CURRENT|%.6f", (double)xCurrent);
-    std::string resp; IPC_Send(buf, &resp);
-    fXRayMutex->UnLock();
-    return;
-  }
-#endif
-  if (fXRayMode == REAL_TIME)
-  {
-    if (isMiniXDlg())
-    {
-      // Inline the hardware calls to avoid deadlock
-      SetMiniXHV((double)fXRayState.VoltageToSet);
-      SetMiniXCurrent((double)fXRayState.CurrentToSet);
-      SetDevice(fDeviceIndex);
-      ReadMiniXMonitor(&fXRayMonitor);
-      if (fXRayMonitor.mxmEnabledCmds & mxcSetHVandCurrent)
-      {
-        SendMiniXCommand((byte)mxcSetHVandCurrent);
-      }
-      else
-      {
-        SetDevice(fDeviceIndex);
-        ReadMiniXMonitor(&fXRayMonitor);
-        printf(" MiniX status: %s\n", GetMiniXStatusString(fXRayMonitor.mxmStatusInd));
-      }
-    }
-  }
-  else if (fXRayMode == SIMULATION)
-    fXRayState.ActualCurrent = 0.95f * fXRayState.CurrentToSet + 0.1f * fXRayState.CurrentToSet * (Float_t)gRandom->Rndm();
+  fBackend->SetCurrent(fXRayState);
+  PublishState();
   fXRayMutex->UnLock();
 }
 //---------------------------------------------------------------------------
 void XRay::SetXRayHVAndCurrent()
 {
   fXRayMutex->Lock();
-#ifdef _WIN32
-  if (fUseRemote)
-  {
-    std::string resp; IPC_Send("SET_HV_I", &resp);
-    fXRayMutex->UnLock();
-    return;
-  }
-#endif
-  if (fXRayMode == REAL_TIME)
-  {
-    if (isMiniXDlg())
-    {
-      SetMiniXHV((double)fXRayState.VoltageToSet);
-      SetMiniXCurrent((double)fXRayState.CurrentToSet);
-      SetDevice(fDeviceIndex);
-      ReadMiniXMonitor(&fXRayMonitor);
-      if (fXRayMonitor.mxmEnabledCmds & mxcSetHVandCurrent)
-      {
-        SendMiniXCommand((byte)mxcSetHVandCurrent);
-      }
-      else
-      {
-        SetDevice(fDeviceIndex);
-        ReadMiniXMonitor(&fXRayMonitor);
-        printf(" MiniX status: %s\n", GetMiniXStatusString(fXRayMonitor.mxmStatusInd));
-      }
-    }
-  }
+  fBackend->SetHVAndCurrent(fXRayState);
+  fXRayMutex->UnLock();
+}
+//---------------------------------------------------------------------------
+void XRay::SetXRaySetpoints(Float_t xVoltage, Float_t xCurrent)
+{
+  if (debug > 1)
+    printf("In XRay::SetXRaySetpoints\n");
+  fXRayMutex->Lock();
+  fXRayState.VoltageToSet = xVoltage;
+  fXRayState.CurrentToSet = xCurrent;
+  fBackend->SetHVAndCurrent(fXRayState);
+  PublishState();
   fXRayMutex->UnLock();
 }
 //---------------------------------------------------------------------------
@@ -502,199 +242,45 @@ void XRay::ReadXRayVoltage()
 {
   if (debug > 0)
     printf("In XRay::ReadXRayVoltage\n");
-  fXRayMutex->Lock();
-#ifdef _WIN32
-  if (fUseRemote)
-  {
-    std::string resp;
-    if (IPC_Send("READ_DATA", &resp) && resp.rfind("OK|", 0) == 0)
-    {
-      std::vector<std::string> tok; SplitTokens(resp, '|', tok);
-      if (tok.size() >= 8)
-      {
-        fXRayState.Power = atoi(tok[1].c_str()) != 0;
-        fXRayState.VoltageToSet = (Float_t)atof(tok[2].c_str());
-        fXRayState.ActualVoltage = (Float_t)atof(tok[3].c_str());
-        fXRayState.CurrentToSet = (Float_t)atof(tok[4].c_str());
-        fXRayState.ActualCurrent = (Float_t)atof(tok[5].c_str());
-        fXRayState.ActualPower = (Float_t)atof(tok[6].c_str());
-        fXRayState.Temperature = (Float_t)atof(tok[7].c_str());
-      }
-    }
-    fXRayMutex->UnLock();
-    return;
-  }
-#endif
-  if (fXRayMode == REAL_TIME)
-  {
-    if (isMiniXDlg())
-    {
-      SetDevice(fDeviceIndex);
-      ReadMiniXMonitor(&fXRayMonitor);
-      // if(fXRayMonitor.mxmRefreshed){
-      // ReadMiniXMonitor(&fXRayMonitor);
-      fXRayState.ActualVoltage = (Float_t)fXRayMonitor.mxmHighVoltage_kV;
-      //}
-    }
-  }
-  else if (fXRayMode == SIMULATION)
-  {
-    if (fXRayState.Power)
-      fXRayState.ActualVoltage = 0.95f * fXRayState.VoltageToSet + 0.1f * fXRayState.VoltageToSet * (Float_t)gRandom->Rndm();
-    else
-      fXRayState.ActualVoltage = 0;
-  }
+  ReadFields(kXRVoltage);
   if (debug > 1)
     printf("fXRayState.ActualVoltage=%f\n", fXRayState.ActualVoltage);
-  fXRayMutex->UnLock();
 }
 //---------------------------------------------------------------------------
 void XRay::ReadXRayCurrent()
 {
   if (debug > 0)
     printf("In XRay::ReadXRayCurrent\n");
-  fXRayMutex->Lock();
-#ifdef _WIN32
-  if (fUseRemote)
-  {
-    std::string resp;
-    if (IPC_Send("READ_DATA", &resp) && resp.rfind("OK|", 0) == 0)
-    {
-      std::vector<std::string> tok; SplitTokens(resp, '|', tok);
-      if (tok.size() >= 8)
-      {
-        fXRayState.Power = atoi(tok[1].c_str()) != 0;
-        fXRayState.VoltageToSet = (Float_t)atof(tok[2].c_str());
-        fXRayState.ActualVoltage = (Float_t)atof(tok[3].c_str());
-        fXRayState.CurrentToSet = (Float_t)atof(tok[4].c_str());
-        fXRayState.ActualCurrent = (Float_t)atof(tok[5].c_str());
-        fXRayState.ActualPower = (Float_t)atof(tok[6].c_str());
-        fXRayState.Temperature = (Float_t)atof(tok[7].c_str());
-      }
-    }
-    fXRayMutex->UnLock();
-    return;
-  }
-#endif
-  if (fXRayMode == REAL_TIME)
-  {
-    if (isMiniXDlg())
-    {
-      SetDevice(fDeviceIndex);
-      ReadMiniXMonitor(&fXRayMonitor);
-      // if(fXRayMonitor.mxmRefreshed){
-      // ReadMiniXMonitor(&fXRayMonitor);
-      fXRayState.ActualCurrent = (Float_t)fXRayMonitor.mxmCurrent_uA;
-      //}
-    }
-  }
-  else if (fXRayMode == SIMULATION)
-  {
-    if (fXRayState.Power)
-      fXRayState.ActualCurrent = 0.95f * fXRayState.CurrentToSet + 0.1f * fXRayState.CurrentToSet * (Float_t)gRandom->Rndm();
-    else
-      fXRayState.ActualCurrent = 0;
-  }
+  ReadFields(kXRCurrent);
   if (debug > 1)
     printf("fXRayState.ActualCurrent=%f\n", fXRayState.ActualCurrent);
-  fXRayMutex->UnLock();
 }
 //---------------------------------------------------------------------------
 void XRay::ReadXRayPowerDraw()
 {
   if (debug > 0)
     printf("In XRay::ReadXRayPowerDraw\n");
-  fXRayMutex->Lock();
-#ifdef _WIN32
-  if (fUseRemote)
-  {
-    std::string resp;
-    if (IPC_Send("READ_DATA", &resp) && resp.rfind("OK|", 0) == 0)
-    {
-      std::vector<std::string> tok; SplitTokens(resp, '|', tok);
-      if (tok.size() >= 8)
-      {
-        fXRayState.Power = atoi(tok[1].c_str()) != 0;
-        fXRayState.VoltageToSet = (Float_t)atof(tok[2].c_str());
-        fXRayState.ActualVoltage = (Float_t)atof(tok[3].c_str());
-        fXRayState.CurrentToSet = (Float_t)atof(tok[4].c_str());
-        fXRayState.ActualCurrent = (Float_t)atof(tok[5].c_str());
-        fXRayState.ActualPower = (Float_t)atof(tok[6].c_str());
-        fXRayState.Temperature = (Float_t)atof(tok[7].c_str());
-      }
-    }
-    fXRayMutex->UnLock();
-    return;
-  }
-#endif
-  if (fXRayMode == REAL_TIME)
-  {
-    if (isMiniXDlg())
-    {
-      // ReadMiniXMonitor(&fXRayMonitor);
-      // if(fXRayMonitor.mxmRefreshed){
-      fXRayState.ActualPower = (Float_t)fXRayMonitor.mxmPower_mW;
-      //}
-    }
-  }
-  else if (fXRayMode == SIMULATION)
-  {
-    if (fXRayState.Power)
-      fXRayState.ActualPower = 0.95f * fXRayState.VoltageToSet * fXRayState.CurrentToSet + 0.1f * fXRayState.VoltageToSet * fXRayState.CurrentToSet * (Float_t)gRandom->Rndm();
-    else
-      fXRayState.ActualPower = 0;
-  }
+  ReadFields(kXRPower);
   if (debug > 1)
     printf("fXRayState.ActualPower=%f\n", fXRayState.ActualPower);
-  fXRayMutex->UnLock();
 }
 //---------------------------------------------------------------------------
 void XRay::ReadXRayTemperature()
 {
   if (debug > 0)
     printf("In XRay::ReadXRayTemperature\n");
-  fXRayMutex->Lock();
-#ifdef _WIN32
-  if (fUseRemote)
-  {
-    std::string resp;
-    if (IPC_Send("READ_DATA", &resp) && resp.rfind("OK|", 0) == 0)
-    {
-      std::vector<std::string> tok; SplitTokens(resp, '|', tok);
-      if (tok.size() >= 8)
-      {
-        fXRayState.Power = atoi(tok[1].c_str()) != 0;
-        fXRayState.VoltageToSet = (Float_t)atof(tok[2].c_str());
-        fXRayState.ActualVoltage = (Float_t)atof(tok[3].c_str());
-        fXRayState.CurrentToSet = (Float_t)atof(tok[4].c_str());
-        fXRayState.ActualCurrent = (Float_t)atof(tok[5].c_str());
-        fXRayState.ActualPower = (Float_t)atof(tok[6].c_str());
-        fXRayState.Temperature = (Float_t)atof(tok[7].c_str());
-      }
-    }
-    fXRayMutex->UnLock();
-    return;
-  }
-#endif
-  if (fXRayMode == REAL_TIME)
-  {
-    if (isMiniXDlg())
-    {
-      // ReadMiniXMonitor(&fXRayMonitor);
-      // if(fXRayMonitor.mxmRefreshed){
-      fXRayState.Temperature = (Float_t)fXRayMonitor.mxmTemperatureC;
-      //}
-    }
-  }
-  else if (fXRayMode == SIMULATION)
-  {
-    if (fXRayState.Power)
-      fXRayState.Temperature = 30 + 2 * (Float_t)gRandom->Rndm();
-    else
-      fXRayState.Temperature = 0;
-  }
+  ReadFields(kXRTemperature);
   if (debug > 1)
     printf("fXRayState.Temperature=%f\n", fXRayState.Temperature);
+}
+//---------------------------------------------------------------------------
+void XRay::ReadFields(UInt_t fields)
+{
+  if (fAcqRunning.load())
+    return; // values are refreshed by the acquisition thread
+  fXRayMutex->Lock();
+  fBackend->ReadData(fXRayState, fields);
+  RecordState();
   fXRayMutex->UnLock();
 }
 //---------------------------------------------------------------------------
@@ -702,199 +288,79 @@ void XRay::ReadXRayData()
 {
   if (debug > 1)
     printf("In XRay::ReadXRayData\n");
+  if (fAcqRunning.load())
+    return; // values are refreshed by the acquisition thread
+  SampleXRayData();
+}
+//---------------------------------------------------------------------------
+void XRay::SampleXRayData()
+{
   fXRayMutex->Lock();
-#ifdef _WIN32
-  if (fUseRemote)
-  {
-    std::string resp;
-    if (IPC_Send("READ_DATA", &resp) && resp.rfind("OK|", 0) == 0)
-    {
-      std::vector<std::string> tok; SplitTokens(resp, '|', tok);
-      if (tok.size() >= 8)
-      {
-        fXRayState.Power = atoi(tok[1].c_str()) != 0;
-        fXRayState.VoltageToSet = (Float_t)atof(tok[2].c_str());
-        fXRayState.ActualVoltage = (Float_t)atof(tok[3].c_str());
-        fXRayState.CurrentToSet = (Float_t)atof(tok[4].c_str());
-        fXRayState.ActualCurrent = (Float_t)atof(tok[5].c_str());
-        fXRayState.ActualPower = (Float_t)atof(tok[6].c_str());
-        fXRayState.Temperature = (Float_t)atof(tok[7].c_str());
-      }
-    }
-    if (debug > 1)
-    {
-      printf("(remote) VoltageToSet: %f\n", fXRayState.VoltageToSet);
-      printf("(remote) CurrentToSet: %f\n", fXRayState.CurrentToSet);
-      printf("(remote) fXRayState.ActualVoltage=%f\n", fXRayState.ActualVoltage);
-      printf("(remote) fXRayState.ActualCurrent=%f\n", fXRayState.ActualCurrent);
-      printf("(remote) fXRayState.ActualPower=%f\n", fXRayState.ActualPower);
-      printf("(remote) fXRayState.Temperature=%f\n", fXRayState.Temperature);
-    }
-    fXRayMutex->UnLock();
-    return;
-  }
-#endif
-  if (fXRayMode == REAL_TIME)
-  {
-    if (isMiniXDlg())
-    {
-      SetDevice(fDeviceIndex);
-      ReadMiniXMonitor(&fXRayMonitor);
-      if (fXRayMonitor.mxmRefreshed)
-      {
-        fXRayState.ActualVoltage = (Float_t)fXRayMonitor.mxmHighVoltage_kV;
-        fXRayState.ActualCurrent = (Float_t)fXRayMonitor.mxmCurrent_uA;
-        fXRayState.ActualPower = (Float_t)fXRayMonitor.mxmPower_mW;
-        fXRayState.Temperature = (Float_t)fXRayMonitor.mxmTemperatureC;
-      }
-    }
-  }
-  else if (fXRayMode == SIMULATION)
-  {
-    if (fXRayState.Power)
-    {
-      fXRayState.ActualVoltage = 0.95f * fXRayState.VoltageToSet + 0.1f * fXRayState.VoltageToSet * (Float_t)gRandom->Rndm();
-      fXRayState.ActualCurrent = 0.95f * fXRayState.CurrentToSet + 0.1f * fXRayState.CurrentToSet * (Float_t)gRandom->Rndm();
-      fXRayState.ActualPower = 0.95f * fXRayState.VoltageToSet * fXRayState.CurrentToSet + 0.1f * fXRayState.VoltageToSet * fXRayState.CurrentToSet * (Float_t)gRandom->Rndm();
-      fXRayState.Temperature = 30 + 2 * (Float_t)gRandom->Rndm();
-    }
-    else
-    {
-      fXRayState.ActualVoltage = 0;
-      fXRayState.ActualCurrent = 0;
-      fXRayState.ActualPower = 0;
-      fXRayState.Temperature = 0;
-    }
-  }
-
+  fBackend->ReadData(fXRayState, kXRAllFields);
   if (debug > 1)
   {
-    printf("MiniX status: %s\n", GetMiniXStatusString(fXRayMonitor.mxmStatusInd));
     printf("VoltageToSet: %f\n", fXRayState.VoltageToSet);
     printf("CurrentToSet: %f\n", fXRayState.CurrentToSet);
     printf("fXRayState.ActualVoltage=%f\n", fXRayState.ActualVoltage);
     printf("fXRayState.ActualCurrent=%f\n", fXRayState.ActualCurrent);
     printf("fXRayState.ActualPower=%f\n", fXRayState.ActualPower);
     printf("fXRayState.Temperature=%f\n", fXRayState.Temperature);
-    if (fXRayMonitor.mxmOutOfRange)
-      printf("fXRayMonitor.mxmOutOfRange=%d\n", 1);
-    else
-      printf("fXRayMonitor.mxmOutOfRange=%d\n", 0);
-    if (fXRayMonitor.mxmInterLock)
-      printf("fXRayMonitor.mxmInterLock=%d\n", 1);
-    else
-      printf("fXRayMonitor.mxmInterLock=%d\n", 0);
-    if (fXRayMonitor.mxmRefreshed)
-      printf("fXRayMonitor.mxmRefreshed=%d\n", 1);
-    else
-      printf("fXRayMonitor.mxmRefreshed=%d\n", 0);
   }
+  RecordState();
   fXRayMutex->UnLock();
 }
 //---------------------------------------------------------------------------
+void XRay::RecordState()
+{
+  PublishState();
+  fHistory->Add(XRClock::Get()->Now(), fXRayState);
+}
+//---------------------------------------------------------------------------
 XRay::~XRay()
 {
-#ifdef _WIN32
-  if (fUseRemote)
-  {
-    std::string resp;
-    IPC_Send("SHUTDOWN", &resp); // optional
-    if (fPipeClient) { fPipeClient->disconnect(); delete fPipeClient; fPipeClient = 0; }
-  }
-  else
-#endif
-  {
-    if (isMiniXDlg())
-    {
-      SendMiniXCommand((byte)mxcExit);
-      gSystem->Sleep(100);
-    }
-    if (isMiniXDlg())
-    {
-      CloseMiniX();
-      gSystem->Sleep(100);
-    }
+  StopAcquisition();
+  // The program and the ramp wait on their queued steps: stop them while
+  // the queue runs, the program first as it may be running the ramp
+  delete fSequence;
+  fSequence = 0;
+  delete fRamp;
+  fRamp = 0;
+  // Pending commands are revoked, the running one completes first
+  delete fQueue;
+  fQueue = 0;
+  if (fBackend)
+  {
+    delete fBackend;
+    fBackend = 0;
   }
   if (fXRayMutex)
   {
     delete fXRayMutex;
     fXRayMutex = 0;
   }
+  delete fHistory;
+  fHistory = 0;
 }
 //---------------------------------------------------------------------------
 void XRay::GetDeviceList()
 {
   if (debug > 0)
     printf("In XRay::GetDeviceList\n");
-#ifdef _WIN32
-  if (fUseRemote)
-  {
-    std::string resp; IPC_Send("GET_DEVICE_LIST", &resp);
-    return;
-  }
-#endif
-  if (fXRayMode == REAL_TIME)
-  {
-    if (isMiniXDlg())
-    {
-      ::GetDeviceList();
-    }
-  }
+  fBackend->GetDeviceList();
 }
 //---------------------------------------------------------------------------
 long XRay::GetDeviceCount()
 {
   if (debug > 0)
     printf("In XRay::GetDeviceCount\n");
-#ifdef _WIN32
-  if (fUseRemote)
-  {
-    std::string resp; if (IPC_Send("GET_DEVICE_COUNT", &resp) && resp.rfind("OK|", 0) == 0)
-    {
-      std::vector<std::string> tok; SplitTokens(resp, '|', tok);
-      if (tok.size() >= 2) return atol(tok[1].c_str());
-    }
-    return 0;
-  }
-#endif
-  if (fXRayMode == REAL_TIME)
-  {
-    if (isMiniXDlg())
-    {
-      return ::GetDeviceCount();
-    }
-  }
-  return 0;
+  return fBackend->GetDeviceCount();
 }
 //---------------------------------------------------------------------------
 long XRay::GetDeviceSerialNumberByIndex(long lDeviceIndex, char *strSerialNumber)
 {
   if (debug > 0)
     printf("In XRay::GetDeviceSerialNumberByIndex\n");
-#ifdef _WIN32
-  if (fUseRemote)
-  {
-    char buf[64]; sprintf(buf, "GET_DEVICE_SERIAL|%ld", lDeviceIndex);
-    std::string resp; if (IPC_Send(buf, &resp) && resp.rfind("OK|", 0) == 0)
-    {
-      std::vector<std::string> tok; SplitTokens(resp, '|', tok);
-      if (tok.size() >= 3)
-      {
-        if (strSerialNumber) strncpy(strSerialNumber, tok[2].c_str(), 255);
-        return atol(tok[1].c_str());
-      }
-    }
-    return -1;
-  }
-#endif
-  if (fXRayMode == REAL_TIME)
-  {
-    if (isMiniXDlg())
-    {
-      return ::GetDeviceSerialNumberByIndex(lDeviceIndex, strSerialNumber);
-    }
-  }
-  return -1;
+  return fBackend->GetDeviceSerialNumberByIndex(lDeviceIndex, strSerialNumber);
 }
 //---------------------------------------------------------------------------
 void XRay::SetDevice(long lDeviceIndex)
@@ -902,52 +368,81 @@ void XRay::SetDevice(long lDeviceIndex)
   if (debug > 0)
     printf("In XRay::SetDevice\n");
   fXRayMutex->Lock();
-#ifdef _WIN32
-  if (fUseRemote)
-  {
-    char buf[64]; sprintf(buf, "SET_DEVICE|%ld", lDeviceIndex);
-    std::string resp; IPC_Send(buf, &resp);
-    fXRayMutex->UnLock();
-    return;
-  }
-#endif
-  if (fXRayMode == REAL_TIME)
-  {
-    if (isMiniXDlg())
-    {
-      ::SetDevice(lDeviceIndex);
-      if (debug > 0)
-        printf("Set MiniX device to index %ld\n", lDeviceIndex);
-    }
-    else
-    {
-      printf("Cannot set device - MiniX dialog not available\n");
-    }
-  }
-  else if (fXRayMode == SIMULATION)
-  {
-    if (debug > 0)
-      printf("SetDevice in simulation mode - no action taken\n");
-  }
+  fBackend->SetDevice(lDeviceIndex);
   fXRayMutex->UnLock();
 }
 //---------------------------------------------------------------------------
 Bool_t XRay::ExecCommand(string cmdstr, string *result)
 {
-  *result = "OK";
-#ifdef _WIN32
-  if (fUseRemote)
+  if (fBackend->ExecCommand(cmdstr, result))
+    return result->compare(0, 4, "DONE") == 0;
+  return fSequence->Run(cmdstr, result);
+}
+//---------------------------------------------------------------------------
+std::future<Bool_t> XRay::SetXRayStateAsync(Bool_t power, const XRayCommandQueue::Done_t &done)
+{
+  if (!power)
+    return fQueue->Submit(kXRSafety, [this]() { SetXRayState(kFALSE); }, done);
+  return fQueue->Submit(kXRControl, [this]() { SetXRayState(kTRUE); }, done, kTRUE);
+}
+//---------------------------------------------------------------------------
+std::future<Bool_t> XRay::SetXRayVoltageAsync(Float_t xVoltage, const XRayCommandQueue::Done_t &done)
+{
+  return fQueue->Submit(kXRControl, [this, xVoltage]() { SetXRayVoltage(xVoltage); }, done);
+}
+//---------------------------------------------------------------------------
+std::future<Bool_t> XRay::SetXRayCurrentAsync(Float_t xCurrent, const XRayCommandQueue::Done_t &done)
+{
+  return fQueue->Submit(kXRControl, [this, xCurrent]() { SetXRayCurrent(xCurrent); }, done);
+}
+//---------------------------------------------------------------------------
+std::future<Bool_t> XRay::ReadXRayDataAsync(const XRayCommandQueue::Done_t &done)
+{
+  return fQueue->Submit(kXRTelemetry, [this]() { ReadXRayData(); }, done);
+}
+//---------------------------------------------------------------------------
+std::future<Bool_t> XRay::Submit(XRPriority_t priority, const XRayCommandQueue::Command_t &cmd,
+                                 const XRayCommandQueue::Done_t &done)
+{
+  return fQueue->Submit(priority, cmd, done);
+}
+//---------------------------------------------------------------------------
+void XRay::StartAcquisition(Int_t periodMs)
+{
+  if (periodMs <= 0 || fAcqRunning.load())
+    return;
+  if (debug > 0)
+    printf("In XRay::StartAcquisition, period %d ms\n", periodMs);
+  fAcqPeriodMs = periodMs;
+  SampleXRayData(); // make the first snapshot valid before readers switch over
+  fAcqRunning = true;
+  fAcqThread = new TThread("XRayAcqThread", AcquisitionThreadFunc, (void *)this);
+  fAcqThread->Run();
+}
+//---------------------------------------------------------------------------
+void XRay::StopAcquisition()
+{
+  if (!fAcqThread)
+    return;
+  fAcqRunning = false;
+  fAcqThread->Join();
+  delete fAcqThread;
+  fAcqThread = 0;
+  if (debug > 0)
+    printf("In XRay::StopAcquisition\n");
+}
+//---------------------------------------------------------------------------
+void *XRay::AcquisitionThreadFunc(void *arg)
+{
+  XRay *xr = (XRay *)arg;
+  // msec, bounds StopAcquisition() latency; a virtual period passes in
+  // about one real msec, so there it is slept in one piece
+  const Int_t slice = XRClock::Get()->IsVirtual() ? xr->fAcqPeriodMs : 20;
+  while (xr->fAcqRunning.load())
   {
-    std::string req = std::string("EXEC|") + cmdstr;
-    std::string resp; if (IPC_Send(req, &resp) && resp.rfind("OK|", 0) == 0)
-    {
-      std::vector<std::string> tok; SplitTokens(resp, '|', tok);
-      if (tok.size() >= 2) *result = tok[1];
-      return kTRUE;
-    }
-    *result = "ERR";
-    return kFALSE;
+    xr->SampleXRayData();
+    for (Int_t slept = 0; slept < xr->fAcqPeriodMs && xr->fAcqRunning.load(); slept += slice)
+      XRClock::Get()->Sleep(xr->fAcqPeriodMs - slept < slice ? xr->fAcqPeriodMs - slept : slice);
   }
-#endif
-  return kTRUE;
+  return 0;
 }
@@ -3,13 +3,19 @@
 
 #include <stdio.h>
 #include "../Vparams.h"
-#ifdef _WIN32
-#include "hwdrivers/miniX/MiniXAPI.h"
-#else
-#include "hwdrivers/miniX/MiniXAPI_Linux.h"
-#endif
 
 #include <TMutex.h>
+#include <atomic>
+#include <string>
+#include "XRayBackend.h"
+#include "XRayCommandQueue.h"
+#include "XRayHistory.h"
+#include "XRayRamp.h"
+#include "XRaySequence.h"
+#include "XRaySnapshot.h"
+
+class TThread;
+class MiniXScheduler;
 
 using namespace std;
 
@@ -18,21 +24,27 @@ class XRay
 {
  public:
   XRay(const char* serialNumber = NULL);
+  // Tube owned by XRayManager: bound to deviceIndex, DLL access via scheduler
+  XRay(MiniXScheduler* scheduler, long deviceIndex, const char* serialNumber);
   ~XRay();
 
-  typedef struct {
-    Bool_t Power;
-    Float_t VoltageToSet, ActualVoltage;
-    Float_t CurrentToSet, ActualCurrent;
-    Float_t ActualPower, Temperature;
-  } XRayState;
+  typedef XRayState_t XRayState;
 
   void SetXRayState(Bool_t);
   void PrintStatus();
   XRayState GetXRayState();
+  // Last published state; never locks nor touches the hardware
+  XRayState GetXRaySnapshot() {return fSnapshot.Read();};
+  // Count of state publications; changes whenever the snapshot does
+  unsigned long GetSnapshotSequence() {return fSnapshot.GetSequence();};
+  // Version of the published state: grows by one with every change, and
+  // starts above the versions of an earlier run of the process
+  ULong64_t GetStateVersion() {return fVersionBase + fSnapshot.GetSequence();};
   void SetXRayVoltage(Float_t);
   void SetXRayCurrent(Float_t);
   void SetXRayHVAndCurrent();
+  // Set and commit both setpoints at once
+  void SetXRaySetpoints(Float_t xVoltage, Float_t xCurrent);
   void ReadXRayVoltage();
   void ReadXRayCurrent();
   void ReadXRayPowerDraw();
@@ -45,45 +57,58 @@ class XRay
   long GetDeviceCount();
   long GetDeviceSerialNumberByIndex(long lDeviceIndex, char *strSerialNumber);
   void SetDevice(long lDeviceIndex);
+  // Sequence program (see XRaySequence), run to its end where the tube
+  // is: by the service for a remote tube, here otherwise
   Bool_t ExecCommand(string, string*);
-
-  // Simulation mode for Linux
-#ifndef _WIN32
-  void OpenMiniX(){printf("In OpenMiniX\n"); fXRReady=1;};
-  byte isMiniXDlg(){return fXRReady;};
-  void CloseMiniX(){printf("In CloseMiniX\n");};
-  void SendMiniXCommand(byte MiniXCommand){printf("In SendMiniXCommand\n");};
-  void ReadMiniXMonitor(MiniX_Monitor *MiniXMonitor){printf("In ReadMiniXMonitor\n");};
-  void SetMiniXHV(double HighVoltage_kV){printf("In SetMiniXHV\n");};
-  void SetMiniXCurrent(double Current_uA){printf("In SetMiniXCurrent\n");};
-  void ReadMiniXSettings(MiniX_Settings *MiniXSettings){printf("In ReadMiniXSettings\n");};
-  long ReadMiniXSerialNumber(){printf("In ReadMiniXSerialNumber\n"); return 123456789;};
-  void GetDeviceList(){printf("In GetDeviceList\n");};
-  long GetDeviceCount(){printf("In GetDeviceCount\n"); return 1;};
-  long GetDeviceSerialNumberByIndex(long lDeviceIndex, char *strSerialNumber){printf("In GetDeviceSerialNumberByIndex\n"); sprintf(strSerialNumber, "SIM123456789"); return 0;};
-  void SetDevice(long lDeviceIndex){printf("In SetDevice\n");};
-#endif
+  // Background acquisition: sample the tube every periodMs in a dedicated
+  // thread; GetXRayState() then returns the latest published snapshot
+  // without locking and the Read* methods no longer touch the hardware.
+  void StartAcquisition(Int_t periodMs);
+  void StopAcquisition();
+  Bool_t IsAcquiring() {return fAcqRunning.load();};
+  // Asynchronous commands, run by the tube's command queue in order of
+  // priority: HV off overtakes queued setpoint changes and reads and
+  // revokes a queued power on. The future (and done) report kTRUE once
+  // the command was executed, kFALSE if it was revoked.
+  std::future<Bool_t> SetXRayStateAsync(Bool_t power, const XRayCommandQueue::Done_t& done = XRayCommandQueue::Done_t());
+  std::future<Bool_t> SetXRayVoltageAsync(Float_t xVoltage, const XRayCommandQueue::Done_t& done = XRayCommandQueue::Done_t());
+  std::future<Bool_t> SetXRayCurrentAsync(Float_t xCurrent, const XRayCommandQueue::Done_t& done = XRayCommandQueue::Done_t());
+  std::future<Bool_t> ReadXRayDataAsync(const XRayCommandQueue::Done_t& done = XRayCommandQueue::Done_t());
+  std::future<Bool_t> Submit(XRPriority_t priority, const XRayCommandQueue::Command_t& cmd,
+                             const XRayCommandQueue::Done_t& done = XRayCommandQueue::Done_t());
+  XRayCommandQueue* GetCommandQueue() {return fQueue;};
+  // Setpoint ramps, stepped through the command queue
+  XRayRamp* GetRamp() {return fRamp;};
+  // Sequence programs, run in the background next to the tube
+  XRaySequence* GetSequence() {return fSequence;};
+  // Every reading, and the rollups of the older ones
+  XRayHistory* GetHistory() {return fHistory;};
 
 //---------------------------------
  private:
+  void XRInit(const char* serialNumber);
+  void XRFinishInit(XRayBackend* backend);
   void XRReadConfig();
+  void ReadFields(UInt_t fields);
+  void SampleXRayData();
+  void PublishState() {fSnapshot.Publish(fXRayState);};
+  // PublishState of a reading, kept in the history too
+  void RecordState();
+  static void* AcquisitionThreadFunc(void*);
   Int_t debug;
   HWmode_t fXRayMode;
   XRayState fXRayState;
-  MiniX_Monitor fXRayMonitor;
-  MiniX_Settings fXRaySettings;
   TMutex *fXRayMutex;
+  XRayBackend *fBackend; // MiniX DLL, remote service or simulation
+  XRayCommandQueue *fQueue; // asynchronous commands
+  XRayRamp *fRamp;       // setpoint ramps
+  XRaySequence *fSequence; // EXEC programs
+  XRayHistory *fHistory; // readings over time
   string fSerialNumber;  // Serial number of this X-ray device
-  long fDeviceIndex;     // Device index of this X-ray device
-#ifndef _WIN32
-  byte fXRReady;
-#endif
-#ifdef _WIN32
-  // When enabled, XRay methods forward to a remote service via named pipe
-  bool fUseRemote; 
-  class NamedPipeClient* fPipeClient; // forward decl; implemented in ipc/NamedPipeClient.h
-  bool IPC_Send(const string& req, string* resp);
-  static void SplitTokens(const string& s, char delim, vector<string>& out);
-#endif
+  XRaySnapshot<XRayState> fSnapshot; // lock-free copy of fXRayState for readers
+  ULong64_t fVersionBase; // start time, usec: no run changes a million times a second
+  TThread *fAcqThread;
+  std::atomic<bool> fAcqRunning;
+  Int_t fAcqPeriodMs;    // acquisition period, msec; 0 = acquire on demand
 };
 #endif //XRAY_H
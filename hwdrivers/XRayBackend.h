@@ -0,0 +1,65 @@
+#ifndef XRAYBACKEND_H
+#define XRAYBACKEND_H
+
+#include <string>
+#include "../Vparams.h"
+
+// State of one X-ray tube as seen by XRay and its clients
+typedef struct {
+  Bool_t Power;
+  Float_t VoltageToSet, ActualVoltage;
+  Float_t CurrentToSet, ActualCurrent;
+  Float_t ActualPower, Temperature;
+} XRayState_t;
+
+// Fields refreshed by XRayBackend::ReadData
+enum {
+  kXRVoltage = 1,
+  kXRCurrent = 2,
+  kXRPower = 4,
+  kXRTemperature = 8,
+  kXRAllFields = kXRVoltage | kXRCurrent | kXRPower | kXRTemperature
+};
+
+//===========================================
+// Hardware access of one XRay.
+// XRay selects one implementation at construction (MiniX DLL, remote
+// service via pipe or simulation) and from then on only keeps the state,
+// the locking and the snapshot; each backend call receives the tube
+// state and updates it in place. Callers hold the XRay mutex.
+class XRayBackend
+{
+ public:
+  virtual ~XRayBackend() {};
+
+  virtual const char *GetName() = 0;
+  virtual HWmode_t GetMode() = 0;
+  virtual const char *GetSerialNumber() = 0;
+
+  // Switch HV on/off with the setpoints in st; kFALSE if the command
+  // did not reach the tube
+  virtual Bool_t SetPower(XRayState_t &st, Bool_t power) = 0;
+  // New st.VoltageToSet / st.CurrentToSet requested
+  virtual void SetVoltage(XRayState_t &st) = 0;
+  virtual void SetCurrent(XRayState_t &st) = 0;
+  // Apply both setpoints together
+  virtual void SetHVAndCurrent(XRayState_t &st) = 0;
+  // Refresh the measured values selected by fields (kXR* mask)
+  virtual void ReadData(XRayState_t &st, UInt_t fields) = 0;
+  // Bring st up to date with a state kept elsewhere (remote service)
+  virtual void RefreshState(XRayState_t &) {};
+  // Backend specific part of XRay::PrintStatus
+  virtual void PrintStatus() {};
+
+  virtual void GetDeviceList() {};
+  virtual long GetDeviceCount() {return 0;};
+  virtual long GetDeviceSerialNumberByIndex(long, char *) {return -1;};
+  virtual void SetDevice(long) {};
+  // Run a sequence program where the tube is; kFALSE if that is here,
+  // for XRay to run it itself
+  virtual Bool_t ExecCommand(const std::string &, std::string *)
+  {
+    return kFALSE;
+  };
+};
+#endif //XRAYBACKEND_H
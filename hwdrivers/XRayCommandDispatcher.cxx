@@ -0,0 +1,845 @@
+#include "stdafx.h"
+#include "XRayCommandDispatcher.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "XRay.h"
+#include "XRayManager.h"
+#include "XRClock.h"
+#include "ipc/RequestPipeline.h"
+#include "ipc/XRayProtocol.h"
+#include "XRLog.h"
+
+static Vparams &params = *Vparams::getParams();
+
+// Indexed by Command_t
+static const char *const kCommandNames[XRayCommandDispatcher::kNCommands] = {
+  "", "INIT", "SHUTDOWN", "GET_STATE", "READ_DATA", "GET_SERIAL",
+  "SET_POWER", "SET_VOLTAGE", "SET_CURRENT", "SET_HV_I", "SUBSCRIBE", "UNSUBSCRIBE",
+  "QUEUE_STATS", "RAMP", "RAMP_STATUS", "RAMP_ABORT", "PRINT_STATUS",
+  "GET_DEVICE_LIST", "GET_DEVICE_COUNT", "GET_DEVICE_SERIAL", "SET_DEVICE", "EXEC",
+  "READ_ALL", "LEASE", "RELEASE", "OBSERVE", "EXEC_STATUS", "EXEC_ABORT",
+  "HISTORY"
+};
+
+//---------------------------------------------------------------------------
+XRayCommandDispatcher::XRayCommandDispatcher(MultiPipeServer &server, XRayManager *manager, XRay *defaultTube)
+  : fServer(server)
+{
+  debug = params.verbose;
+  fManager = manager;
+  fDefault = defaultTube;
+  LevelParameter *p1 = params.conf->GetParameter<LevelParameter>("XRLease");
+  fLeaseMs = p1 ? (Long64_t)p1->Level : XRLEASE;
+  fText = RequestPipeline::wrap(server, [this](int client, const std::string &line, const MultiPipeServer::Reply &reply) {
+    HandleText(client, line, reply);
+  });
+}
+//---------------------------------------------------------------------------
+void XRayCommandDispatcher::Stop()
+{
+  fHub.Stop();
+  // Programs report to the clients of this server
+  for (Int_t i = 0; fManager && i < fManager->GetNTubes(); i++)
+    fManager->GetTube(i)->GetSequence()->Abort();
+  if (fDefault)
+    fDefault->GetSequence()->Abort();
+}
+//---------------------------------------------------------------------------
+XRayCommandDispatcher::Command_t XRayCommandDispatcher::Lookup(const CommandToken &name)
+{
+  Command_t cmd;
+  switch (name.hash())
+  {
+  case CommandHash("INIT"): cmd = kInit; break;
+  case CommandHash("SHUTDOWN"): cmd = kShutdown; break;
+  case CommandHash("GET_STATE"): cmd = kGetState; break;
+  case CommandHash("READ_DATA"): cmd = kReadData; break;
+  case CommandHash("GET_SERIAL"): cmd = kGetSerial; break;
+  case CommandHash("SET_POWER"): cmd = kSetPower; break;
+  case CommandHash("SET_VOLTAGE"): cmd = kSetVoltage; break;
+  case CommandHash("SET_CURRENT"): cmd = kSetCurrent; break;
+  case CommandHash("SET_HV_I"): cmd = kSetHVI; break;
+  case CommandHash("SUBSCRIBE"): cmd = kSubscribe; break;
+  case CommandHash("UNSUBSCRIBE"): cmd = kUnsubscribe; break;
+  case CommandHash("QUEUE_STATS"): cmd = kQueueStats; break;
+  case CommandHash("RAMP"): cmd = kRamp; break;
+  case CommandHash("RAMP_STATUS"): cmd = kRampStatus; break;
+  case CommandHash("RAMP_ABORT"): cmd = kRampAbort; break;
+  case CommandHash("PRINT_STATUS"): cmd = kPrintStatus; break;
+  case CommandHash("GET_DEVICE_LIST"): cmd = kGetDeviceList; break;
+  case CommandHash("GET_DEVICE_COUNT"): cmd = kGetDeviceCount; break;
+  case CommandHash("GET_DEVICE_SERIAL"): cmd = kGetDeviceSerial; break;
+  case CommandHash("SET_DEVICE"): cmd = kSetDevice; break;
+  case CommandHash("EXEC"): cmd = kExec; break;
+  case CommandHash("READ_ALL"): cmd = kReadAll; break;
+  case CommandHash("LEASE"): cmd = kLease; break;
+  case CommandHash("RELEASE"): cmd = kRelease; break;
+  case CommandHash("OBSERVE"): cmd = kObserve; break;
+  case CommandHash("EXEC_STATUS"): cmd = kExecStatus; break;
+  case CommandHash("EXEC_ABORT"): cmd = kExecAbort; break;
+  case CommandHash("HISTORY"): cmd = kHistory; break;
+  default:
+    return kUnknown;
+  }
+  // Another word may share the hash
+  return name.is(kCommandNames[cmd]) ? cmd : kUnknown;
+}
+//---------------------------------------------------------------------------
+Bool_t XRayCommandDispatcher::IsControl(Command_t cmd)
+{
+  switch (cmd)
+  {
+  case kSetPower: case kSetVoltage: case kSetCurrent: case kSetHVI:
+  case kRamp: case kRampAbort: case kSetDevice: case kExec: case kExecAbort:
+    return kTRUE;
+  default:
+    return kFALSE;
+  }
+}
+//---------------------------------------------------------------------------
+const char *XRayCommandDispatcher::GetCommandName(Command_t cmd)
+{
+  return cmd > kUnknown && cmd < kNCommands ? kCommandNames[cmd] : "UNKNOWN";
+}
+//---------------------------------------------------------------------------
+// |power|vset|v|iset|i|p|t|version
+static void AppendFields(std::string &out, const XRayState_t &st, ULong64_t version)
+{
+  char buf[256];
+  snprintf(buf, sizeof(buf), "|%d|%f|%f|%f|%f|%f|%f|%llu", st.Power ? 1 : 0, st.VoltageToSet,
+           st.ActualVoltage, st.CurrentToSet, st.ActualCurrent, st.ActualPower, st.Temperature,
+           (unsigned long long)version);
+  out += buf;
+}
+//---------------------------------------------------------------------------
+std::string XRayCommandDispatcher::FormatState(const XRayState_t &st, ULong64_t version)
+{
+  std::string out("OK");
+  AppendFields(out, st, version);
+  return out;
+}
+//---------------------------------------------------------------------------
+// The version is taken before the state: a change in between makes the
+// reply newer than its version (sent again next time), never older
+static std::string FormatSnapshot(XRay *xray)
+{
+  ULong64_t version = xray->GetStateVersion();
+  return XRayCommandDispatcher::FormatState(xray->GetXRaySnapshot(), version);
+}
+//---------------------------------------------------------------------------
+// XRayMsgState reply frame
+static std::string EncodeState(uint16_t op, uint32_t id, const XRayState_t &st)
+{
+  XRayMsgState m;
+  memset(&m, 0, sizeof(m));
+  m.power = st.Power ? 1 : 0;
+  m.voltageToSet = st.VoltageToSet;
+  m.actualVoltage = st.ActualVoltage;
+  m.currentToSet = st.CurrentToSet;
+  m.actualCurrent = st.ActualCurrent;
+  m.actualPower = st.ActualPower;
+  m.temperature = st.Temperature;
+  return XRayEncode(op, XRayStatusOk, id, &m, sizeof(m));
+}
+//---------------------------------------------------------------------------
+// Snapshot of xray as a reply frame, with its XRayMsgVersion if versioned
+static std::string EncodeSnapshot(uint16_t op, uint32_t id, XRay *xray, Bool_t versioned)
+{
+  // Version first: it is never newer than the state it goes with
+  XRayMsgVersion current;
+  current.version = xray->GetStateVersion();
+  std::string r = EncodeState(op, id, xray->GetXRaySnapshot());
+  if (versioned)
+    r.append((const char *)&current, sizeof(current));
+  return r;
+}
+//---------------------------------------------------------------------------
+// READ_ALL replies, in tube order: OK|<n>|<serial>,power,vset,v,iset,i,p,t,version|...
+// as text (a field per tube, so it nests in a BATCH reply), one
+// XRayMsgState per tube in binary
+static std::string FormatAll(const std::vector<XRay *> &tubes)
+{
+  char buf[32];
+  snprintf(buf, sizeof(buf), "OK|%d", (Int_t)tubes.size());
+  std::string out(buf);
+  for (size_t i = 0; i < tubes.size(); i++)
+  {
+    out += '|';
+    out += tubes[i]->GetSerialNumber();
+    size_t start = out.size();
+    ULong64_t version = tubes[i]->GetStateVersion();
+    AppendFields(out, tubes[i]->GetXRaySnapshot(), version);
+    for (size_t k = start; k < out.size(); k++)
+      if (out[k] == '|')
+        out[k] = ',';
+  }
+  return out;
+}
+//---------------------------------------------------------------------------
+static std::string EncodeAll(uint16_t op, uint32_t id, const std::vector<XRay *> &tubes)
+{
+  std::string out = XRayEncode(op, XRayStatusOk, id);
+  for (size_t i = 0; i < tubes.size(); i++)
+  {
+    std::string one = EncodeState(op, id, tubes[i]->GetXRaySnapshot());
+    out.append(one, sizeof(XRayMsgHeader), std::string::npos);
+  }
+  return out;
+}
+//---------------------------------------------------------------------------
+// XRayOpEvent frame: the changed fields only
+static std::string EncodeEvent(const XRayState_t &st, UInt_t changed, ULong64_t seq)
+{
+  XRayMsgEvent ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.changed = (uint8_t)changed;
+  ev.power = st.Power ? 1 : 0;
+  const float values[] = {st.VoltageToSet, st.ActualVoltage, st.CurrentToSet,
+                          st.ActualCurrent, st.ActualPower, st.Temperature};
+  char body[sizeof(ev) + sizeof(values)];
+  size_t size = sizeof(ev);
+  memcpy(body, &ev, sizeof(ev));
+  for (Int_t k = 0; k < 6; k++)
+    if (changed & (XRayFieldVoltageToSet << k))
+    {
+      memcpy(body + size, &values[k], sizeof(float));
+      size += sizeof(float);
+    }
+  return XRayEncode(XRayOpEvent, XRayStatusOk, (uint32_t)seq, body, size);
+}
+//---------------------------------------------------------------------------
+// Completion of a queued command: OK, or revoked by a later HV off
+static XRayCommandQueue::Done_t Acked(const MultiPipeServer::Reply &reply)
+{
+  return [reply](Bool_t done) { reply(done ? "OK" : "ERR|revoked"); };
+}
+//---------------------------------------------------------------------------
+static XRayCommandQueue::Done_t Acked(const MultiPipeServer::Reply &reply, uint16_t op, uint32_t id)
+{
+  return [reply, op, id](Bool_t done) { reply(XRayEncode(op, done ? XRayStatusOk : XRayStatusRevoked, id)); };
+}
+//---------------------------------------------------------------------------
+XRay *XRayCommandDispatcher::GetTube(Int_t client)
+{
+  std::map<Int_t, XRay *>::iterator it = fBound.find(client);
+  return it != fBound.end() ? it->second : fDefault;
+}
+//---------------------------------------------------------------------------
+XRay *XRayCommandDispatcher::FindTube(const CommandToken &tube)
+{
+  if (!fManager || tube.empty())
+    return 0;
+  for (Int_t i = 0; i < fManager->GetNTubes(); i++)
+    if (tube.is(fManager->GetTube(i)->GetSerialNumber()))
+      return fManager->GetTube(i);
+  // Not a serial number: an index
+  char *end;
+  long index = strtol(tube.p, &end, 10);
+  return end == tube.p + tube.n ? fManager->GetTube((Int_t)index) : 0;
+}
+//---------------------------------------------------------------------------
+void XRayCommandDispatcher::ReadAll(Int_t client, const std::function<void(const std::vector<XRay *> &tubes)> &done)
+{
+  std::shared_ptr<std::vector<XRay *> > tubes = std::make_shared<std::vector<XRay *> >();
+  for (Int_t i = 0; fManager && i < fManager->GetNTubes(); i++)
+    tubes->push_back(fManager->GetTube(i));
+  if (tubes->empty() || fObservers.count(client))
+  {
+    done(*tubes);
+    return;
+  }
+  std::shared_ptr<std::atomic<Int_t> > left = std::make_shared<std::atomic<Int_t> >((Int_t)tubes->size());
+  for (size_t i = 0; i < tubes->size(); i++)
+    (*tubes)[i]->ReadXRayDataAsync([tubes, left, done](Bool_t) {
+      if (--*left == 0)
+        done(*tubes);
+    });
+}
+//---------------------------------------------------------------------------
+Bool_t XRayCommandDispatcher::TakeControl(Int_t client, XRay *xray, std::string &denied, Long64_t ms)
+{
+  if (fObservers.count(client))
+  {
+    denied = "ERR|readonly";
+    return kFALSE;
+  }
+  Long64_t now = XRClock::Get()->Now();
+  std::map<XRay *, Lease_t>::iterator it = fLeases.find(xray);
+  Bool_t mine = it != fLeases.end() && it->second.Client == client;
+  if (it != fLeases.end() && !mine)
+  {
+    const Lease_t &held = it->second;
+    char buf[64];
+    if (held.Program && xray->GetSequence()->IsRunning())
+      snprintf(buf, sizeof(buf), "ERR|leased|exec");
+    else if (held.Expires > now)
+      snprintf(buf, sizeof(buf), "ERR|leased|%lld", (long long)(held.Expires - now));
+    else
+      buf[0] = 0;
+    if (buf[0])
+    {
+      denied = buf;
+      return kFALSE;
+    }
+  }
+  // A change renews the lease without cutting a longer LEASE short
+  if (ms <= 0)
+    ms = fLeaseMs;
+  if (ms > kMaxLeaseFactor * fLeaseMs)
+    ms = kMaxLeaseFactor * fLeaseMs;
+  Long64_t expires = now + ms;
+  Lease_t &lease = fLeases[xray];
+  if (!mine)
+    lease.Program = kFALSE;
+  if (!mine || expires > lease.Expires)
+    lease.Expires = expires;
+  lease.Client = client;
+  return kTRUE;
+}
+//---------------------------------------------------------------------------
+void XRayCommandDispatcher::Release(Int_t client)
+{
+  Long64_t now = XRClock::Get()->Now();
+  for (std::map<XRay *, Lease_t>::iterator it = fLeases.begin(); it != fLeases.end();)
+  {
+    Lease_t &lease = it->second;
+    if (lease.Client != client)
+      ++it;
+    else if (lease.Program && it->first->GetSequence()->IsRunning())
+    {
+      // The program keeps the tube, no client's any more; free once it ends
+      lease.Client = -1;
+      lease.Expires = now;
+      ++it;
+    }
+    else
+      fLeases.erase(it++);
+  }
+}
+//---------------------------------------------------------------------------
+void XRayCommandDispatcher::Subscribe(Int_t client, XRay *xray, Int_t minIntervalMs)
+{
+  MultiPipeServer *server = &fServer;
+  if (fServer.isBinary(client))
+    fHub.Subscribe(client, xray, minIntervalMs, [server, client](const XRayState_t &st, UInt_t changed, ULong64_t seq) {
+      server->sendFrame(client, EncodeEvent(st, changed, seq));
+    });
+  else
+    fHub.Subscribe(client, xray, minIntervalMs, [server, client](const XRayState_t &st, UInt_t changed, ULong64_t seq) {
+      server->send(client, XRayTelemetryHub::FormatEvent(st, changed, seq));
+    });
+}
+//---------------------------------------------------------------------------
+void XRayCommandDispatcher::Exec(Int_t client, XRay *xray, const CommandLine &tok, const MultiPipeServer::Reply &reply)
+{
+  std::vector<XRaySeqInstr_t> prog;
+  std::string error;
+  if (!XRaySequence::Compile(tok[1].str(), prog, error))
+  {
+    reply("ERR|" + error);
+    return;
+  }
+  XRaySequence *seq = xray->GetSequence();
+  // Only this thread starts programs, so it cannot start in between
+  if (seq->IsRunning())
+  {
+    reply("ERR|busy");
+    return;
+  }
+  // The client's lease on the tube lasts as long as the program
+  fLeases[xray].Program = kTRUE;
+  if (!tok[2].is("STREAM"))
+  {
+    seq->Start(prog, XRaySequence::Record_t(), [seq, reply]() { reply("OK|" + seq->FormatSummary(kTRUE)); });
+    return;
+  }
+  char buf[64];
+  snprintf(buf, sizeof(buf), "OK|RUNNING|%d", (Int_t)prog.size());
+  reply(buf);
+  MultiPipeServer *server = &fServer;
+  Bool_t binary = fServer.isBinary(client);
+  // EXEC|... pushed as an EVT| line or the text of an XRayOpExecRecord frame
+  std::function<void(const std::string &)> push = [server, client, binary](const std::string &text) {
+    if (binary)
+      server->sendFrame(client, XRayEncode(XRayOpExecRecord, XRayStatusOk, 0, text.data(), text.size()));
+    else
+      server->send(client, "EVT|" + text);
+  };
+  seq->Start(prog, [push](Int_t k, const XRaySeqRecord_t &rec) {
+    char num[32];
+    snprintf(num, sizeof(num), "EXEC|%d|", k);
+    push(num + XRaySequence::FormatRecord(rec));
+  }, [push, seq]() { push("EXEC|END|" + seq->FormatSummary(kFALSE)); });
+}
+//---------------------------------------------------------------------------
+void XRayCommandDispatcher::Handle(Int_t client, const std::string &msg, const MultiPipeServer::Reply &reply)
+{
+  if (fServer.isBinary(client))
+    HandleBinary(client, msg, reply);
+  else
+    fText(client, msg, reply);
+}
+//---------------------------------------------------------------------------
+void XRayCommandDispatcher::Connected(Int_t client, Bool_t connected)
+{
+  if (connected)
+    return;
+  fBound.erase(client);
+  fProtocol.erase(client);
+  fObservers.erase(client);
+  Release(client);
+  fHub.Unsubscribe(client);
+}
+//---------------------------------------------------------------------------
+void XRayCommandDispatcher::HandleText(Int_t client, const std::string &line, const MultiPipeServer::Reply &reply)
+{
+  CommandLine tok(line);
+  XRay *xray = GetTube(client);
+  Bool_t addressed = tok[0].n > 0 && tok[0].p[0] == '#';
+  if (addressed)
+  {
+    // #<tube>|<command>|...: the command line proper follows the prefix
+    xray = FindTube(CommandToken(tok[0].p + 1, tok[0].n - 1));
+    if (!xray)
+    {
+      reply("ERR|notube");
+      return;
+    }
+    size_t skip = tok[0].n + 1;
+    tok.split(line.c_str() + skip, skip < line.size() ? line.size() - skip : 0);
+  }
+  Command_t cmd = Lookup(tok[0]);
+
+  if (cmd == kUnknown)
+  {
+    reply("ERR|unknown");
+    return;
+  }
+  if (cmd == kInit)
+  {
+    // INIT|<serial> binds that device (#<tube>|INIT that tube), one of
+    // the tubes brought up at startup, so a reconnect does not rescan USB
+    XRay *tube = xray;
+    if (!addressed && !tok[1].empty())
+      tube = FindTube(tok[1]);
+    else if (!tube && fManager)
+      tube = fManager->GetTube(0);
+    if (!tube)
+    {
+      reply("ERR|nodevice");
+      return;
+    }
+    fBound[client] = tube;
+    // Return the serial number of the connected device.
+    // INIT|<serial>|PROTO|<version> asks for the binary protocol: the
+    // answer names the version used from the next request on, 0 = text
+    if (!tok[2].is("PROTO"))
+    {
+      reply(std::string("OK|") + tube->GetSerialNumber());
+      return;
+    }
+    long version = tok[3].integer();
+    if (version > kXRayProtoVersion)
+      version = kXRayProtoVersion;
+    if (version < 0)
+      version = 0;
+    char proto[32];
+    snprintf(proto, sizeof(proto), "|PROTO|%ld", version);
+    reply(std::string("OK|") + tube->GetSerialNumber() + proto);
+    fProtocol[client] = (Int_t)version;
+    fServer.setBinary(client, version > 0);
+    return;
+  }
+  if (cmd == kShutdown)
+  {
+    // Ends this session; the server stops with its last client, unless
+    // that is an observer
+    reply("OK");
+    fServer.disconnect(client);
+    if (fServer.clientCount() <= 1 && !fObservers.count(client))
+    {
+      if (fShutdown)
+        fShutdown();
+      fServer.stop();
+    }
+    return;
+  }
+  if (cmd == kObserve)
+  {
+    // OBSERVE[|0]: read-only from now on (0: control again)
+    if (tok[1].empty() || tok[1].integer())
+    {
+      fObservers.insert(client);
+      Release(client);
+    }
+    else
+      fObservers.erase(client);
+    reply("OK");
+    return;
+  }
+  if (cmd == kRelease)
+  {
+    Release(client);
+    reply("OK");
+    return;
+  }
+  if (!xray && cmd != kReadAll)
+  {
+    reply("ERR|noinst");
+    return;
+  }
+  std::string denied;
+  // HV off is never refused; without the control it goes alone
+  Bool_t control = IsControl(cmd) && TakeControl(client, xray, denied);
+  Bool_t safetyOff = cmd == kSetPower && !tok[1].integer();
+  if (IsControl(cmd) && !control && !safetyOff)
+  {
+    reply(denied);
+    return;
+  }
+
+  switch (cmd)
+  {
+  case kGetState:
+    // GET_STATE|IF_CHANGED|<version>: the state only if it moved on
+    if (tok[1].is("IF_CHANGED") && xray->GetStateVersion() == tok[2].uinteger())
+      reply("OK|unchanged");
+    else
+      reply(FormatSnapshot(xray));
+    break;
+  case kReadData:
+    // An observer gets the last reading published, without reading the tube
+    if (fObservers.count(client))
+      reply(FormatSnapshot(xray));
+    else
+      xray->ReadXRayDataAsync([xray, reply](Bool_t) { reply(FormatSnapshot(xray)); });
+    break;
+  case kGetSerial:
+    reply(std::string("OK|") + xray->GetSerialNumber());
+    break;
+  case kSetPower:
+    // Through the command queue: HV off overtakes queued work, and ends a
+    // program of the tube (without waiting for its thread here). Setpoints
+    // that are not numbers refuse HV on, and HV off goes without them
+    if ((tok.size() >= 3 && !tok[2].numeric()) || (tok.size() >= 4 && !tok[3].numeric()))
+    {
+      if (!safetyOff)
+      {
+        reply("ERR|args");
+        break;
+      }
+      control = kFALSE;
+    }
+    if (safetyOff)
+      xray->GetSequence()->Abort(kFALSE);
+    if (control && tok.size() >= 3)
+      xray->SetXRayVoltageAsync((Float_t)tok[2].number());
+    if (control && tok.size() >= 4)
+      xray->SetXRayCurrentAsync((Float_t)tok[3].number());
+    xray->SetXRayStateAsync(tok[1].integer() ? kTRUE : kFALSE, Acked(reply));
+    break;
+  case kSetVoltage:
+    if (tok.size() < 2)
+      reply("OK");
+    else if (!tok[1].numeric())
+      reply("ERR|args");
+    else
+      xray->SetXRayVoltageAsync((Float_t)tok[1].number(), Acked(reply));
+    break;
+  case kSetCurrent:
+    if (tok.size() < 2)
+      reply("OK");
+    else if (!tok[1].numeric())
+      reply("ERR|args");
+    else
+      xray->SetXRayCurrentAsync((Float_t)tok[1].number(), Acked(reply));
+    break;
+  case kSetHVI:
+    // SET_HV_I|kV|uA sets both setpoints before the commit
+    if (tok.size() >= 3 && (!tok[1].numeric() || !tok[2].numeric()))
+      reply("ERR|args");
+    else if (tok.size() >= 3)
+    {
+      Float_t v = (Float_t)tok[1].number(), i = (Float_t)tok[2].number();
+      xray->Submit(kXRControl, [xray, v, i]() { xray->SetXRaySetpoints(v, i); }, Acked(reply));
+    }
+    else
+      xray->Submit(kXRControl, [xray]() { xray->SetXRayHVAndCurrent(); }, Acked(reply));
+    break;
+  case kSubscribe:
+    // SUBSCRIBE[|minIntervalMs]: EVT|<seq>|<field>=<value>|... lines with
+    // the changed fields follow, the first one with all of them
+    reply("OK");
+    Subscribe(client, xray, (Int_t)tok[1].integer());
+    break;
+  case kUnsubscribe:
+    fHub.Unsubscribe(client);
+    reply("OK");
+    break;
+  case kQueueStats:
+    reply(std::string("OK|") + xray->GetCommandQueue()->FormatStats());
+    break;
+  case kRamp:
+  {
+    // RAMP|kV/s|uA/s|stepMs|kV:uA[:holdMs]|... ; 0 takes the configured rate/period
+    if (xray->GetSequence()->IsRunning())
+    {
+      reply("ERR|busy");
+      break;
+    }
+    std::vector<XRayRampStep_t> steps;
+    XRayRampStep_t step;
+    for (size_t k = 4; k < tok.size(); k++)
+      if (XRayRamp::ParseStep(tok[k].p, tok[k].n, step))
+        steps.push_back(step);
+    if (tok.size() < 5 || steps.size() != tok.size() - 4 || !tok.complete())
+    {
+      reply("ERR|args");
+      break;
+    }
+    xray->GetRamp()->Start(steps, (Float_t)tok[1].number(), (Float_t)tok[2].number(), (Int_t)tok[3].integer());
+    reply(std::string("OK|") + xray->GetRamp()->FormatStatus());
+    break;
+  }
+  case kRampStatus:
+    reply(std::string("OK|") + xray->GetRamp()->FormatStatus());
+    break;
+  case kRampAbort:
+    if (xray->GetSequence()->IsRunning())
+    {
+      reply("ERR|busy");
+      break;
+    }
+    xray->GetRamp()->Abort();
+    reply(std::string("OK|") + xray->GetRamp()->FormatStatus());
+    break;
+  case kPrintStatus:
+    xray->Submit(kXRTelemetry, [xray]() { xray->PrintStatus(); }, [reply](Bool_t) { reply("OK"); });
+    break;
+  case kGetDeviceList:
+    xray->Submit(kXRTelemetry, [xray]() { xray->GetDeviceList(); }, [reply](Bool_t) { reply("OK"); });
+    break;
+  case kGetDeviceCount:
+  {
+    std::shared_ptr<long> count = std::make_shared<long>(0);
+    xray->Submit(kXRTelemetry, [xray, count]() { *count = xray->GetDeviceCount(); }, [reply, count](Bool_t) {
+      char buf[64];
+      snprintf(buf, sizeof(buf), "OK|%ld", *count);
+      reply(buf);
+    });
+    break;
+  }
+  case kGetDeviceSerial:
+  {
+    long idx = tok[1].integer();
+    std::shared_ptr<std::string> serial = std::make_shared<std::string>();
+    std::shared_ptr<long> ret = std::make_shared<long>(-1);
+    xray->Submit(kXRTelemetry, [xray, idx, serial, ret]() {
+      char buf[256] = {0};
+      *ret = xray->GetDeviceSerialNumberByIndex(idx, buf);
+      *serial = buf;
+    }, [reply, serial, ret](Bool_t) {
+      char buf[320];
+      snprintf(buf, sizeof(buf), "OK|%ld|%s", *ret, serial->c_str());
+      reply(buf);
+    });
+    break;
+  }
+  case kSetDevice:
+  {
+    long idx = tok[1].integer();
+    xray->Submit(kXRControl, [xray, idx]() { xray->SetDevice(idx); }, [reply](Bool_t) { reply("OK"); });
+    break;
+  }
+  case kExec:
+    Exec(client, xray, tok, reply);
+    break;
+  case kExecStatus:
+    reply(std::string("OK|") + xray->GetSequence()->FormatSummary(kFALSE));
+    break;
+  case kExecAbort:
+    xray->GetSequence()->Abort();
+    reply(std::string("OK|") + xray->GetSequence()->FormatSummary(kFALSE));
+    break;
+  case kHistory:
+  {
+    // HISTORY[|from|to|points], by default the last minute in up to
+    // XRHISTORYPOINTS points: OK|<now>|<msec per point>|<n>|<point>|...
+    Long64_t now = XRClock::Get()->Now();
+    Long64_t from = tok[1].empty() ? -60000 : tok[1].integer();
+    Long64_t to = tok[2].integer();
+    if (from <= 0)
+      from += now;
+    if (to <= 0)
+      to += now + 1;
+    if (to <= from)
+    {
+      reply("ERR|args");
+      break;
+    }
+    std::vector<XRayHistoryPoint_t> points;
+    Long64_t span = xray->GetHistory()->Query(from, to, (Int_t)tok[3].integer(XRHISTORYPOINTS), points);
+    char buf[64];
+    snprintf(buf, sizeof(buf), "OK|%lld|", (long long)now);
+    reply(buf + XRayHistory::FormatQuery(span, points));
+    break;
+  }
+  case kReadAll:
+    ReadAll(client, [reply](const std::vector<XRay *> &tubes) { reply(FormatAll(tubes)); });
+    break;
+  case kLease:
+  {
+    // LEASE[|ms]: hold the control of the tube for ms (0: XRLease)
+    Long64_t ms = tok[1].integer();
+    if (!TakeControl(client, xray, denied, ms))
+    {
+      reply(denied);
+      break;
+    }
+    char buf[64];
+    snprintf(buf, sizeof(buf), "OK|%lld", (long long)(fLeases[xray].Expires - XRClock::Get()->Now()));
+    reply(buf);
+    break;
+  }
+  default:
+    reply("ERR|unknown");
+  }
+}
+//---------------------------------------------------------------------------
+// Binary protocol of the clients that negotiated it (ipc/XRayProtocol.h):
+// the polling and setpoint ops skip text parsing and formatting, any other
+// command travels as text in an XRayOpText frame
+void XRayCommandDispatcher::HandleBinary(Int_t client, const std::string &msg, const MultiPipeServer::Reply &reply)
+{
+  XRayMsgHeader h;
+  const char *body;
+  size_t size;
+  if (!XRayDecode(msg, h, body, size))
+  {
+    reply(XRayEncode(0, XRayStatusError, 0));
+    return;
+  }
+  uint16_t op = h.op;
+  uint32_t id = h.id;
+  if (op == XRayOpText)
+  {
+    fText(client, std::string(body, size), [reply, id](const std::string &r) {
+      reply(XRayEncode(XRayOpText, XRayStatusOk, id, r.data(), r.size()));
+    });
+    return;
+  }
+  if (op == XRayOpPing)
+  {
+    reply(XRayEncode(op, XRayStatusOk, id));
+    return;
+  }
+  if (op == XRayOpReadAll)
+  {
+    ReadAll(client, [reply, op, id](const std::vector<XRay *> &tubes) { reply(EncodeAll(op, id, tubes)); });
+    return;
+  }
+  // The status of a request addresses tube status - 1, 0 the client's own
+  XRay *xray = h.status ? (fManager ? fManager->GetTube((Int_t)h.status - 1) : 0) : GetTube(client);
+  if (!xray)
+  {
+    reply(XRayEncode(op, XRayStatusNoInst, id));
+    return;
+  }
+  XRayMsgSetpoints sp;
+  std::string denied;
+  // HV off is never refused; without the control it goes alone
+  Bool_t safetyOff = op == XRayOpSetPower && XRayBody(body, size, sp) && !sp.power;
+  Bool_t control = (op == XRayOpSetPower || op == XRayOpSetSetpoints) && TakeControl(client, xray, denied);
+  if ((op == XRayOpSetPower || op == XRayOpSetSetpoints) && !control && !safetyOff)
+  {
+    reply(XRayEncode(op, XRayStatusDenied, id));
+    return;
+  }
+  XRayMsgSubscribe sub;
+  XRayMsgVersion known;
+  // Clients of version 4 and older expect the state alone
+  Bool_t versioned = fProtocol[client] >= 5;
+  switch (op)
+  {
+  case XRayOpGetStateIfChanged:
+  {
+    if (!XRayBody(body, size, known))
+    {
+      reply(XRayEncode(op, XRayStatusError, id));
+      break;
+    }
+    if (xray->GetStateVersion() == known.version)
+    {
+      reply(XRayEncode(op, XRayStatusUnchanged, id));
+      break;
+    }
+    reply(EncodeSnapshot(op, id, xray, kTRUE));
+    break;
+  }
+  case XRayOpGetState:
+    reply(EncodeSnapshot(op, id, xray, versioned));
+    break;
+  case XRayOpReadData:
+    if (fObservers.count(client))
+      reply(EncodeSnapshot(op, id, xray, versioned));
+    else
+      xray->ReadXRayDataAsync([xray, reply, op, id, versioned](Bool_t) { reply(EncodeSnapshot(op, id, xray, versioned)); });
+    break;
+  case XRayOpSetPower:
+    if (!XRayBody(body, size, sp))
+    {
+      reply(XRayEncode(op, XRayStatusError, id));
+      break;
+    }
+    // As in text: setpoints that are not finite refuse HV on only
+    if (!isfinite(sp.voltage) || !isfinite(sp.current))
+    {
+      if (!safetyOff)
+      {
+        reply(XRayEncode(op, XRayStatusError, id));
+        break;
+      }
+      control = kFALSE;
+    }
+    if (safetyOff)
+      xray->GetSequence()->Abort(kFALSE);
+    if (control)
+    {
+      xray->SetXRayVoltageAsync(sp.voltage);
+      xray->SetXRayCurrentAsync(sp.current);
+    }
+    xray->SetXRayStateAsync(sp.power ? kTRUE : kFALSE, Acked(reply, op, id));
+    break;
+  case XRayOpSetSetpoints:
+  {
+    if (!XRayBody(body, size, sp) || !isfinite(sp.voltage) || !isfinite(sp.current))
+    {
+      reply(XRayEncode(op, XRayStatusError, id));
+      break;
+    }
+    Float_t v = sp.voltage, i = sp.current;
+    xray->Submit(kXRControl, [xray, v, i]() { xray->SetXRaySetpoints(v, i); }, Acked(reply, op, id));
+    break;
+  }
+  case XRayOpSubscribe:
+    if (!XRayBody(body, size, sub))
+    {
+      reply(XRayEncode(op, XRayStatusError, id));
+      break;
+    }
+    reply(XRayEncode(op, XRayStatusOk, id));
+    Subscribe(client, xray, (Int_t)sub.minIntervalMs);
+    break;
+  case XRayOpUnsubscribe:
+    fHub.Unsubscribe(client);
+    reply(XRayEncode(op, XRayStatusOk, id));
+    break;
+  default:
+    reply(XRayEncode(op, XRayStatusUnknown, id));
+  }
+}
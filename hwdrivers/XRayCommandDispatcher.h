@@ -0,0 +1,121 @@
+#ifndef XRAYCOMMANDDISPATCHER_H
+#define XRAYCOMMANDDISPATCHER_H
+
+#include <Rtypes.h>
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "XRayTelemetryHub.h"
+#include "ipc/CommandLine.h"
+#include "ipc/MultiPipeServer.h"
+
+class XRay;
+class XRayManager;
+
+//===========================================
+// Command set of the pipe servers, shared by the service (main.cxx) and
+// the GUI so both answer every request the same way.
+// A request line is split in place (CommandLine) and its command found by
+// a switch over the compile-time hashes of the names, numbers are read
+// straight from the line: parsing and lookup allocate nothing. Clients
+// that negotiated the binary protocol at INIT are served from frames.
+// Every tube of the manager is served. Each client works on the tube
+// INIT|<serial> bound it to, until then on the default tube, if any; a
+// request prefixed #<tube>| (tube index or serial number) works on that
+// tube instead, as does a binary request with 1 + its index as status.
+// READ_ALL reads every tube at once. State replies carry the version of
+// the tube's state (XRay::GetStateVersion); GET_STATE|IF_CHANGED|<version>
+// answers just OK|unchanged while it is still current, so a fast poller
+// costs next to nothing.
+// A client that changes a tube holds its control lease (XRLease msec
+// after its last change, or as long as LEASE asked, at most
+// kMaxLeaseFactor * XRLease); until then the other clients' changes are
+// refused with ERR|leased|<msec left>. The lease of a client that
+// started an EXEC program lasts as long as the program (ERR|leased|exec
+// meanwhile), even past its disconnect. An HV off is never refused: from
+// a client without the lease, or an observer, it goes without the
+// setpoints it may carry. A client that sent OBSERVE is read-only: its
+// reads are answered from the tubes' snapshots, never waiting for a
+// device.
+// EXEC|<program> runs a sequence program (XRaySequence) on the tube and
+// answers OK|<summary> with its records once it is over; EXEC|<program>|STREAM
+// answers OK|RUNNING|<instructions> at once and pushes EVT|EXEC|<k>|<record>
+// for each record, then EVT|EXEC|END|<summary>. While a program runs it
+// drives the tube's ramp, so RAMP and RAMP_ABORT answer ERR|busy.
+// HISTORY|<from>|<to>|<points> answers the tube's readings of a time
+// window (XRayHistory), msec of the service clock or, <= 0, before now.
+// Runs on the server's event loop thread.
+class XRayCommandDispatcher
+{
+ public:
+  // Called when SHUTDOWN of the last client stops the server
+  typedef std::function<void()> Shutdown_t;
+  // LEASE|<ms> holds a tube for at most this many times XRLease
+  enum {kMaxLeaseFactor = 6};
+
+  enum Command_t {
+    kUnknown, kInit, kShutdown, kGetState, kReadData, kGetSerial,
+    kSetPower, kSetVoltage, kSetCurrent, kSetHVI, kSubscribe, kUnsubscribe,
+    kQueueStats, kRamp, kRampStatus, kRampAbort, kPrintStatus,
+    kGetDeviceList, kGetDeviceCount, kGetDeviceSerial, kSetDevice, kExec,
+    kReadAll, kLease, kRelease, kObserve, kExecStatus, kExecAbort,
+    kHistory, kNCommands
+  };
+
+  XRayCommandDispatcher(MultiPipeServer &server, XRayManager *manager, XRay *defaultTube = 0);
+
+  void SetShutdown(const Shutdown_t &shutdown) { fShutdown = shutdown; }
+  // Request handler and session callback of MultiPipeServer::run
+  void Handle(Int_t client, const std::string &msg, const MultiPipeServer::Reply &reply);
+  void Connected(Int_t client, Bool_t connected);
+  // Ends the pushes; call before the tubes go away
+  void Stop();
+
+  static Command_t Lookup(const CommandToken &name);
+  // kTRUE for the commands that change a tube
+  static Bool_t IsControl(Command_t cmd);
+  static const char *GetCommandName(Command_t cmd);
+  // OK|power|vset|v|iset|i|p|t|version, the GET_STATE / READ_DATA reply
+  static std::string FormatState(const XRayState_t &st, ULong64_t version);
+
+ private:
+  void HandleText(Int_t client, const std::string &line, const MultiPipeServer::Reply &reply);
+  void HandleBinary(Int_t client, const std::string &msg, const MultiPipeServer::Reply &reply);
+  void Subscribe(Int_t client, XRay *xray, Int_t minIntervalMs);
+  void Exec(Int_t client, XRay *xray, const CommandLine &tok, const MultiPipeServer::Reply &reply);
+  XRay *GetTube(Int_t client);
+  // Tube by index or serial number; NULL if there is none
+  XRay *FindTube(const CommandToken &tube);
+  // Fresh reading of every tube, the reads overlapping; done gets the
+  // tubes once the last one is in, on that tube's queue thread. For an
+  // observer done gets them at once, to be served from their snapshots
+  void ReadAll(Int_t client, const std::function<void(const std::vector<XRay *> &tubes)> &done);
+  // kTRUE if client may change xray, taking or renewing its lease for at
+  // least ms (0: XRLease, at most kMaxLeaseFactor * XRLease); otherwise
+  // the reply in denied
+  Bool_t TakeControl(Int_t client, XRay *xray, std::string &denied, Long64_t ms = 0);
+  void Release(Int_t client);
+
+  // Control of a tube
+  typedef struct {
+    Int_t Client;
+    Long64_t Expires;   // msec of XRClock
+    Bool_t Program;     // also held while the tube's program runs
+  } Lease_t;
+
+  Int_t debug;
+  MultiPipeServer &fServer;
+  XRayManager *fManager;
+  Shutdown_t fShutdown;
+  XRay *fDefault;
+  std::map<Int_t, XRay *> fBound;        // INIT of each client
+  std::map<Int_t, Int_t> fProtocol;      // binary version of each client
+  std::map<XRay *, Lease_t> fLeases;
+  std::set<Int_t> fObservers;            // read-only clients
+  Long64_t fLeaseMs;
+  XRayTelemetryHub fHub;                 // SUBSCRIBE
+  MultiPipeServer::RequestHandler fText; // HandleText with @<id>| and BATCH
+};
+#endif //XRAYCOMMANDDISPATCHER_H
@@ -0,0 +1,191 @@
+#include "stdafx.h"
+#include "XRayCommandQueue.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <TThread.h>
+#include "XRClock.h"
+
+//---------------------------------------------------------------------------
+XRayCommandQueue::XRayCommandQueue()
+    : fWork(&fMutex)
+{
+  fThread = 0;
+  fRunning = kFALSE;
+  memset(&fStats, 0, sizeof(fStats));
+  fSafetyCount = 0;
+}
+//---------------------------------------------------------------------------
+XRayCommandQueue::~XRayCommandQueue()
+{
+  std::vector<Entry *> left;
+  fMutex.Lock();
+  fRunning = kFALSE;
+  for (Int_t p = 0; p < kXRNPriorities; p++)
+  {
+    left.insert(left.end(), fQueue[p].begin(), fQueue[p].end());
+    fQueue[p].clear();
+  }
+  fStats.Depth = 0;
+  fWork.Signal();
+  fMutex.UnLock();
+  for (size_t i = 0; i < left.size(); i++)
+    Complete(left[i], kFALSE);
+  if (fThread)
+  {
+    fThread->Join();
+    delete fThread;
+    fThread = 0;
+  }
+}
+//---------------------------------------------------------------------------
+std::future<Bool_t> XRayCommandQueue::Submit(XRPriority_t priority, const Command_t &cmd,
+                                             const Done_t &done, Bool_t revocable)
+{
+  Entry *e = new Entry;
+  e->cmd = cmd;
+  e->done = done;
+  e->promise = std::make_shared<std::promise<Bool_t> >();
+  e->revocable = revocable;
+  e->submitted = XRClock::Get()->Now();
+  std::future<Bool_t> result = e->promise->get_future();
+
+  std::vector<Entry *> revoked;
+  fMutex.Lock();
+  if (priority == kXRSafety)
+  {
+    fSafetyCount++;
+    // HV off wins over a power on that is still waiting
+    for (Int_t p = kXRSafety; p < kXRNPriorities; p++)
+    {
+      std::deque<Entry *> &q = fQueue[p];
+      for (std::deque<Entry *>::iterator it = q.begin(); it != q.end();)
+      {
+        if ((*it)->revocable)
+        {
+          revoked.push_back(*it);
+          it = q.erase(it);
+        }
+        else
+          ++it;
+      }
+    }
+    fStats.Revoked += revoked.size();
+    fStats.Depth -= (Int_t)revoked.size();
+  }
+  fQueue[priority].push_back(e);
+  fStats.Submitted++;
+  fStats.Depth++;
+  if (fStats.Depth > fStats.MaxDepth)
+    fStats.MaxDepth = fStats.Depth;
+  if (!fThread)
+  {
+    fRunning = kTRUE;
+    fThread = new TThread("XRayCmdThread", ThreadFunc, (void *)this);
+    fThread->Run();
+  }
+  fWork.Signal();
+  fMutex.UnLock();
+
+  for (size_t i = 0; i < revoked.size(); i++)
+    Complete(revoked[i], kFALSE);
+  return result;
+}
+//---------------------------------------------------------------------------
+Int_t XRayCommandQueue::GetDepth()
+{
+  fMutex.Lock();
+  Int_t n = fStats.Depth;
+  fMutex.UnLock();
+  return n;
+}
+//---------------------------------------------------------------------------
+ULong64_t XRayCommandQueue::GetSafetyCount()
+{
+  fMutex.Lock();
+  ULong64_t n = fSafetyCount;
+  fMutex.UnLock();
+  return n;
+}
+//---------------------------------------------------------------------------
+void XRayCommandQueue::GetStats(XRayQueueStats_t &stats)
+{
+  fMutex.Lock();
+  stats = fStats;
+  fMutex.UnLock();
+}
+//---------------------------------------------------------------------------
+std::string XRayCommandQueue::FormatStats()
+{
+  XRayQueueStats_t st;
+  GetStats(st);
+  char buf[256];
+  Int_t n = snprintf(buf, sizeof(buf), "%d|%d|%lld|%lld|%lld", st.Depth, st.MaxDepth,
+                     (long long)st.Submitted, (long long)st.Executed, (long long)st.Revoked);
+  for (Int_t p = 0; p < kXRNPriorities && n > 0 && n < (Int_t)sizeof(buf); p++)
+    n += snprintf(buf + n, sizeof(buf) - n, "|%.1f|%lld", st.Count[p] ? (double)st.WaitSum[p] / st.Count[p] : 0.,
+                  (long long)st.MaxWait[p]);
+  return std::string(buf);
+}
+//---------------------------------------------------------------------------
+void XRayCommandQueue::PrintStats()
+{
+  static const char *names[kXRNPriorities] = {"safety", "control", "telemetry"};
+  XRayQueueStats_t st;
+  GetStats(st);
+  printf("Command queue: depth %d (max %d), %lld submitted, %lld executed, %lld revoked\n",
+         st.Depth, st.MaxDepth, (long long)st.Submitted, (long long)st.Executed, (long long)st.Revoked);
+  for (Int_t p = 0; p < kXRNPriorities; p++)
+    if (st.Count[p])
+      printf("  %s: %lld commands, wait mean %.1f ms, max %lld ms\n", names[p], (long long)st.Count[p],
+             (double)st.WaitSum[p] / st.Count[p], (long long)st.MaxWait[p]);
+}
+//---------------------------------------------------------------------------
+void *XRayCommandQueue::ThreadFunc(void *arg)
+{
+  ((XRayCommandQueue *)arg)->Loop();
+  return 0;
+}
+//---------------------------------------------------------------------------
+void XRayCommandQueue::Loop()
+{
+  fMutex.Lock();
+  while (fRunning)
+  {
+    Entry *e = 0;
+    Int_t p = 0;
+    for (; p < kXRNPriorities && !e; p++)
+      if (!fQueue[p].empty())
+      {
+        e = fQueue[p].front();
+        fQueue[p].pop_front();
+        break;
+      }
+    if (!e)
+    {
+      fWork.Wait();
+      continue;
+    }
+    Long64_t wait = XRClock::Get()->Now() - e->submitted;
+    fStats.Depth--;
+    fStats.Count[p]++;
+    fStats.WaitSum[p] += wait;
+    if (wait > fStats.MaxWait[p])
+      fStats.MaxWait[p] = wait;
+    fMutex.UnLock();
+    e->cmd();
+    Complete(e, kTRUE);
+    fMutex.Lock();
+    fStats.Executed++;
+  }
+  fMutex.UnLock();
+}
+//---------------------------------------------------------------------------
+void XRayCommandQueue::Complete(Entry *e, Bool_t executed)
+{
+  if (e->done)
+    e->done(executed);
+  e->promise->set_value(executed);
+  delete e;
+}
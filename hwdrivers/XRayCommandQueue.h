@@ -0,0 +1,83 @@
+#ifndef XRAYCOMMANDQUEUE_H
+#define XRAYCOMMANDQUEUE_H
+
+#include <Rtypes.h>
+#include <TMutex.h>
+#include <TCondition.h>
+#include <functional>
+#include <future>
+#include <memory>
+#include <deque>
+#include <string>
+
+class TThread;
+
+// Priority of a queued tube command, highest first
+enum XRPriority_t {
+  kXRSafety = 0,   // HV off
+  kXRControl,      // power on, setpoints
+  kXRTelemetry,    // reads
+  kXRNPriorities
+};
+
+// Queue statistics, times in msec of XRClock
+typedef struct {
+  Int_t Depth, MaxDepth;
+  Long64_t Submitted, Executed, Revoked;
+  Long64_t WaitSum[kXRNPriorities], MaxWait[kXRNPriorities], Count[kXRNPriorities];
+} XRayQueueStats_t;
+
+//===========================================
+// Per-tube asynchronous command queue.
+// Commands are executed one at a time by a worker thread (started on
+// the first Submit) in order of priority, FIFO within a priority, so a
+// safety command overtakes every queued setpoint change and telemetry
+// read. Submitting a safety command also revokes the queued commands
+// marked revocable (power on), which then complete with kFALSE.
+class XRayCommandQueue
+{
+ public:
+  typedef std::function<void()> Command_t;
+  typedef std::function<void(Bool_t)> Done_t;
+
+  XRayCommandQueue();
+  // Revokes what is still queued and stops the worker
+  ~XRayCommandQueue();
+
+  // The future and done(executed) complete after the command ran
+  // (kTRUE) or was revoked (kFALSE); done runs on the worker thread
+  std::future<Bool_t> Submit(XRPriority_t priority, const Command_t &cmd,
+                             const Done_t &done = Done_t(), Bool_t revocable = kFALSE);
+
+  Int_t GetDepth();
+  // kXRSafety commands submitted so far: a change tells that HV off was
+  // asked for since
+  ULong64_t GetSafetyCount();
+  void GetStats(XRayQueueStats_t &stats);
+  // depth|maxDepth|submitted|executed|revoked followed by mean|max wait
+  // of each priority, as sent by the QUEUE_STATS pipe command
+  std::string FormatStats();
+  void PrintStats();
+
+ private:
+  struct Entry {
+    Command_t cmd;
+    Done_t done;
+    std::shared_ptr<std::promise<Bool_t> > promise;
+    Bool_t revocable;
+    Long64_t submitted;
+  };
+
+  static void *ThreadFunc(void *arg);
+  void Loop();
+  static void Complete(Entry *e, Bool_t executed);
+
+  TMutex fMutex;
+  TCondition fWork;
+  std::deque<Entry *> fQueue[kXRNPriorities];
+  TThread *fThread;
+  Bool_t fRunning;
+  XRayQueueStats_t fStats;
+  ULong64_t fSafetyCount;
+};
+#endif //XRAYCOMMANDQUEUE_H
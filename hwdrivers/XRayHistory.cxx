@@ -0,0 +1,277 @@
+#include "stdafx.h"
+#include "XRayHistory.h"
+
+#include <stdio.h>
+#include "XRLog.h"
+
+static Vparams &params = *Vparams::getParams();
+
+//---------------------------------------------------------------------------
+XRayHistory::XRayHistory()
+{
+  fLast = 0;
+  Long64_t spans[kNLevels] = {0, 1000, 10000, 60000};
+  Int_t capacity[kNLevels] = {XRHISTORYRAW, XRHISTORYSEC, XRHISTORY10SEC, XRHISTORYMIN};
+  VectorParameter *p1 = params.conf->GetParameter<VectorParameter>("XRHistory");
+  for (Int_t k = 0; p1 && k < kNLevels && k < (Int_t)p1->Vector.size(); k++)
+    capacity[k] = (Int_t)p1->Vector[k];
+  for (Int_t k = 0; k < kNLevels; k++)
+  {
+    fLevels[k].Span = spans[k];
+    fLevels[k].Capacity = capacity[k] > 1 ? capacity[k] : 1;
+    fLevels[k].Head = fLevels[k].Size = 0;
+  }
+}
+//---------------------------------------------------------------------------
+Int_t XRayHistory::Find(const Level_t &l, Long64_t t)
+{
+  // The times of a level grow from its oldest entry on
+  Int_t lo = 0, hi = l.Size;
+  while (lo < hi)
+  {
+    Int_t mid = (lo + hi) / 2;
+    if (l.T[Index(l, mid)] < t)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+//---------------------------------------------------------------------------
+Int_t XRayHistory::Push(Level_t &l, Long64_t t)
+{
+  // Grow up to the capacity, then overwrite the oldest entry
+  Bool_t raw = l.Span == 0;
+  Int_t i;
+  if (l.Size < l.Capacity)
+  {
+    if (l.Size == (Int_t)l.T.capacity())
+    {
+      // Doubling, but never past the capacity: the bound is the memory used
+      size_t n = l.Size < 8 ? 16 : 2 * (size_t)l.Size;
+      if (n > (size_t)l.Capacity)
+        n = l.Capacity;
+      l.T.reserve(n);
+      l.FlagsOr.reserve(n);
+      for (Int_t f = 0; f < kHistNValues; f++)
+        l.Min[f].reserve(n);
+      if (!raw)
+      {
+        l.N.reserve(n);
+        l.FlagsAnd.reserve(n);
+        for (Int_t f = 0; f < kHistNValues; f++)
+        {
+          l.Max[f].reserve(n);
+          l.Sum[f].reserve(n);
+        }
+      }
+    }
+    i = l.Size++;
+    l.T.push_back(t);
+    l.FlagsOr.push_back(0);
+    for (Int_t f = 0; f < kHistNValues; f++)
+      l.Min[f].push_back(0);
+    if (!raw)
+    {
+      l.N.push_back(0);
+      l.FlagsAnd.push_back(0);
+      for (Int_t f = 0; f < kHistNValues; f++)
+      {
+        l.Max[f].push_back(0);
+        l.Sum[f].push_back(0);
+      }
+    }
+  }
+  else
+  {
+    i = l.Head;
+    l.Head = (l.Head + 1) % l.Capacity;
+    l.T[i] = t;
+  }
+  return i;
+}
+//---------------------------------------------------------------------------
+void XRayHistory::Add(Long64_t t, const XRayState_t &st)
+{
+  Float_t v[kHistNValues] = {st.ActualVoltage, st.ActualCurrent, st.ActualPower, st.Temperature};
+  UChar_t flags = (st.Power ? kHistPowerOn : 0) | (st.ActualPower > MAXXRAYPOWER ? kHistOverPower : 0);
+
+  fMutex.Lock();
+  // Kept in order for the binary search, should the clock step back
+  if (t < fLast)
+    t = fLast;
+  fLast = t;
+
+  Level_t &raw = fLevels[kRaw];
+  Int_t i = Push(raw, t);
+  raw.FlagsOr[i] = flags;
+  for (Int_t f = 0; f < kHistNValues; f++)
+    raw.Min[f][i] = v[f];
+
+  for (Int_t k = kSec; k < kNLevels; k++)
+  {
+    Level_t &l = fLevels[k];
+    Long64_t start = t - t % l.Span;
+    i = l.Size > 0 ? Index(l, l.Size - 1) : -1;
+    if (i < 0 || l.T[i] != start)
+    {
+      i = Push(l, start);
+      l.N[i] = 0;
+      l.FlagsOr[i] = 0;
+      l.FlagsAnd[i] = 0xff;
+      for (Int_t f = 0; f < kHistNValues; f++)
+      {
+        l.Min[f][i] = l.Max[f][i] = v[f];
+        l.Sum[f][i] = 0;
+      }
+    }
+    l.N[i]++;
+    l.FlagsOr[i] |= flags;
+    l.FlagsAnd[i] &= flags;
+    for (Int_t f = 0; f < kHistNValues; f++)
+    {
+      if (v[f] < l.Min[f][i])
+        l.Min[f][i] = v[f];
+      if (v[f] > l.Max[f][i])
+        l.Max[f][i] = v[f];
+      l.Sum[f][i] += v[f];
+    }
+  }
+  fMutex.UnLock();
+}
+//---------------------------------------------------------------------------
+void XRayHistory::Point(const Level_t &l, Int_t k, XRayHistoryPoint_t &p)
+{
+  Int_t i = Index(l, k);
+  p.T = l.T[i];
+  if (l.Span == 0)
+  {
+    p.N = 1;
+    p.FlagsOr = p.FlagsAnd = l.FlagsOr[i];
+    for (Int_t f = 0; f < kHistNValues; f++)
+      p.Min[f] = p.Mean[f] = p.Max[f] = l.Min[f][i];
+    return;
+  }
+  p.N = l.N[i];
+  p.FlagsOr = l.FlagsOr[i];
+  p.FlagsAnd = l.FlagsAnd[i];
+  for (Int_t f = 0; f < kHistNValues; f++)
+  {
+    p.Min[f] = l.Min[f][i];
+    p.Max[f] = l.Max[f][i];
+    p.Mean[f] = (Float_t)(l.Sum[f][i] / l.N[i]);
+  }
+}
+//---------------------------------------------------------------------------
+void XRayHistory::Merge(XRayHistoryPoint_t &into, const XRayHistoryPoint_t &p)
+{
+  if (p.N == 0)
+    return;
+  if (into.N == 0)
+  {
+    into = p;
+    return;
+  }
+  Int_t n = into.N + p.N;
+  for (Int_t f = 0; f < kHistNValues; f++)
+  {
+    if (p.Min[f] < into.Min[f])
+      into.Min[f] = p.Min[f];
+    if (p.Max[f] > into.Max[f])
+      into.Max[f] = p.Max[f];
+    into.Mean[f] = (Float_t)(((Double_t)into.Mean[f] * into.N + (Double_t)p.Mean[f] * p.N) / n);
+  }
+  into.N = n;
+  into.FlagsOr |= p.FlagsOr;
+  into.FlagsAnd &= p.FlagsAnd;
+}
+//---------------------------------------------------------------------------
+Long64_t XRayHistory::Query(Long64_t t0, Long64_t t1, Int_t maxPoints, std::vector<XRayHistoryPoint_t> &out)
+{
+  if (maxPoints < 1)
+    maxPoints = 1;
+  if (maxPoints > kMaxPoints)
+    maxPoints = kMaxPoints;
+  out.clear();
+  if (t1 <= t0)
+    return 0;
+
+  fMutex.Lock();
+  // Finest level that holds the whole window in few enough points; the
+  // entries that overlap [t0, t1) are those from first to last
+  Int_t level = -1, first = 0, last = 0;
+  for (Int_t k = 0; k < kNLevels && level < 0; k++)
+  {
+    const Level_t &l = fLevels[k];
+    if (l.Size == 0)
+      continue;
+    first = Find(l, l.Span > 0 ? t0 - l.Span + 1 : t0);
+    last = Find(l, t1);
+    Bool_t covers = l.Size < l.Capacity || l.T[Index(l, 0)] <= t0;
+    if ((covers && last - first <= maxPoints) || k == kNLevels - 1)
+      level = k;
+  }
+  if (level < 0 || last <= first)
+  {
+    fMutex.UnLock();
+    return 0;
+  }
+
+  // Only a window too long for the coarsest level needs merging
+  const Level_t &l = fLevels[level];
+  Int_t group = (last - first + maxPoints - 1) / maxPoints;
+  if (group < 1)
+    group = 1;
+  out.reserve((last - first) / group + 1);
+  XRayHistoryPoint_t p, q;
+  for (Int_t k = first; k < last; k += group)
+  {
+    p.N = 0;
+    for (Int_t j = k; j < k + group && j < last; j++)
+    {
+      Point(l, j, q);
+      Merge(p, q);
+    }
+    out.push_back(p);
+  }
+  fMutex.UnLock();
+  return l.Span * group;
+}
+//---------------------------------------------------------------------------
+void XRayHistory::GetUsage(Long64_t &entries, Long64_t &bytes)
+{
+  entries = bytes = 0;
+  fMutex.Lock();
+  for (Int_t k = 0; k < kNLevels; k++)
+  {
+    const Level_t &l = fLevels[k];
+    entries += l.Size;
+    bytes += l.T.capacity() * sizeof(Long64_t) + l.N.capacity() * sizeof(Int_t) +
+             (l.FlagsOr.capacity() + l.FlagsAnd.capacity()) * sizeof(UChar_t);
+    for (Int_t f = 0; f < kHistNValues; f++)
+      bytes += (l.Min[f].capacity() + l.Max[f].capacity()) * sizeof(Float_t) + l.Sum[f].capacity() * sizeof(Double_t);
+  }
+  fMutex.UnLock();
+}
+//---------------------------------------------------------------------------
+std::string XRayHistory::FormatQuery(Long64_t span, const std::vector<XRayHistoryPoint_t> &points)
+{
+  // Appended a value triple at a time: %f of a value near FLT_MAX alone
+  // takes 47 characters
+  char buf[192];
+  snprintf(buf, sizeof(buf), "%lld|%d", (long long)span, (Int_t)points.size());
+  std::string out(buf);
+  out.reserve(out.size() + points.size() * 160);
+  for (size_t k = 0; k < points.size(); k++)
+  {
+    const XRayHistoryPoint_t &p = points[k];
+    snprintf(buf, sizeof(buf), "|%lld,%d,%d,%d", (long long)p.T, p.N, p.FlagsOr, p.FlagsAnd);
+    out += buf;
+    for (Int_t f = 0; f < kHistNValues; f++)
+    {
+      snprintf(buf, sizeof(buf), ",%f,%f,%f", p.Min[f], p.Mean[f], p.Max[f]);
+      out += buf;
+    }
+  }
+  return out;
+}
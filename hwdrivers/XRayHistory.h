@@ -0,0 +1,85 @@
+#ifndef XRAYHISTORY_H
+#define XRAYHISTORY_H
+
+#include <Rtypes.h>
+#include <TMutex.h>
+#include <string>
+#include <vector>
+#include "XRayBackend.h"
+
+// Values kept by XRayHistory, in the order of its arrays
+enum {kHistVoltage = 0, kHistCurrent, kHistPower, kHistTemperature, kHistNValues};
+
+// Status flags of a sample
+enum {
+  kHistPowerOn = 1,     // HV on
+  kHistOverPower = 2    // anode power above MAXXRAYPOWER
+};
+
+// One point of a history query: a sample, or the samples of a bucket
+typedef struct {
+  Long64_t T;           // msec of XRClock: sample time, or bucket start
+  Int_t N;              // samples
+  UChar_t FlagsOr, FlagsAnd; // flags of any / of every sample
+  Float_t Min[kHistNValues], Mean[kHistNValues], Max[kHistNValues];
+} XRayHistoryPoint_t;
+
+//===========================================
+// Telemetry history of one XRay.
+// Every reading goes to a ring of raw samples and to the current bucket
+// of three rollups: min / max / sum per value over 1 s, 10 s and 1 min.
+// Each level keeps one contiguous array per value (structure of arrays)
+// and a fixed number of entries (XRHistory), so memory is bounded
+// however long the run; the oldest entries are overwritten. A query
+// answers from the finest level that covers its window in at most the
+// points asked for, found by binary search: a week costs about what a
+// minute does.
+class XRayHistory
+{
+ public:
+  enum {kRaw = 0, kSec, k10Sec, kMin, kNLevels};
+  enum {kMaxPoints = 10000};
+
+  XRayHistory();
+
+  // Reading st taken at t, msec of XRClock
+  void Add(Long64_t t, const XRayState_t &st);
+  // Points of [t0, t1) from the finest level with at most maxPoints of
+  // them; from the coarsest one, merged down to maxPoints, if none has.
+  // Returns the msec per point (0: raw samples, or none).
+  Long64_t Query(Long64_t t0, Long64_t t1, Int_t maxPoints, std::vector<XRayHistoryPoint_t> &out);
+  // Fold p into the point into (N 0: empty)
+  static void Merge(XRayHistoryPoint_t &into, const XRayHistoryPoint_t &p);
+
+  // Entries held and bytes used, summed over the levels
+  void GetUsage(Long64_t &entries, Long64_t &bytes);
+  // <span>|<n>|t,n,flagsOr,flagsAnd,vmin,vmean,vmax,imin,...,tmax|... as
+  // sent by the HISTORY pipe command
+  static std::string FormatQuery(Long64_t span, const std::vector<XRayHistoryPoint_t> &points);
+
+ private:
+  // Ring of one level; raw samples use Min only, with N, FlagsAnd, Max
+  // and Sum left empty
+  typedef struct {
+    Long64_t Span;       // msec per bucket, 0 raw
+    Int_t Capacity;
+    Int_t Head, Size;    // Head: the oldest entry once the ring is full
+    std::vector<Long64_t> T;
+    std::vector<Int_t> N;
+    std::vector<UChar_t> FlagsOr, FlagsAnd;
+    std::vector<Float_t> Min[kHistNValues], Max[kHistNValues];
+    std::vector<Double_t> Sum[kHistNValues];
+  } Level_t;
+
+  static Int_t Index(const Level_t &l, Int_t k) {return l.Size < l.Capacity ? k : (l.Head + k) % l.Capacity;};
+  // k of the first entry of l at t or later (Size if none)
+  static Int_t Find(const Level_t &l, Long64_t t);
+  // Index of a new newest entry at t
+  static Int_t Push(Level_t &l, Long64_t t);
+  static void Point(const Level_t &l, Int_t k, XRayHistoryPoint_t &p);
+
+  TMutex fMutex;
+  Level_t fLevels[kNLevels];
+  Long64_t fLast;        // time of the newest sample
+};
+#endif //XRAYHISTORY_H
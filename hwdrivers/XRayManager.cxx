@@ -0,0 +1,136 @@
+#include "stdafx.h"
+#include "XRayManager.h"
+
+#include <string.h>
+#include <TThread.h>
+#include "XRClock.h"
+#include "MiniXScheduler.h"
+#include "MiniXCommandPlan.h"
+#include "MiniXDeviceMap.h"
+#ifdef _WIN32
+#include "hwdrivers/miniX/MiniXAPI.h"
+#else
+#include "hwdrivers/miniX/MiniXAPI_Linux.h"
+#endif
+#include "XRLog.h"
+
+//---------------------------------------------------------------------------
+XRayManager::XRayManager()
+{
+  debug = Vparams::getParams()->verbose;
+  fOpened = kFALSE;
+  fScheduler = new MiniXScheduler();
+
+  std::vector<std::string> serials;
+#ifndef VIEWER_ONLY
+  printf("\n\t***** Start MiniX X-Ray tube manager *****\n");
+  LevelParameter *p1 = Vparams::getParams()->conf->GetParameter<LevelParameter>("XRStartupTimeout");
+  Int_t timeout = p1 ? (Int_t)p1->Level : XRSTARTUPTIMEOUT;
+  XRClock *clock = XRClock::Get();
+  Long64_t t0 = clock->Now();
+  fScheduler->Run(-1, [&]() {
+    OpenMiniX();
+    MiniXCommandPlan::ForgetSelection();
+    fOpened = kTRUE;
+    // The controller application needs a variable time to come up
+    Bool_t up = clock->PollUntil([]() { return isMiniXDlg() ? kTRUE : kFALSE; }, timeout);
+    printf("Startup: MiniX application %s after %lld ms\n", up ? "up" : "NOT up",
+           (long long)(clock->Now() - t0));
+    if (!up)
+      return;
+    // One enumeration for the whole process, reused by every lookup
+    MiniXDeviceMap *devices = MiniXDeviceMap::Instance();
+    devices->Refresh();
+    for (long i = 0; i < devices->GetCount(); i++)
+      serials.push_back(devices->GetSerial(i));
+  });
+  printf("Found %d MiniX device(s)\n", (Int_t)serials.size());
+
+  // Bring the tubes up concurrently: the scheduler interleaves their
+  // status polls, so the controllers connect at the same time
+  Long64_t t1 = clock->Now();
+  std::vector<BringUp_t> bringUp(serials.size());
+  std::vector<TThread *> threads;
+  for (size_t i = 0; i < serials.size(); i++)
+  {
+    printf("  Device %d: Serial Number %s\n", (Int_t)i, serials[i].c_str());
+    bringUp[i].Scheduler = fScheduler;
+    bringUp[i].DeviceIndex = (long)i;
+    bringUp[i].SerialNumber = serials[i].c_str();
+    bringUp[i].Tube = 0;
+    threads.push_back(new TThread("XRayBringUpThread", BringUpThreadFunc, (void *)&bringUp[i]));
+    threads.back()->Run();
+  }
+  for (size_t i = 0; i < threads.size(); i++)
+  {
+    threads[i]->Join();
+    delete threads[i];
+    fTubes.push_back(bringUp[i].Tube);
+  }
+  if (!serials.empty())
+    printf("Startup: %d tube(s) brought up in %lld ms, %lld ms since the manager started\n",
+           (Int_t)serials.size(), (long long)(clock->Now() - t1), (long long)(clock->Now() - t0));
+#endif
+
+  if (fTubes.empty())
+    fTubes.push_back(new XRay(fScheduler, -1, NULL));
+}
+//---------------------------------------------------------------------------
+void *XRayManager::BringUpThreadFunc(void *arg)
+{
+  BringUp_t *b = (BringUp_t *)arg;
+  b->Tube = new XRay(b->Scheduler, b->DeviceIndex, b->SerialNumber);
+  return 0;
+}
+//---------------------------------------------------------------------------
+XRayManager::~XRayManager()
+{
+  for (size_t i = 0; i < fTubes.size(); i++)
+    delete fTubes[i];
+  fTubes.clear();
+  // Also when the application came up only after the startup timeout
+  if (fOpened)
+  {
+    fScheduler->Run(-1, [&]() {
+      MiniXDeviceMap::Instance()->Invalidate();
+      CloseMiniX();
+      MiniXCommandPlan::ForgetSelection();
+      XRClock::Get()->Sleep(100);
+    });
+  }
+  delete fScheduler;
+  fScheduler = 0;
+}
+//---------------------------------------------------------------------------
+XRay *XRayManager::GetTube(Int_t i)
+{
+  if (i < 0 || i >= (Int_t)fTubes.size())
+    return 0;
+  return fTubes[i];
+}
+//---------------------------------------------------------------------------
+XRay *XRayManager::GetTube(const char *serialNumber)
+{
+  if (!serialNumber)
+    return 0;
+  // Tube i is bound to device i
+  long index = MiniXDeviceMap::Instance()->Find(serialNumber);
+  if (index >= 0 && index < (long)fTubes.size() && strcmp(fTubes[index]->GetSerialNumber(), serialNumber) == 0)
+    return fTubes[index];
+  // Simulated tubes are not enumerated
+  for (size_t i = 0; i < fTubes.size(); i++)
+    if (strcmp(fTubes[i]->GetSerialNumber(), serialNumber) == 0)
+      return fTubes[i];
+  return 0;
+}
+//---------------------------------------------------------------------------
+void XRayManager::PrintStatus()
+{
+  printf("********* X-ray manager: %d tube(s) *********\n", (Int_t)fTubes.size());
+  for (size_t i = 0; i < fTubes.size(); i++)
+    printf("Tube %d: serial %s, %s\n", (Int_t)i, fTubes[i]->GetSerialNumber(),
+           fTubes[i]->GetXRayMode() == REAL_TIME ? "REAL_TIME" : "SIMULATION");
+  printf("Scheduler: %lld jobs, %lld device switches, max wait %lld ms, %d pending\n",
+         (long long)fScheduler->GetJobCount(), (long long)fScheduler->GetSwitchCount(),
+         (long long)fScheduler->GetMaxWait(), fScheduler->GetPendingCount());
+}
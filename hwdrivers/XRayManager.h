@@ -0,0 +1,45 @@
+#ifndef XRAYMANAGER_H
+#define XRAYMANAGER_H
+
+#include <vector>
+#include <string>
+#include "XRay.h"
+
+class MiniXScheduler;
+
+//===========================================
+// Owner of every MiniX tube of the process.
+// Opens the MiniX DLL once, enumerates the attached devices and creates
+// one XRay per device. All tubes share a single MiniXScheduler so the
+// process-global SetDevice() selection can never race; each tube is
+// still driven through the usual XRay API. The tubes are brought up in
+// parallel, one thread each, so their controllers connect concurrently.
+// With no device attached one simulated tube is provided.
+class XRayManager
+{
+ public:
+  XRayManager();
+  ~XRayManager();
+
+  Int_t GetNTubes() {return (Int_t)fTubes.size();};
+  XRay *GetTube(Int_t i);
+  XRay *GetTube(const char *serialNumber);
+  MiniXScheduler *GetScheduler() {return fScheduler;};
+  void PrintStatus();
+
+ private:
+  // Arguments and result of one bring-up thread
+  typedef struct {
+    MiniXScheduler *Scheduler;
+    long DeviceIndex;
+    const char *SerialNumber;
+    XRay *Tube;
+  } BringUp_t;
+  static void *BringUpThreadFunc(void *arg);
+
+  Int_t debug;
+  MiniXScheduler *fScheduler;
+  std::vector<XRay *> fTubes;
+  Bool_t fOpened;   // OpenMiniX called by this manager, up or not
+};
+#endif //XRAYMANAGER_H
@@ -0,0 +1,292 @@
+#include "stdafx.h"
+#include "XRayRamp.h"
+
+#include <stdio.h>
+#include <math.h>
+#include <TThread.h>
+#include "XRay.h"
+#include "XRClock.h"
+#include "XRLog.h"
+
+static Vparams &params = *Vparams::getParams();
+
+//---------------------------------------------------------------------------
+// Move x towards target by at most step
+static Float_t Approach(Float_t x, Float_t target, Float_t step)
+{
+  if (fabs(target - x) <= step)
+    return target;
+  return x < target ? x + step : x - step;
+}
+//---------------------------------------------------------------------------
+static Float_t Clamp(Float_t x, Float_t min, Float_t max)
+{
+  return x < min ? min : (x > max ? max : x);
+}
+//---------------------------------------------------------------------------
+XRayRamp::XRayRamp(XRay *xray)
+{
+  debug = params.verbose;
+  fXRay = xray;
+  fThread = 0;
+  fAbort = false;
+  fState = kRampIdle;
+  fStep = 0;
+  fProgress = 0;
+  fVoltage = fCurrent = 0;
+  fVoltageRate = fDefVoltageRate = XRRAMPVOLTAGERATE;
+  fCurrentRate = fDefCurrentRate = XRRAMPCURRENTRATE;
+  fStepMs = fDefStepMs = XRRAMPSTEP;
+
+  VectorParameter *p1 = params.conf->GetParameter<VectorParameter>("XRRamp");
+  if (p1 && p1->Vector.size() >= 3)
+  {
+    fDefVoltageRate = (Float_t)p1->Vector[0];
+    fDefCurrentRate = (Float_t)p1->Vector[1];
+    fDefStepMs = (Int_t)p1->Vector[2];
+  }
+}
+//---------------------------------------------------------------------------
+XRayRamp::~XRayRamp()
+{
+  Abort();
+}
+//---------------------------------------------------------------------------
+Bool_t XRayRamp::Start(Float_t xVoltage, Float_t xCurrent)
+{
+  std::vector<XRayRampStep_t> steps(1);
+  steps[0].Voltage = xVoltage;
+  steps[0].Current = xCurrent;
+  steps[0].HoldMs = 0;
+  return Start(steps, 0, 0, 0);
+}
+//---------------------------------------------------------------------------
+Bool_t XRayRamp::Start(const std::vector<XRayRampStep_t> &steps, Float_t voltageRate,
+                       Float_t currentRate, Int_t stepMs)
+{
+  if (steps.empty())
+    return kFALSE;
+  // A new ramp replaces the running one
+  Abort();
+
+  fMutex.Lock();
+  fSteps = steps;
+  for (size_t k = 0; k < fSteps.size(); k++)
+  {
+    fSteps[k].Voltage = Clamp(fSteps[k].Voltage, MINXRAYVOLTAGE, MAXXRAYVOLTAGE);
+    fSteps[k].Current = Clamp(fSteps[k].Current, MINXRAYCURRENT, MAXXRAYCURRENT);
+    if (fSteps[k].HoldMs < 0)
+      fSteps[k].HoldMs = 0;
+  }
+  fVoltageRate = voltageRate > 0 ? voltageRate : fDefVoltageRate;
+  fCurrentRate = currentRate > 0 ? currentRate : fDefCurrentRate;
+  fStepMs = stepMs > 0 ? stepMs : fDefStepMs;
+  fState = kRampRunning;
+  fStep = 0;
+  fProgress = 0;
+  fMutex.UnLock();
+
+  if (debug > 0)
+    printf("In XRayRamp::Start, %d step(s), %.2f kV/s, %.2f uA/s, every %d ms\n",
+           (Int_t)steps.size(), fVoltageRate, fCurrentRate, fStepMs);
+  fAbort = false;
+  fThread = new TThread("XRayRampThread", ThreadFunc, (void *)this);
+  fThread->Run();
+  return kTRUE;
+}
+//---------------------------------------------------------------------------
+void XRayRamp::Abort()
+{
+  fAbort = true;
+  Join();
+}
+//---------------------------------------------------------------------------
+void XRayRamp::Join()
+{
+  if (!fThread)
+    return;
+  fThread->Join();
+  delete fThread;
+  fThread = 0;
+}
+//---------------------------------------------------------------------------
+XRayRamp::RampState_t XRayRamp::GetState()
+{
+  fMutex.Lock();
+  RampState_t state = fState;
+  fMutex.UnLock();
+  return state;
+}
+//---------------------------------------------------------------------------
+const char *XRayRamp::GetStateName(RampState_t state)
+{
+  switch (state)
+  {
+  case kRampIdle:
+    return "IDLE";
+  case kRampRunning:
+    return "RUNNING";
+  case kRampDone:
+    return "DONE";
+  case kRampAborted:
+    return "ABORTED";
+  }
+  return "UNKNOWN";
+}
+//---------------------------------------------------------------------------
+Float_t XRayRamp::GetProgress()
+{
+  fMutex.Lock();
+  Float_t progress = fProgress;
+  fMutex.UnLock();
+  return progress;
+}
+//---------------------------------------------------------------------------
+std::string XRayRamp::FormatStatus()
+{
+  char buf[256];
+  fMutex.Lock();
+  Float_t targetVoltage = fSteps.empty() ? 0 : fSteps.back().Voltage;
+  Float_t targetCurrent = fSteps.empty() ? 0 : fSteps.back().Current;
+  snprintf(buf, sizeof(buf), "%s|%.3f|%d|%d|%f|%f|%f|%f", GetStateName(fState), fProgress,
+           fStep, (Int_t)fSteps.size(), fVoltage, fCurrent, targetVoltage, targetCurrent);
+  fMutex.UnLock();
+  return std::string(buf);
+}
+//---------------------------------------------------------------------------
+Bool_t XRayRamp::ParseStep(const char *str, size_t n, XRayRampStep_t &step)
+{
+  // %n marks where each form ends; anything left in the token is garbage
+  Int_t end = -1, hold = -1;
+  step.HoldMs = 0;
+  if (sscanf(str, "%f:%f%n", &step.Voltage, &step.Current, &end) < 2 || end < 0 ||
+      !isfinite(step.Voltage) || !isfinite(step.Current))
+    return kFALSE;
+  if ((size_t)end < n && str[end] == ':')
+  {
+    if (sscanf(str + end + 1, "%d%n", &step.HoldMs, &hold) < 1 || hold < 0)
+      return kFALSE;
+    end += 1 + hold;
+  }
+  return (size_t)end == n;
+}
+//---------------------------------------------------------------------------
+Bool_t XRayRamp::Commit(Float_t xVoltage, Float_t xCurrent)
+{
+  // Revocable: a queued HV off drops the step and ends the ramp
+  XRay *xr = fXRay;
+  Bool_t executed = xr->GetCommandQueue()->Submit(kXRControl,
+      [xr, xVoltage, xCurrent]() { xr->SetXRaySetpoints(xVoltage, xCurrent); },
+      XRayCommandQueue::Done_t(), kTRUE).get();
+  if (executed)
+  {
+    fMutex.Lock();
+    fVoltage = xVoltage;
+    fCurrent = xCurrent;
+    fMutex.UnLock();
+  }
+  return executed;
+}
+//---------------------------------------------------------------------------
+Bool_t XRayRamp::Pause(Long64_t ms)
+{
+  XRClock *clock = XRClock::Get();
+  Long64_t end = clock->Now() + ms;
+  for (Long64_t left = ms; left > 0 && !fAbort.load(); left = end - clock->Now())
+    clock->Sleep(left < kAbortPollMs ? left : kAbortPollMs);
+  return !fAbort.load();
+}
+//---------------------------------------------------------------------------
+void *XRayRamp::ThreadFunc(void *arg)
+{
+  ((XRayRamp *)arg)->Loop();
+  return 0;
+}
+//---------------------------------------------------------------------------
+void XRayRamp::Loop()
+{
+  XRClock *clock = XRClock::Get();
+  XRay::XRayState st = fXRay->GetXRayState();
+  Float_t v = st.VoltageToSet;
+  Float_t i = st.CurrentToSet;
+  Bool_t wasOn = st.Power;
+  fMutex.Lock();
+  fVoltage = v;
+  fCurrent = i;
+  fMutex.UnLock();
+
+  // Planned duration of every waypoint, msec, for the progress
+  std::vector<Long64_t> duration(fSteps.size());
+  Long64_t total = 0;
+  Float_t pv = v, pi = i;
+  for (size_t k = 0; k < fSteps.size(); k++)
+  {
+    Float_t tv = fabs(fSteps[k].Voltage - pv) / fVoltageRate;
+    Float_t ti = fabs(fSteps[k].Current - pi) / fCurrentRate;
+    duration[k] = (Long64_t)(1000 * (tv > ti ? tv : ti)) + fSteps[k].HoldMs;
+    total += duration[k];
+    pv = fSteps[k].Voltage;
+    pi = fSteps[k].Current;
+  }
+
+  const Float_t dv = fVoltageRate * fStepMs / 1000;
+  const Float_t di = fCurrentRate * fStepMs / 1000;
+  Bool_t ok = kTRUE;
+  Long64_t doneMs = 0;
+  for (size_t k = 0; k < fSteps.size() && ok; k++)
+  {
+    fMutex.Lock();
+    fStep = (Int_t)k;
+    fMutex.UnLock();
+    const XRayRampStep_t &step = fSteps[k];
+    Long64_t start = clock->Now();
+    Long64_t holdEnd = -1;
+    while (ok)
+    {
+      if (v == step.Voltage && i == step.Current)
+      {
+        // Reached: hold the waypoint
+        if (holdEnd < 0)
+          holdEnd = clock->Now() + step.HoldMs;
+        if (clock->Now() >= holdEnd)
+          break;
+        Long64_t left = holdEnd - clock->Now();
+        Pause(left < fStepMs ? left : fStepMs);
+      }
+      else
+      {
+        if (!Pause(fStepMs))
+        {
+          ok = kFALSE;
+          break;
+        }
+        v = Approach(v, step.Voltage, dv);
+        i = Approach(i, step.Current, di);
+        ok = Commit(v, i);
+      }
+      // A tube switched off in the meantime ends the ramp
+      Bool_t isOn = fXRay->GetXRayState().Power;
+      if (fAbort.load() || (wasOn && !isOn))
+        ok = kFALSE;
+      wasOn = isOn;
+
+      Long64_t elapsed = clock->Now() - start;
+      fMutex.Lock();
+      fProgress = total > 0 ? (Float_t)(doneMs + (elapsed < duration[k] ? elapsed : duration[k])) / total : 1;
+      fMutex.UnLock();
+    }
+    doneMs += duration[k];
+  }
+
+  fMutex.Lock();
+  if (ok)
+  {
+    fState = kRampDone;
+    fProgress = 1;
+  }
+  else
+    fState = kRampAborted;
+  fMutex.UnLock();
+  if (debug > 0)
+    printf("XRayRamp %s at %.2f kV, %.2f uA\n", GetStateName(GetState()), v, i);
+}
@@ -0,0 +1,83 @@
+#ifndef XRAYRAMP_H
+#define XRAYRAMP_H
+
+#include <Rtypes.h>
+#include <TMutex.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+class TThread;
+class XRay;
+
+// One waypoint of a ramp: setpoints to reach and time to hold them, msec
+typedef struct {
+  Float_t Voltage, Current;
+  Int_t HoldMs;
+} XRayRampStep_t;
+
+//===========================================
+// Setpoint ramp engine of one XRay.
+// A ramp walks the tube setpoints through a schedule of waypoints: every
+// step period a background thread moves voltage and current towards the
+// next waypoint by at most rate * period and commits both through the
+// tube's command queue, then holds each reached waypoint. Setpoints are
+// clamped to MIN/MAXXRAYVOLTAGE and MIN/MAXXRAYCURRENT. The steps are
+// revocable control commands, so a queued HV off cancels the ramp; so
+// does the tube being switched off while it ramps.
+// Start and Abort are called from one thread at a time: the pipe server's,
+// or that of the tube's sequence program while one runs.
+class XRayRamp
+{
+ public:
+  enum RampState_t {kRampIdle = 0, kRampRunning, kRampDone, kRampAborted};
+  // The ramp thread checks for Abort this often, msec, so that Start and
+  // Abort do not wait out a whole step period on the caller's thread
+  enum {kAbortPollMs = 10};
+
+  XRayRamp(XRay *xray);
+  // Aborts a running ramp
+  ~XRayRamp();
+
+  // Ramp to one target with the configured rates and step period
+  Bool_t Start(Float_t xVoltage, Float_t xCurrent);
+  // Ramp through steps; rates in kV/s and uA/s, <=0 takes the default
+  Bool_t Start(const std::vector<XRayRampStep_t> &steps, Float_t voltageRate,
+               Float_t currentRate, Int_t stepMs);
+  void Abort();
+
+  RampState_t GetState();
+  static const char *GetStateName(RampState_t state);
+  // Fraction of the schedule done, 0..1
+  Float_t GetProgress();
+  // state|progress|step|nsteps|voltage|current|targetVoltage|targetCurrent
+  // as sent by the RAMP_STATUS pipe command
+  std::string FormatStatus();
+  // Waypoint of the RAMP pipe command: kV:uA[:holdMs] in finite numbers.
+  // str may point into the line; the step must fill exactly its n characters
+  static Bool_t ParseStep(const char *str, size_t n, XRayRampStep_t &step);
+
+ private:
+  static void *ThreadFunc(void *arg);
+  void Loop();
+  Bool_t Commit(Float_t xVoltage, Float_t xCurrent);
+  // Sleep ms in steps, kFALSE if aborted meanwhile
+  Bool_t Pause(Long64_t ms);
+  void Join();
+
+  Int_t debug;
+  XRay *fXRay;
+  TMutex fMutex;             // guards the status below
+  TThread *fThread;
+  std::atomic<bool> fAbort;
+  std::vector<XRayRampStep_t> fSteps;
+  Float_t fVoltageRate, fCurrentRate; // kV/s, uA/s
+  Int_t fStepMs;
+  RampState_t fState;
+  Int_t fStep;               // waypoint being approached or held
+  Float_t fProgress;
+  Float_t fVoltage, fCurrent; // last committed setpoints
+  Float_t fDefVoltageRate, fDefCurrentRate;
+  Int_t fDefStepMs;
+};
+#endif //XRAYRAMP_H
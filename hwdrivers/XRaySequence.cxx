@@ -0,0 +1,459 @@
+#include "stdafx.h"
+#include "XRaySequence.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <future>
+#include <memory>
+#include <TThread.h>
+#include "XRay.h"
+#include "XRClock.h"
+#include "ipc/CommandLine.h"
+#include "XRLog.h"
+
+static Vparams &params = *Vparams::getParams();
+
+// Statement keywords, indexed by Op_t
+static const char *const kOpNames[] = {"set", "ramp", "power", "wait", "settle", "read", "loop", "end"};
+
+//---------------------------------------------------------------------------
+static Float_t Clamp(Float_t x, Float_t min, Float_t max)
+{
+  return x < min ? min : (x > max ? max : x);
+}
+//---------------------------------------------------------------------------
+// Arguments w[1..] of a statement as numbers into A..D; kFALSE unless
+// there are min to max of them and each one is a number as a whole
+static Bool_t Numbers(const std::vector<CommandToken> &w, size_t min, size_t max, XRaySeqInstr_t &in)
+{
+  if (w.size() - 1 < min || w.size() - 1 > max)
+    return kFALSE;
+  Float_t *out[] = {&in.A, &in.B, &in.C, &in.D};
+  for (size_t k = 1; k < w.size(); k++)
+  {
+    char *end;
+    double v = strtod(w[k].p, &end);
+    if (end != w[k].p + w[k].n)
+      return kFALSE;
+    *out[k - 1] = (Float_t)v;
+  }
+  return kTRUE;
+}
+//---------------------------------------------------------------------------
+XRaySequence::XRaySequence(XRay *xray)
+{
+  debug = params.verbose;
+  fXRay = xray;
+  fThread = 0;
+  fAbort = false;
+  fState = kSeqIdle;
+  fPC = 0;
+  fStart = fEnd = 0;
+  fNRecords = 0;
+  fSettleVoltage = XRSETTLEVOLTAGE;
+  fSettleCurrent = XRSETTLECURRENT;
+  fSettleMs = XRSETTLETIMEOUT;
+  fPollMs = XRSETTLEPOLL;
+
+  VectorParameter *p1 = params.conf->GetParameter<VectorParameter>("XRSettle");
+  if (p1 && p1->Vector.size() >= 4)
+  {
+    fSettleVoltage = (Float_t)p1->Vector[0];
+    fSettleCurrent = (Float_t)p1->Vector[1];
+    fSettleMs = (Int_t)p1->Vector[2];
+    fPollMs = (Int_t)p1->Vector[3];
+  }
+  if (fPollMs < 1)
+    fPollMs = 1;
+}
+//---------------------------------------------------------------------------
+XRaySequence::~XRaySequence()
+{
+  Abort();
+}
+//---------------------------------------------------------------------------
+Bool_t XRaySequence::Compile(const std::string &source, std::vector<XRaySeqInstr_t> &prog, std::string &error)
+{
+  prog.clear();
+  std::vector<Int_t> open; // loops without their end yet
+  std::vector<CommandToken> w;
+  Int_t stmt = 0;
+  const char *why = 0;
+  if (source.find('\n') != std::string::npos)
+    why = "new line";
+  size_t start = 0;
+  while (start < source.size() && !why)
+  {
+    size_t stop = source.find(';', start);
+    if (stop == std::string::npos)
+      stop = source.size();
+    // Words of the statement, pointing into the source
+    w.clear();
+    for (size_t k = start; k < stop;)
+    {
+      while (k < stop && strchr(" \t\r", source[k]))
+        k++;
+      size_t first = k;
+      while (k < stop && !strchr(" \t\r", source[k]))
+        k++;
+      if (k > first)
+        w.push_back(CommandToken(source.c_str() + first, k - first));
+    }
+    start = stop + 1;
+    if (w.empty())
+      continue;
+    stmt++;
+
+    XRaySeqInstr_t in;
+    memset(&in, 0, sizeof(in));
+    in.Op = -1;
+    for (Int_t op = kSeqSet; op <= kSeqEnd; op++)
+      if (w[0].is(kOpNames[op]))
+        in.Op = op;
+    Bool_t ok = kTRUE;
+    switch (in.Op)
+    {
+    case kSeqSet:
+      ok = Numbers(w, 2, 2, in);
+      break;
+    case kSeqRamp:
+      ok = Numbers(w, 2, 4, in);
+      break;
+    case kSeqPower:
+      ok = w.size() == 2 && (w[1].is("on") || w[1].is("off"));
+      in.A = ok && w[1].is("on") ? 1 : 0;
+      break;
+    case kSeqWait:
+      ok = Numbers(w, 1, 1, in) && in.A >= 0;
+      break;
+    case kSeqSettle:
+      ok = Numbers(w, 0, 3, in);
+      break;
+    case kSeqRead:
+      ok = w.size() == 1;
+      break;
+    case kSeqLoop:
+      ok = Numbers(w, 1, 1, in) && in.A >= 0;
+      open.push_back((Int_t)prog.size());
+      break;
+    case kSeqEnd:
+      ok = w.size() == 1;
+      if (open.empty())
+      {
+        why = "end without loop";
+        continue;
+      }
+      in.Jump = open.back();
+      prog[open.back()].Jump = (Int_t)prog.size();
+      open.pop_back();
+      break;
+    default:
+      why = "unknown statement";
+      continue;
+    }
+    if (!ok)
+      why = "arguments";
+    else if (prog.size() >= kMaxInstr)
+      why = "too long";
+    else
+      prog.push_back(in);
+  }
+  if (!why && !open.empty())
+    why = "loop without end";
+  if (!why && prog.empty())
+    why = "empty";
+  if (!why)
+    return kTRUE;
+  char buf[128];
+  snprintf(buf, sizeof(buf), "compile|%d|%s", stmt, why);
+  error = buf;
+  return kFALSE;
+}
+//---------------------------------------------------------------------------
+Bool_t XRaySequence::Start(const std::vector<XRaySeqInstr_t> &prog, const Record_t &onRecord, const Done_t &onDone)
+{
+  if (prog.empty() || IsRunning())
+    return kFALSE;
+  // The thread of the last program is over
+  Join();
+
+  fMutex.Lock();
+  fProg = prog;
+  fOnRecord = onRecord;
+  fOnDone = onDone;
+  fState = kSeqRunning;
+  fPC = 0;
+  fStart = XRClock::Get()->Now();
+  fEnd = -1;
+  fRecords.clear();
+  fNRecords = 0;
+  fMutex.UnLock();
+
+  if (debug > 0)
+    printf("In XRaySequence::Start, %d instruction(s)\n", (Int_t)prog.size());
+  fAbort = false;
+  fSafety = fXRay->GetCommandQueue()->GetSafetyCount();
+  fThread = new TThread("XRaySequenceThread", ThreadFunc, (void *)this);
+  fThread->Run();
+  return kTRUE;
+}
+//---------------------------------------------------------------------------
+Bool_t XRaySequence::Run(const std::string &source, std::string *result)
+{
+  std::vector<XRaySeqInstr_t> prog;
+  std::string error;
+  if (!Compile(source, prog, error))
+  {
+    *result = "ERR|" + error;
+    return kFALSE;
+  }
+  std::shared_ptr<std::promise<void> > done = std::make_shared<std::promise<void> >();
+  std::future<void> ended = done->get_future();
+  if (!Start(prog, Record_t(), [done]() { done->set_value(); }))
+  {
+    *result = "ERR|busy";
+    return kFALSE;
+  }
+  ended.wait();
+  *result = FormatSummary(kTRUE);
+  return GetState() == kSeqDone;
+}
+//---------------------------------------------------------------------------
+void XRaySequence::Abort(Bool_t wait)
+{
+  fAbort = true;
+  if (wait)
+    Join();
+}
+//---------------------------------------------------------------------------
+void XRaySequence::Join()
+{
+  if (!fThread)
+    return;
+  fThread->Join();
+  delete fThread;
+  fThread = 0;
+}
+//---------------------------------------------------------------------------
+Bool_t XRaySequence::IsRunning()
+{
+  return GetState() == kSeqRunning;
+}
+//---------------------------------------------------------------------------
+XRaySequence::SeqState_t XRaySequence::GetState()
+{
+  fMutex.Lock();
+  SeqState_t state = fState;
+  fMutex.UnLock();
+  return state;
+}
+//---------------------------------------------------------------------------
+const char *XRaySequence::GetStateName(SeqState_t state)
+{
+  switch (state)
+  {
+  case kSeqIdle:
+    return "IDLE";
+  case kSeqRunning:
+    return "RUNNING";
+  case kSeqDone:
+    return "DONE";
+  case kSeqAborted:
+    return "ABORTED";
+  case kSeqTimeout:
+    return "TIMEOUT";
+  }
+  return "UNKNOWN";
+}
+//---------------------------------------------------------------------------
+std::string XRaySequence::FormatRecord(const XRaySeqRecord_t &rec)
+{
+  char buf[256];
+  const XRayState_t &st = rec.State;
+  snprintf(buf, sizeof(buf), "%lld,%d,%f,%f,%f,%f,%f,%f", (long long)rec.T, st.Power ? 1 : 0,
+           st.VoltageToSet, st.ActualVoltage, st.CurrentToSet, st.ActualCurrent, st.ActualPower, st.Temperature);
+  return std::string(buf);
+}
+//---------------------------------------------------------------------------
+std::string XRaySequence::FormatSummary(Bool_t records)
+{
+  char buf[128];
+  fMutex.Lock();
+  Long64_t elapsed = (fEnd >= 0 ? fEnd : XRClock::Get()->Now()) - fStart;
+  snprintf(buf, sizeof(buf), "%s|%d|%d|%lld|%d", GetStateName(fState), fPC, (Int_t)fProg.size(),
+           (long long)(fState == kSeqIdle ? 0 : elapsed), fNRecords);
+  std::string out(buf);
+  for (size_t k = 0; records && k < fRecords.size(); k++)
+  {
+    out += '|';
+    out += FormatRecord(fRecords[k]);
+  }
+  fMutex.UnLock();
+  return out;
+}
+//---------------------------------------------------------------------------
+Bool_t XRaySequence::Commit(Float_t xVoltage, Float_t xCurrent)
+{
+  XRay *xr = fXRay;
+  Float_t v = Clamp(xVoltage, MINXRAYVOLTAGE, MAXXRAYVOLTAGE);
+  Float_t i = Clamp(xCurrent, MINXRAYCURRENT, MAXXRAYCURRENT);
+  return Submit([xr, v, i]() { xr->SetXRaySetpoints(v, i); });
+}
+//---------------------------------------------------------------------------
+Bool_t XRaySequence::Submit(const std::function<void()> &cmd)
+{
+  // Revocable: a queued HV off drops the step. One submitted before the
+  // step but after the last check runs first, and the step sees it
+  XRayCommandQueue *queue = fXRay->GetCommandQueue();
+  ULong64_t safety = fSafety;
+  queue->Submit(kXRControl, [queue, safety, cmd]() {
+    if (queue->GetSafetyCount() == safety)
+      cmd();
+  }, XRayCommandQueue::Done_t(), kTRUE).get();
+  return !Stopped();
+}
+//---------------------------------------------------------------------------
+Bool_t XRaySequence::Stopped()
+{
+  return fAbort.load() || fXRay->GetCommandQueue()->GetSafetyCount() != fSafety;
+}
+//---------------------------------------------------------------------------
+Bool_t XRaySequence::Read(XRayState_t &st)
+{
+  Bool_t ok = fXRay->ReadXRayDataAsync().get();
+  st = fXRay->GetXRaySnapshot();
+  return ok && !Stopped();
+}
+//---------------------------------------------------------------------------
+Bool_t XRaySequence::Pause(Long64_t ms)
+{
+  XRClock *clock = XRClock::Get();
+  Long64_t end = clock->Now() + ms;
+  for (Long64_t left = ms; left > 0 && !Stopped(); left = end - clock->Now())
+    clock->Sleep(left < fPollMs ? left : fPollMs);
+  return !Stopped();
+}
+//---------------------------------------------------------------------------
+XRaySequence::SeqState_t XRaySequence::Execute(const XRaySeqInstr_t &in)
+{
+  XRClock *clock = XRClock::Get();
+  switch (in.Op)
+  {
+  case kSeqSet:
+    return Commit(in.A, in.B) ? kSeqRunning : kSeqAborted;
+  case kSeqRamp:
+  {
+    XRayRamp *ramp = fXRay->GetRamp();
+    std::vector<XRayRampStep_t> steps(1);
+    steps[0].Voltage = in.A;
+    steps[0].Current = in.B;
+    steps[0].HoldMs = 0;
+    ramp->Start(steps, in.C, in.D, 0);
+    while (ramp->GetState() == XRayRamp::kRampRunning)
+      if (!Pause(fPollMs))
+      {
+        ramp->Abort();
+        return kSeqAborted;
+      }
+    return ramp->GetState() == XRayRamp::kRampDone ? kSeqRunning : kSeqAborted;
+  }
+  case kSeqPower:
+  {
+    XRay *xr = fXRay;
+    if (in.A != 0)
+      return Submit([xr]() { xr->SetXRayState(kTRUE); }) ? kSeqRunning : kSeqAborted;
+    // The program's own HV off does not stop it
+    std::future<Bool_t> off = xr->SetXRayStateAsync(kFALSE);
+    fSafety = xr->GetCommandQueue()->GetSafetyCount();
+    return off.get() && !Stopped() ? kSeqRunning : kSeqAborted;
+  }
+  case kSeqWait:
+    return Pause((Long64_t)in.A) ? kSeqRunning : kSeqAborted;
+  case kSeqSettle:
+  {
+    Float_t dv = in.A > 0 ? in.A : fSettleVoltage;
+    Float_t di = in.B > 0 ? in.B : fSettleCurrent;
+    Long64_t deadline = clock->Now() + (in.C > 0 ? (Long64_t)in.C : fSettleMs);
+    for (;;)
+    {
+      XRayState_t st;
+      if (!Read(st))
+        return kSeqAborted;
+      if (fabs(st.ActualVoltage - st.VoltageToSet) <= dv && fabs(st.ActualCurrent - st.CurrentToSet) <= di)
+        return kSeqRunning;
+      if (clock->Now() >= deadline)
+        return kSeqTimeout;
+      if (!Pause(fPollMs))
+        return kSeqAborted;
+    }
+  }
+  case kSeqRead:
+  {
+    XRaySeqRecord_t rec;
+    if (!Read(rec.State))
+      return kSeqAborted;
+    fMutex.Lock();
+    rec.T = clock->Now() - fStart;
+    Int_t k = fNRecords++;
+    if (fRecords.size() < kMaxRecords)
+      fRecords.push_back(rec);
+    fMutex.UnLock();
+    if (fOnRecord)
+      fOnRecord(k, rec);
+    return kSeqRunning;
+  }
+  }
+  return kSeqAborted;
+}
+//---------------------------------------------------------------------------
+void *XRaySequence::ThreadFunc(void *arg)
+{
+  ((XRaySequence *)arg)->Loop();
+  return 0;
+}
+//---------------------------------------------------------------------------
+void XRaySequence::Loop()
+{
+  // Iterations left of each loop, by the index of its instruction
+  std::vector<Int_t> left(fProg.size(), 0);
+  Int_t n = (Int_t)fProg.size();
+  Int_t pc = 0;
+  SeqState_t state = kSeqRunning;
+  while (state == kSeqRunning && pc < n)
+  {
+    fMutex.Lock();
+    fPC = pc;
+    fMutex.UnLock();
+    if (Stopped())
+    {
+      state = kSeqAborted;
+      break;
+    }
+    const XRaySeqInstr_t &in = fProg[pc];
+    if (in.Op == kSeqLoop)
+    {
+      left[pc] = (Int_t)in.A;
+      pc = left[pc] > 0 ? pc + 1 : in.Jump + 1;
+    }
+    else if (in.Op == kSeqEnd)
+      pc = --left[in.Jump] > 0 ? in.Jump + 1 : pc + 1;
+    else
+    {
+      state = Execute(in);
+      if (state == kSeqRunning)
+        pc++;
+    }
+  }
+
+  fMutex.Lock();
+  fState = state == kSeqRunning ? kSeqDone : state;
+  fPC = pc;
+  fEnd = XRClock::Get()->Now();
+  fMutex.UnLock();
+  if (debug > 0)
+    printf("XRaySequence %s at instruction %d of %d\n", GetStateName(GetState()), pc, n);
+  if (fOnDone)
+    fOnDone();
+}
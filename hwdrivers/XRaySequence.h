@@ -0,0 +1,114 @@
+#ifndef XRAYSEQUENCE_H
+#define XRAYSEQUENCE_H
+
+#include <Rtypes.h>
+#include <TMutex.h>
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+#include "XRayBackend.h"
+
+class TThread;
+class XRay;
+
+// One compiled statement of a sequence program
+typedef struct {
+  Int_t Op;          // XRaySequence::Op_t
+  Float_t A, B, C, D;
+  Int_t Jump;        // loop: index of its end; end: index of its loop
+} XRaySeqInstr_t;
+
+// A reading recorded by a program, msec after its start
+typedef struct {
+  Long64_t T;
+  XRayState_t State;
+} XRaySeqRecord_t;
+
+//===========================================
+// Sequence programs of one XRay (EXEC pipe command).
+// A program is a list of statements separated by ';', on one line: the
+// text protocol ends a request at a new line, so a program holding one is
+// refused whole rather than run in part. BATCH splits on ';' as well, so
+// an EXEC in a BATCH is refused, ERR|exec_in_batch:
+//   set <kV> <uA>                 commit both setpoints
+//   ramp <kV> <uA> [<kV/s> <uA/s>] ramp there with XRayRamp (0: XRRamp rates)
+//   power on|off
+//   wait <ms>
+//   settle [<kV> <uA> [<ms>]]     wait until the readings are within kV / uA
+//                                 of the setpoints (0: XRSettle), at most ms
+//   read                          record a fresh reading
+//   loop <n> ... end              repeat the statements n times; nests
+// It is compiled once into an instruction list and run by a background
+// thread, so its timing is that of the host of the tube, not of a client.
+// Changes go through the tube's command queue as revocable control
+// commands. Any HV off of the tube but the program's own (a kXRSafety
+// command of the queue) aborts it, also one that comes while it waits,
+// and a step behind it in the queue is skipped.
+class XRaySequence
+{
+ public:
+  enum Op_t {kSeqSet = 0, kSeqRamp, kSeqPower, kSeqWait, kSeqSettle, kSeqRead, kSeqLoop, kSeqEnd};
+  enum SeqState_t {kSeqIdle = 0, kSeqRunning, kSeqDone, kSeqAborted, kSeqTimeout};
+  enum {kMaxInstr = 1024, kMaxRecords = 10000};
+
+  // Record k (from 0) of the running program, on its thread
+  typedef std::function<void(Int_t k, const XRaySeqRecord_t &rec)> Record_t;
+  // End of the program, on its thread
+  typedef std::function<void()> Done_t;
+
+  XRaySequence(XRay *xray);
+  // Aborts a running program
+  ~XRaySequence();
+
+  // Program of source; kFALSE with the statement number and reason in
+  // error if it does not compile
+  static Bool_t Compile(const std::string &source, std::vector<XRaySeqInstr_t> &prog, std::string &error);
+  // Run prog in the background; kFALSE if a program is running
+  Bool_t Start(const std::vector<XRaySeqInstr_t> &prog, const Record_t &onRecord, const Done_t &onDone);
+  // Compile and run source to its end; kTRUE if it completed. result gets
+  // FormatSummary(kTRUE) or the compile error
+  Bool_t Run(const std::string &source, std::string *result);
+  // Stop a running program; wait: until its thread is over
+  void Abort(Bool_t wait = kTRUE);
+
+  Bool_t IsRunning();
+  SeqState_t GetState();
+  static const char *GetStateName(SeqState_t state);
+  // state|pc|ninstr|elapsed|nrecords, and with records |t,power,vset,v,iset,i,p,temp|...
+  std::string FormatSummary(Bool_t records);
+  static std::string FormatRecord(const XRaySeqRecord_t &rec);
+
+ private:
+  static void *ThreadFunc(void *arg);
+  void Loop();
+  SeqState_t Execute(const XRaySeqInstr_t &in);
+  Bool_t Commit(Float_t xVoltage, Float_t xCurrent);
+  // cmd as a revocable control command of the tube, skipped after an HV
+  // off; kFALSE if the program is to stop
+  Bool_t Submit(const std::function<void()> &cmd);
+  // Aborted, or HV off asked for since fSafety
+  Bool_t Stopped();
+  Bool_t Read(XRayState_t &st);
+  // Sleep ms in steps, kFALSE if aborted meanwhile
+  Bool_t Pause(Long64_t ms);
+  void Join();
+
+  Int_t debug;
+  XRay *fXRay;
+  TMutex fMutex;             // guards the status below
+  TThread *fThread;
+  std::atomic<bool> fAbort;
+  ULong64_t fSafety;         // safety count of the queue at the start or the program's own HV off
+  std::vector<XRaySeqInstr_t> fProg;
+  Record_t fOnRecord;
+  Done_t fOnDone;
+  SeqState_t fState;
+  Int_t fPC;                 // instruction being run
+  Long64_t fStart, fEnd;     // msec of XRClock
+  std::vector<XRaySeqRecord_t> fRecords; // the first kMaxRecords
+  Int_t fNRecords;
+  Float_t fSettleVoltage, fSettleCurrent; // default tolerances, kV, uA
+  Int_t fSettleMs, fPollMs;
+};
+#endif //XRAYSEQUENCE_H
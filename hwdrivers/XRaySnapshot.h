@@ -0,0 +1,69 @@
+#ifndef XRAYSNAPSHOT_H
+#define XRAYSNAPSHOT_H
+
+#include <atomic>
+#include <string.h>
+
+//===========================================
+// Sequence-locked copy of a small POD structure.
+// One writer (serialized by the owner, e.g. under fXRayMutex) publishes
+// new values; any number of readers take consistent copies without
+// locking and without ever blocking the writer. The payload is kept in
+// relaxed atomic words so that concurrent access is well defined.
+// Publishing the value already held is a no-op, so the sequence counts
+// changes of the value.
+template <typename T>
+class XRaySnapshot
+{
+ public:
+  XRaySnapshot() : fSeq(0)
+  {
+    for (unsigned i = 0; i < kNWords; i++)
+      fWords[i].store(0, std::memory_order_relaxed);
+  }
+
+  void Publish(const T &value)
+  {
+    unsigned int buf[kNWords];
+    memset(buf, 0, sizeof(buf));
+    memcpy(buf, &value, sizeof(T));
+    unsigned long seq = fSeq.load(std::memory_order_relaxed);
+    // The writer's own words need no sequence check
+    bool same = seq != 0;
+    for (unsigned i = 0; i < kNWords && same; i++)
+      same = fWords[i].load(std::memory_order_relaxed) == buf[i];
+    if (same)
+      return;
+    fSeq.store(seq + 1, std::memory_order_relaxed); // odd: write in progress
+    std::atomic_thread_fence(std::memory_order_release);
+    for (unsigned i = 0; i < kNWords; i++)
+      fWords[i].store(buf[i], std::memory_order_relaxed);
+    fSeq.store(seq + 2, std::memory_order_release);
+  }
+
+  T Read() const
+  {
+    unsigned int buf[kNWords];
+    unsigned long seq1, seq2;
+    do
+    {
+      seq1 = fSeq.load(std::memory_order_acquire);
+      for (unsigned i = 0; i < kNWords; i++)
+        buf[i] = fWords[i].load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      seq2 = fSeq.load(std::memory_order_relaxed);
+    } while ((seq1 & 1) || seq1 != seq2);
+    T value;
+    memcpy(&value, buf, sizeof(T));
+    return value;
+  }
+
+  // Number of completed publications that changed the value
+  unsigned long GetSequence() const { return fSeq.load(std::memory_order_acquire) >> 1; };
+
+ private:
+  enum { kNWords = (sizeof(T) + sizeof(unsigned int) - 1) / sizeof(unsigned int) };
+  std::atomic<unsigned long> fSeq;
+  std::atomic<unsigned int> fWords[kNWords];
+};
+#endif //XRAYSNAPSHOT_H
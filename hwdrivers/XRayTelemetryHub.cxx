@@ -0,0 +1,215 @@
+#include "stdafx.h"
+#include "XRayTelemetryHub.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <TThread.h>
+#include "XRay.h"
+#include "XRClock.h"
+#include "XRLog.h"
+
+static Vparams &params = *Vparams::getParams();
+
+//---------------------------------------------------------------------------
+XRayTelemetryHub::XRayTelemetryHub()
+{
+  debug = params.verbose;
+  fStop = false;
+  fTickMs = XRSUBSCRIBETICK;
+  fSampleMs = XRSUBSCRIBESAMPLE;
+  VectorParameter *p1 = params.conf->GetParameter<VectorParameter>("XRSubscribe");
+  if (p1 && p1->Vector.size() >= 2)
+  {
+    fTickMs = (Int_t)p1->Vector[0];
+    fSampleMs = (Int_t)p1->Vector[1];
+  }
+  if (fTickMs < 1)
+    fTickMs = 1;
+  fThread = new TThread("XRayTelemetryHub", ThreadFunc, (void *)this);
+  fThread->Run();
+}
+//---------------------------------------------------------------------------
+XRayTelemetryHub::~XRayTelemetryHub()
+{
+  Stop();
+}
+//---------------------------------------------------------------------------
+void XRayTelemetryHub::Stop()
+{
+  if (!fThread)
+    return;
+  fStop = true;
+  fThread->Join();
+  delete fThread;
+  fThread = 0;
+}
+//---------------------------------------------------------------------------
+void XRayTelemetryHub::Subscribe(Int_t client, XRay *xray, Int_t minIntervalMs, const Push_t &push)
+{
+  Sub_t sub;
+  sub.Tube = xray;
+  sub.MinIntervalMs = minIntervalMs > 0 ? minIntervalMs : 0;
+  sub.Push = push;
+  memset(&sub.Last, 0, sizeof(sub.Last));
+  sub.LastSeq = (unsigned long)-1; // first update right away
+  sub.LastPush = 0;
+  sub.Seq = 0;
+
+  fMutex.Lock();
+  Bool_t moved = fSubs.count(client) && fSubs[client].Tube != xray;
+  XRay *previous = moved ? fSubs[client].Tube : 0;
+  fSubs[client] = sub;
+  if (previous)
+  {
+    Bool_t used = kFALSE;
+    for (std::map<Int_t, Sub_t>::iterator it = fSubs.begin(); it != fSubs.end(); ++it)
+      used = used || it->second.Tube == previous;
+    if (!used)
+      fTubes.erase(previous);
+  }
+  if (!fTubes.count(xray))
+  {
+    Tube_t tube;
+    tube.LastSample = 0;
+    tube.Reading = std::make_shared<std::atomic<bool> >(false);
+    fTubes[xray] = tube;
+  }
+  fMutex.UnLock();
+  if (debug > 0)
+    printf("XRayTelemetryHub: client %d subscribed to %s, every %d ms at most\n", client,
+           xray->GetSerialNumber(), sub.MinIntervalMs);
+}
+//---------------------------------------------------------------------------
+Bool_t XRayTelemetryHub::Unsubscribe(Int_t client)
+{
+  fMutex.Lock();
+  std::map<Int_t, Sub_t>::iterator found = fSubs.find(client);
+  if (found == fSubs.end())
+  {
+    fMutex.UnLock();
+    return kFALSE;
+  }
+  XRay *tube = found->second.Tube;
+  fSubs.erase(found);
+  Bool_t used = kFALSE;
+  for (std::map<Int_t, Sub_t>::iterator it = fSubs.begin(); it != fSubs.end(); ++it)
+    used = used || it->second.Tube == tube;
+  if (!used)
+    fTubes.erase(tube);
+  fMutex.UnLock();
+  return kTRUE;
+}
+//---------------------------------------------------------------------------
+Int_t XRayTelemetryHub::GetCount()
+{
+  fMutex.Lock();
+  Int_t n = (Int_t)fSubs.size();
+  fMutex.UnLock();
+  return n;
+}
+//---------------------------------------------------------------------------
+UInt_t XRayTelemetryHub::Diff(const XRayState_t &a, const XRayState_t &b)
+{
+  UInt_t changed = 0;
+  if (a.Power != b.Power)
+    changed |= kFPower;
+  if (a.VoltageToSet != b.VoltageToSet)
+    changed |= kFVoltageToSet;
+  if (a.ActualVoltage != b.ActualVoltage)
+    changed |= kFActualVoltage;
+  if (a.CurrentToSet != b.CurrentToSet)
+    changed |= kFCurrentToSet;
+  if (a.ActualCurrent != b.ActualCurrent)
+    changed |= kFActualCurrent;
+  if (a.ActualPower != b.ActualPower)
+    changed |= kFActualPower;
+  if (a.Temperature != b.Temperature)
+    changed |= kFTemperature;
+  return changed;
+}
+//---------------------------------------------------------------------------
+std::string XRayTelemetryHub::FormatEvent(const XRayState_t &st, UInt_t changed, ULong64_t seq)
+{
+  // Appended a field at a time: %f of a value near FLT_MAX alone takes
+  // 47 characters
+  char buf[64];
+  snprintf(buf, sizeof(buf), "EVT|%llu", (unsigned long long)seq);
+  std::string out(buf);
+  auto add = [&out, &buf](const char *format, Float_t value) {
+    snprintf(buf, sizeof(buf), format, value);
+    out += buf;
+  };
+  if (changed & kFPower)
+    out += st.Power ? "|power=1" : "|power=0";
+  if (changed & kFVoltageToSet)
+    add("|vset=%f", st.VoltageToSet);
+  if (changed & kFActualVoltage)
+    add("|v=%f", st.ActualVoltage);
+  if (changed & kFCurrentToSet)
+    add("|iset=%f", st.CurrentToSet);
+  if (changed & kFActualCurrent)
+    add("|i=%f", st.ActualCurrent);
+  if (changed & kFActualPower)
+    add("|p=%f", st.ActualPower);
+  if (changed & kFTemperature)
+    add("|t=%f", st.Temperature);
+  return out;
+}
+//---------------------------------------------------------------------------
+void *XRayTelemetryHub::ThreadFunc(void *arg)
+{
+  ((XRayTelemetryHub *)arg)->Loop();
+  return 0;
+}
+//---------------------------------------------------------------------------
+void XRayTelemetryHub::Loop()
+{
+  XRClock *clock = XRClock::Get();
+  while (!fStop.load())
+  {
+    clock->Sleep(fTickMs);
+    Long64_t now = clock->Now();
+    fMutex.Lock();
+    Sample(now);
+    for (std::map<Int_t, Sub_t>::iterator it = fSubs.begin(); it != fSubs.end(); ++it)
+    {
+      Sub_t &sub = it->second;
+      unsigned long seq = sub.Tube->GetSnapshotSequence();
+      // Nothing published, or too early: a later tick merges the changes
+      if (seq == sub.LastSeq || (sub.Seq > 0 && now - sub.LastPush < sub.MinIntervalMs))
+        continue;
+      XRayState_t st = sub.Tube->GetXRaySnapshot();
+      UInt_t changed = sub.Seq == 0 ? (UInt_t)kFAll : Diff(sub.Last, st);
+      sub.LastSeq = seq;
+      if (!changed)
+        continue;
+      sub.Last = st;
+      sub.LastPush = now;
+      sub.Push(st, changed, ++sub.Seq);
+    }
+    fMutex.UnLock();
+  }
+}
+//---------------------------------------------------------------------------
+void XRayTelemetryHub::Sample(Long64_t now)
+{
+  for (std::map<XRay *, Tube_t>::iterator it = fTubes.begin(); it != fTubes.end(); ++it)
+  {
+    XRay *xr = it->first;
+    Tube_t &tube = it->second;
+    if (xr->IsAcquiring() || tube.Reading->load())
+      continue;
+    Int_t period = -1;
+    for (std::map<Int_t, Sub_t>::iterator s = fSubs.begin(); s != fSubs.end(); ++s)
+      if (s->second.Tube == xr && (period < 0 || s->second.MinIntervalMs < period))
+        period = s->second.MinIntervalMs;
+    if (period < fSampleMs)
+      period = fSampleMs;
+    if (now - tube.LastSample < period)
+      continue;
+    tube.LastSample = now;
+    std::shared_ptr<std::atomic<bool> > reading = tube.Reading;
+    *reading = true;
+    xr->ReadXRayDataAsync([reading](Bool_t) { *reading = false; });
+  }
+}
@@ -0,0 +1,85 @@
+#ifndef XRAYTELEMETRYHUB_H
+#define XRAYTELEMETRYHUB_H
+
+#include <Rtypes.h>
+#include <TMutex.h>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include "XRayBackend.h"
+
+class TThread;
+class XRay;
+
+//===========================================
+// Server-push telemetry of the pipe servers (SUBSCRIBE command).
+// A background thread watches the published state of every subscribed
+// tube (XRay snapshot sequence) every tick and pushes each subscriber the
+// fields that changed since its last update, at most once per its minimum
+// interval; changes that arrive meanwhile are merged into the next update.
+// The first update after subscribing carries all fields. Updates of one
+// subscription are numbered from 1, so a client can tell it missed one.
+// A subscribed tube without background acquisition is read through its
+// command queue every sampling period, or less often if all of its
+// subscribers asked for a lower rate, so trips still show up.
+class XRayTelemetryHub
+{
+ public:
+  // Fields of XRayState_t an update carries
+  enum Field_t {
+    kFPower = 1 << 0, kFVoltageToSet = 1 << 1, kFActualVoltage = 1 << 2,
+    kFCurrentToSet = 1 << 3, kFActualCurrent = 1 << 4, kFActualPower = 1 << 5,
+    kFTemperature = 1 << 6, kFAll = (1 << 7) - 1
+  };
+  // Called from the hub thread with the new state, the changed fields and
+  // the sequence number of the update
+  typedef std::function<void(const XRayState_t &st, UInt_t changed, ULong64_t seq)> Push_t;
+
+  XRayTelemetryHub();
+  // Stops the thread; tubes must outlive the hub
+  ~XRayTelemetryHub();
+
+  // (Re)subscribe client to xray; minIntervalMs <= 0 pushes every change
+  void Subscribe(Int_t client, XRay *xray, Int_t minIntervalMs, const Push_t &push);
+  // kFALSE if client was not subscribed
+  Bool_t Unsubscribe(Int_t client);
+  Int_t GetCount();
+  void Stop();
+
+  // Fields that differ between a and b
+  static UInt_t Diff(const XRayState_t &a, const XRayState_t &b);
+  // EVT|<seq>|power=<0/1>|vset=..|v=..|iset=..|i=..|p=..|t=.. with only
+  // the changed fields, as pushed to text clients
+  static std::string FormatEvent(const XRayState_t &st, UInt_t changed, ULong64_t seq);
+
+ private:
+  typedef struct {
+    XRay *Tube;
+    Int_t MinIntervalMs;
+    Push_t Push;
+    XRayState_t Last;        // state as of the last update
+    unsigned long LastSeq;   // snapshot sequence handled
+    Long64_t LastPush;       // msec of XRClock
+    ULong64_t Seq;           // updates sent
+  } Sub_t;
+  typedef struct {
+    Long64_t LastSample;
+    std::shared_ptr<std::atomic<bool> > Reading;
+  } Tube_t;
+
+  static void *ThreadFunc(void *arg);
+  void Loop();
+  void Sample(Long64_t now);
+
+  Int_t debug;
+  TMutex fMutex;                  // guards the maps
+  std::map<Int_t, Sub_t> fSubs;   // by client
+  std::map<XRay *, Tube_t> fTubes;
+  TThread *fThread;
+  std::atomic<bool> fStop;
+  Int_t fTickMs;
+  Int_t fSampleMs;
+};
+#endif //XRAYTELEMETRYHUB_H
@@ -0,0 +1,131 @@
+#include "stdafx.h"
+#include "XRayTubeModel.h"
+
+#include <math.h>
+#include <TRandom.h>
+#include "../Vparams.h"
+
+//---------------------------------------------------------------------------
+XRayTubeModel::XRayTubeModel()
+{
+  fTauHV = 0.5;
+  fTauCurrent = 0.3;
+  fTauThermal = 60;
+  fAmbient = 25;
+  fRth = 5;
+  fNoise = 0.002;
+  fReqHV = XRVDEFAULT;
+  fReqCurrent = XRCURRENTDEFAULT;
+  fHV = fCurrent = 0;
+  fTemperature = fAmbient;
+  fHVOn = kFALSE;
+  fInterlock = kTRUE;
+  fLastMs = 0;
+}
+//---------------------------------------------------------------------------
+void XRayTubeModel::ReadConfig()
+{
+  AnalysisConfig *conf = Vparams::getParams()->conf;
+  VectorParameter *tau = conf->GetParameter<VectorParameter>("XRSimTimeConstants");
+  if (tau && tau->Vector.size() >= 3)
+    SetTimeConstants(tau->Vector[0], tau->Vector[1], tau->Vector[2]);
+  VectorParameter *th = conf->GetParameter<VectorParameter>("XRSimThermal");
+  if (th && th->Vector.size() >= 2)
+    SetThermal(th->Vector[0], th->Vector[1]);
+  LevelParameter *noise = conf->GetParameter<LevelParameter>("XRSimNoise");
+  if (noise)
+    fNoise = noise->Level;
+}
+//---------------------------------------------------------------------------
+void XRayTubeModel::SetTimeConstants(Double_t tauHV, Double_t tauCurrent, Double_t tauThermal)
+{
+  fTauHV = tauHV;
+  fTauCurrent = tauCurrent;
+  fTauThermal = tauThermal;
+}
+//---------------------------------------------------------------------------
+void XRayTubeModel::SetThermal(Double_t ambientC, Double_t rthCPerW)
+{
+  if (fLastMs == 0)
+    fTemperature = ambientC;
+  fAmbient = ambientC;
+  fRth = rthCPerW;
+}
+//---------------------------------------------------------------------------
+Bool_t XRayTubeModel::SetRequest(Double_t kV, Double_t uA)
+{
+  // NaN passes both clamps; keep the last request instead
+  if (!isfinite(kV) || !isfinite(uA))
+    return kFALSE;
+  Double_t v = kV < MINXRAYVOLTAGE ? MINXRAYVOLTAGE : (kV > MAXXRAYVOLTAGE ? MAXXRAYVOLTAGE : kV);
+  Double_t i = uA < MINXRAYCURRENT ? MINXRAYCURRENT : (uA > MAXXRAYCURRENT ? MAXXRAYCURRENT : uA);
+  // kV * uA = mW
+  if (v * i > MAXXRAYPOWER)
+    i = MAXXRAYPOWER / v;
+  fReqHV = v;
+  fReqCurrent = i;
+  return v == kV && i == uA;
+}
+//---------------------------------------------------------------------------
+void XRayTubeModel::SetHVOn(Bool_t on)
+{
+  // HV cannot be switched on with an open interlock
+  fHVOn = on && fInterlock;
+}
+//---------------------------------------------------------------------------
+void XRayTubeModel::SetInterlock(Bool_t closed)
+{
+  fInterlock = closed;
+  if (!closed)
+    fHVOn = kFALSE;
+}
+//---------------------------------------------------------------------------
+void XRayTubeModel::Advance(Long64_t nowMs)
+{
+  if (fLastMs == 0 || nowMs <= fLastMs)
+  {
+    if (fLastMs == 0)
+      fLastMs = nowMs;
+    return;
+  }
+  Double_t dt = (nowMs - fLastMs) / 1000.;
+  fLastMs = nowMs;
+
+  // Exact step of the first order responses for inputs constant over dt
+  Double_t targetHV = fHVOn ? fReqHV : 0;
+  Double_t targetCurrent = fHVOn ? fReqCurrent : 0;
+  Double_t powerBefore = fHV * fCurrent;
+  fHV += (targetHV - fHV) * (1 - exp(-dt / fTauHV));
+  fCurrent += (targetCurrent - fCurrent) * (1 - exp(-dt / fTauCurrent));
+  // Thermal input: mean of the power at both ends of the step, W
+  Double_t power = 0.5 * (powerBefore + fHV * fCurrent) / 1000.;
+  Double_t targetT = fAmbient + fRth * power;
+  fTemperature += (targetT - fTemperature) * (1 - exp(-dt / fTauThermal));
+}
+//---------------------------------------------------------------------------
+Double_t XRayTubeModel::GetHV()
+{
+  return Noisy(fHV);
+}
+//---------------------------------------------------------------------------
+Double_t XRayTubeModel::GetCurrent()
+{
+  return Noisy(fCurrent);
+}
+//---------------------------------------------------------------------------
+Double_t XRayTubeModel::GetPower()
+{
+  return Noisy(fHV * fCurrent);
+}
+//---------------------------------------------------------------------------
+Double_t XRayTubeModel::GetTemperature()
+{
+  return fTemperature + (fNoise > 0 ? gRandom->Gaus(0, 0.05) : 0);
+}
+//---------------------------------------------------------------------------
+Double_t XRayTubeModel::Noisy(Double_t v)
+{
+  if (fNoise <= 0 || v == 0)
+    return v;
+  return v * (1 + gRandom->Gaus(0, fNoise));
+}
@@ -0,0 +1,55 @@
+#ifndef XRAYTUBEMODEL_H
+#define XRAYTUBEMODEL_H
+
+#include <Rtypes.h>
+
+//===========================================
+// Physics of one MiniX type X-ray tube, used by the simulators.
+// High voltage and emission current follow the requested values with
+// first order time constants once HV is on and the interlock is closed;
+// the anode temperature relaxes to ambient + Rth * power draw with its
+// own (slow) time constant. The model is integrated lazily: Advance(now)
+// steps it exactly over the time passed since the previous call.
+class XRayTubeModel
+{
+ public:
+  XRayTubeModel();
+
+  // Read XRSimTimeConstants, XRSimThermal and XRSimNoise from params.conf
+  void ReadConfig();
+  void SetTimeConstants(Double_t tauHV, Double_t tauCurrent, Double_t tauThermal); // sec
+  void SetThermal(Double_t ambientC, Double_t rthCPerW);
+  void SetNoise(Double_t relNoise) {fNoise = relNoise;};
+
+  // Requested setpoints are clamped to the tube limits (Vparams.h) and to
+  // the maximum anode power; returns kFALSE if the request was corrected,
+  // or ignored as not finite
+  Bool_t SetRequest(Double_t kV, Double_t uA);
+  void SetHVOn(Bool_t on);
+  void SetInterlock(Bool_t closed);
+  void Advance(Long64_t nowMs);
+
+  Double_t GetRequestedHV() {return fReqHV;};
+  Double_t GetRequestedCurrent() {return fReqCurrent;};
+  Bool_t IsHVOn() {return fHVOn;};
+  Bool_t IsInterlockClosed() {return fInterlock;};
+  // Monitored values with measurement noise
+  Double_t GetHV();          // kV
+  Double_t GetCurrent();     // uA
+  Double_t GetPower();       // mW
+  Double_t GetTemperature(); // C
+
+ private:
+  Double_t Noisy(Double_t v);
+
+  Double_t fTauHV, fTauCurrent, fTauThermal; // sec
+  Double_t fAmbient;  // C
+  Double_t fRth;      // C/W
+  Double_t fNoise;    // relative rms of monitored values
+  Double_t fReqHV, fReqCurrent;
+  Double_t fHV, fCurrent, fTemperature;
+  Bool_t fHVOn;
+  Bool_t fInterlock;  // kTRUE = closed
+  Long64_t fLastMs;   // time of the last Advance, 0 before the first one
+};
+#endif //XRAYTUBEMODEL_H
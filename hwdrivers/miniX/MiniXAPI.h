@@ -5,7 +5,9 @@
 #if _MSC_VER > 1000
 #pragma once
 #endif // _MSC_VER > 1000
+#ifdef _WIN32
 #include "windows.h"
+#endif
 
 //#define WINAPI __stdcall
 typedef const char* CString; 
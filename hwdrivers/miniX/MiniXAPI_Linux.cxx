@@ -0,0 +1,25 @@
+#ifndef _WIN32
+#include "MiniXAPI_Linux.h"
+#include "../MiniXSimulator.h"
+
+// MiniX DLL API served by the simulated controller (see MiniXSimulator.h)
+
+void WINAPI OpenMiniX() {MiniXSimulator::Instance()->Open();}
+byte WINAPI isMiniXDlg() {return MiniXSimulator::Instance()->IsOpen();}
+void WINAPI CloseMiniX() {MiniXSimulator::Instance()->Close();}
+void WINAPI SendMiniXCommand(byte MiniXCommand) {MiniXSimulator::Instance()->SendCommand(MiniXCommand);}
+void WINAPI ReadMiniXMonitor(MiniX_Monitor *MiniXMonitor) {MiniXSimulator::Instance()->ReadMonitor(MiniXMonitor);}
+void WINAPI SetMiniXHV(double HighVoltage_kV) {MiniXSimulator::Instance()->SetHV(HighVoltage_kV);}
+void WINAPI SetMiniXCurrent(double Current_uA) {MiniXSimulator::Instance()->SetCurrent(Current_uA);}
+void WINAPI ReadMiniXSettings(MiniX_Settings *MiniXSettings) {MiniXSimulator::Instance()->ReadSettings(MiniXSettings);}
+long WINAPI ReadMiniXSerialNumber() {return MiniXSimulator::Instance()->ReadSerialNumber();}
+void WINAPI ClearDeviceList() {MiniXSimulator::Instance()->ClearDeviceList();}
+void WINAPI GetDeviceList() {MiniXSimulator::Instance()->EnumerateDevices();}
+long WINAPI GetDeviceCount() {return MiniXSimulator::Instance()->GetDeviceCount();}
+long WINAPI GetDeviceSerialNumberByIndex(long lDeviceIndex, char *strSerialNumber)
+{
+  return MiniXSimulator::Instance()->GetDeviceSerialNumberByIndex(lDeviceIndex, strSerialNumber);
+}
+void WINAPI SetDevice(long lDeviceIndex) {MiniXSimulator::Instance()->SetDevice(lDeviceIndex);}
+long WINAPI ReadMinixOemMxDeviceType() {return 0;}
+#endif // _WIN32
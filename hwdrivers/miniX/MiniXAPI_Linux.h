@@ -0,0 +1,12 @@
+#ifndef MINIXAPI_LINUX_H
+#define MINIXAPI_LINUX_H
+
+// The MiniX DLL exists only for Windows. On Linux the same API is
+// provided by MiniXAPI_Linux.cxx on top of MiniXSimulator, so that the
+// drivers build unchanged and run against a simulated controller.
+#ifndef WINAPI
+#define WINAPI
+#endif
+#include "MiniXAPI.h"
+
+#endif // MINIXAPI_LINUX_H
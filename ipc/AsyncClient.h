@@ -0,0 +1,206 @@
+#pragma once
+#include <string>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <cstdlib>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include "ipc/Transport.h"
+#include "ipc/XRayProtocol.h"
+
+// Asynchronous use of a connected ClientTransport: any number of requests
+// in flight from any thread, each reply handed to its callback or future
+// as it arrives, and pushed messages (SUBSCRIBE, EXEC|...|STREAM) to the
+// push handler, all by one receive thread. Text requests go tagged
+// @<id>|, so the service may complete them in any order (RequestPipeline);
+// on a binary connection (setBinary after INIT negotiated it) they travel
+// as XRayOpText frames and binary requests get their header id set.
+// Callbacks and the push handler run on the receive thread: they must
+// not wait for another reply of this client. While started, the
+// transport's own call methods must not be used.
+class AsyncClient {
+public:
+    // ok false (and reply empty) if the connection was lost or stopped
+    // before the reply came
+    typedef std::function<void(bool ok, const std::string& reply)> Callback;
+    // The receive thread checks for stop() this often, msec; a named pipe
+    // is only read once data is there, so writes never wait behind a read
+    enum { kPollMs = 50 };
+
+    explicit AsyncClient(ClientTransport& transport)
+        : m_transport(transport), m_running(false), m_stop(false), m_nextId(1) {}
+    ~AsyncClient() { stop(); }
+
+    void setPushHandler(const ClientTransport::PushHandler& handler) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_onPush = handler;
+    }
+
+    // Start the receive thread; false if the transport is not connected
+    bool start() {
+        if (m_running.load()) return true;
+        if (!m_transport.isConnected()) return false;
+        if (m_thread.joinable()) m_thread.join();
+        m_stop = false;
+        m_running = true;
+        m_thread = std::thread([this]() { receive(); });
+        return true;
+    }
+
+    // Join the receive thread and fail the requests still waiting; the
+    // transport stays connected for synchronous use
+    void stop() {
+        m_stop = true;
+        if (m_thread.joinable()) m_thread.join();
+    }
+
+    bool isRunning() const { return m_running.load(); }
+
+    // Text request line, reply line to done; false (done not called) if
+    // it could not be sent
+    bool callAsync(const std::string& request, const Callback& done) {
+        std::string line = request;
+        while (!line.empty() && (line.back() == '\n' || line.back() == '\r')) line.pop_back();
+        std::lock_guard<std::mutex> lock(m_writeMutex);
+        uint32_t id = add(done, true);
+        if (!id) return false;
+        std::string out;
+        if (m_transport.m_binary)
+            Frame::append(out, XRayEncode(XRayOpText, 0, id, line.data(), line.size()));
+        else
+            out = "@" + std::to_string((unsigned long)id) + "|" + line + "\n";
+        return write(id, out);
+    }
+
+    // Binary request (XRayEncode payload; its id is replaced), the whole
+    // reply payload to done
+    bool callFrameAsync(const std::string& request, const Callback& done) {
+        if (!m_transport.m_binary || request.size() < sizeof(XRayMsgHeader)) return false;
+        std::lock_guard<std::mutex> lock(m_writeMutex);
+        uint32_t id = add(done, false);
+        if (!id) return false;
+        std::string payload = request;
+        memcpy(&payload[offsetof(XRayMsgHeader, id)], &id, sizeof(id));
+        std::string out;
+        Frame::append(out, payload);
+        return write(id, out);
+    }
+
+    // The same with a future: an empty string if there was no reply
+    std::future<std::string> call(const std::string& request) {
+        return toFuture([this, &request](const Callback& done) { return callAsync(request, done); });
+    }
+    std::future<std::string> callFrame(const std::string& request) {
+        return toFuture([this, &request](const Callback& done) { return callFrameAsync(request, done); });
+    }
+
+private:
+    struct Pending {
+        Callback done;
+        bool text;     // reply is the text of an XRayOpText frame
+    };
+
+    std::future<std::string> toFuture(const std::function<bool(const Callback&)>& send) {
+        std::shared_ptr<std::promise<std::string> > p = std::make_shared<std::promise<std::string> >();
+        std::future<std::string> f = p->get_future();
+        if (!send([p](bool, const std::string& reply) { p->set_value(reply); })) p->set_value(std::string());
+        return f;
+    }
+
+    // Id of a new pending request, 0 if not running
+    uint32_t add(const Callback& done, bool text) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running.load()) return 0;
+        uint32_t id = m_nextId++;
+        if (m_nextId == 0) m_nextId = 1;
+        Pending& p = m_pending[id];
+        p.done = done;
+        p.text = text;
+        return id;
+    }
+
+    // A failed write leaves the connection to the receive thread, which
+    // sees it broken and fails everything pending. If it already took this
+    // request, it calls done: that is not a failure to send here
+    bool write(uint32_t id, const std::string& out) {
+        if (m_transport.writeAll(out)) return true;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_pending.erase(id) == 0;
+    }
+
+    void receive() {
+        bool binary = m_transport.m_binary;
+        std::string msg;
+        bool lost = false;
+        while (!m_stop.load() && !lost) {
+            bool bad = false;
+            while (!m_stop.load() && m_transport.take(binary, msg, bad)) deliver(binary, msg);
+            lost = bad || (!m_stop.load() && !m_transport.readSome(kPollMs));
+        }
+        std::map<uint32_t, Pending> left;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_running = false;
+            left.swap(m_pending);
+        }
+        if (lost) {
+            // No request starts now; wait out one being written
+            std::lock_guard<std::mutex> lock(m_writeMutex);
+            m_transport.disconnect();
+        }
+        for (std::map<uint32_t, Pending>::iterator it = left.begin(); it != left.end(); ++it)
+            if (it->second.done) it->second.done(false, std::string());
+    }
+
+    void deliver(bool binary, std::string& msg) {
+        if (ClientTransport::isPush(binary, msg)) {
+            ClientTransport::PushHandler onPush;
+            { std::lock_guard<std::mutex> lock(m_mutex); onPush = m_onPush; }
+            if (onPush) onPush(msg);
+            return;
+        }
+        uint32_t id = 0;
+        bool oldest = false;
+        if (binary) {
+            XRayMsgHeader h;
+            const char* body;
+            size_t size;
+            if (!XRayDecode(msg, h, body, size)) return;
+            id = h.id;
+        } else {
+            size_t bar = msg.find('|');
+            if (msg.size() > 1 && msg[0] == '@' && bar != std::string::npos) {
+                id = (uint32_t)std::strtoul(msg.c_str() + 1, 0, 10);
+                msg.erase(0, bar + 1);
+            } else {
+                oldest = true;  // untagged (a service without tags)
+            }
+        }
+        Pending p;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            std::map<uint32_t, Pending>::iterator it = oldest ? m_pending.begin() : m_pending.find(id);
+            if (it == m_pending.end()) return;  // not one of ours
+            p = it->second;
+            m_pending.erase(it);
+        }
+        if (binary && p.text) msg.erase(0, sizeof(XRayMsgHeader));
+        if (p.done) p.done(true, msg);
+    }
+
+    ClientTransport& m_transport;
+    std::thread m_thread;
+    std::atomic<bool> m_running;
+    std::atomic<bool> m_stop;
+    std::mutex m_mutex;       // m_pending, m_nextId, m_onPush
+    std::mutex m_writeMutex;  // requests go out whole, in id order
+    std::map<uint32_t, Pending> m_pending;
+    uint32_t m_nextId;
+    ClientTransport::PushHandler m_onPush;
+};
@@ -0,0 +1,109 @@
+#pragma once
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <string>
+
+// FNV-1a of a command name, usable as a case label: a switch over the
+// names of a command set is its perfect hash table, checked by the
+// compiler (two names with one hash are duplicate case values).
+constexpr uint32_t CommandHash(const char* s, size_t n) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; i++) h = (h ^ (unsigned char)s[i]) * 16777619u;
+    return h;
+}
+
+constexpr size_t CommandLength(const char* s) {
+    size_t n = 0;
+    while (s[n]) n++;
+    return n;
+}
+
+constexpr uint32_t CommandHash(const char* s) {
+    return CommandHash(s, CommandLength(s));
+}
+
+// One field of a command line, pointing into the line (no copy); valid
+// while the line is.
+struct CommandToken {
+    const char* p;
+    size_t n;
+
+    CommandToken() : p(""), n(0) {}
+    CommandToken(const char* s, size_t len) : p(s), n(len) {}
+
+    bool empty() const { return n == 0; }
+    bool is(const char* s) const { return strlen(s) == n && memcmp(p, s, n) == 0; }
+    uint32_t hash() const { return CommandHash(p, n); }
+    std::string str() const { return std::string(p, n); }
+
+    // Leading number of the field, as atof/atoi would read it, or def if
+    // the field is empty. Lines end in '\0' or a delimiter, which stops
+    // the conversion, so the field is never copied.
+    double number(double def = 0) const {
+        if (n == 0) return def;
+        char* end;
+        double v = strtod(p, &end);
+        return end > p + n ? def : v;
+    }
+    long integer(long def = 0) const {
+        if (n == 0) return def;
+        char* end;
+        long v = strtol(p, &end, 10);
+        return end > p + n ? def : v;
+    }
+    unsigned long long uinteger(unsigned long long def = 0) const {
+        if (n == 0) return def;
+        char* end;
+        unsigned long long v = strtoull(p, &end, 10);
+        return end > p + n ? def : v;
+    }
+    // The whole field is one finite number ("40", not "40x" or "nan"),
+    // as a setpoint must be
+    bool numeric() const {
+        if (n == 0) return false;
+        char* end;
+        double v = strtod(p, &end);
+        return end == p + n && isfinite(v);
+    }
+};
+
+// A request or reply line split at a delimiter without allocating: the
+// fields are CommandTokens over the line, up to kMaxTokens of them (the
+// last one then holds the rest of the line, and complete() is false).
+class CommandLine {
+public:
+    enum { kMaxTokens = 64 };
+
+    CommandLine() : m_count(0), m_complete(true) {}
+    CommandLine(const std::string& line, char delim = '|') { split(line.c_str(), line.size(), delim); }
+
+    void split(const char* s, size_t n, char delim = '|') {
+        m_count = 0;
+        m_complete = true;
+        size_t start = 0;
+        for (;;) {
+            const char* d = (const char*)memchr(s + start, delim, n - start);
+            if (d && m_count + 1 == kMaxTokens) { d = 0; m_complete = false; }
+            size_t end = d ? (size_t)(d - s) : n;
+            m_tok[m_count++] = CommandToken(s + start, end - start);
+            if (!d) break;
+            start = end + 1;
+        }
+    }
+
+    size_t size() const { return m_count; }
+    bool complete() const { return m_complete; }
+    // Empty token past the end, so optional fields need no size check
+    const CommandToken& operator[](size_t i) const {
+        static const CommandToken none;
+        return i < m_count ? m_tok[i] : none;
+    }
+
+private:
+    CommandToken m_tok[kMaxTokens];
+    size_t m_count;
+    bool m_complete;
+};
@@ -0,0 +1,645 @@
+#pragma once
+#include <string>
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+#include <deque>
+#include <map>
+#include <functional>
+#include <mutex>
+#include <atomic>
+#include <utility>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+#include "ipc/Transport.h"
+
+// Event-driven server for many simultaneous clients of the XRay service.
+// One thread (run) multiplexes every connection: overlapped named pipe
+// instances on Windows, an epoll loop over a Unix-domain or loopback TCP
+// socket on Linux (see TransportAddress; a pipe name \\.\pipe\<name>
+// listens on the Unix-domain socket /tmp/<name>.sock). Requests are
+// '\n' terminated lines. Each one is handed to the request handler with
+// a reply function that may be called at once or later from any thread,
+// e.g. when a queued tube command completes, so a slow command of one
+// client never stalls the others. After setBinary a connection carries
+// length-prefixed frames (Frame in ipc/Transport.h) both ways instead.
+// Replies of any size are queued as handed in and written out piece by
+// piece, a long frame as its chunks, without being copied into one buffer.
+class MultiPipeServer {
+public:
+    typedef std::function<void(const std::string&)> Reply;
+    typedef std::function<void(int client, const std::string& line, const Reply& reply)> RequestHandler;
+    typedef std::function<void(int client, bool connected)> SessionHandler;
+
+    explicit MultiPipeServer(const std::string& address, int maxClients = 8)
+        : m_addr(TransportAddress::parse(address)),
+          m_maxClients(maxClients < 1 ? 1 : maxClients), m_nextId(1), m_clients(0), m_stop(false) {
+#ifdef _WIN32
+        // Two events per instance plus the wake-up event
+        if (m_maxClients > (MAXIMUM_WAIT_OBJECTS - 1) / 2) m_maxClients = (MAXIMUM_WAIT_OBJECTS - 1) / 2;
+        m_wake = NULL;
+#else
+        m_listenFd = m_epollFd = m_wakeFd = -1;
+#endif
+    }
+    ~MultiPipeServer() { close(); }
+
+    std::string name() const {
+#ifndef _WIN32
+        if (m_addr.kind == TransportAddress::Pipe) return "unix:" + m_addr.socketPath();
+#endif
+        return m_addr.str();
+    }
+    int clientCount() const { return m_clients.load(); }
+
+    // Queue a reply line for client; any thread. Dropped if it is gone
+    void send(int client, const std::string& line) {
+        std::string copy;
+        copy.reserve(line.size() + 1);
+        copy = line;
+        send(client, std::move(copy));
+    }
+    void send(int client, std::string&& line) {
+        if (line.empty() || line.back() != '\n') line.push_back('\n');
+        post(client, std::move(line), false, false);
+    }
+    // Queue a reply frame for a binary client; any thread
+    void sendFrame(int client, const std::string& payload) { post(client, std::string(payload), true, false); }
+    void sendFrame(int client, std::string&& payload) { post(client, std::move(payload), true, false); }
+    // Close client once its queued replies are written; any thread
+    void disconnect(int client) { post(client, std::string(), false, true); }
+    // Run task on the event loop thread, after what is queued; any thread
+    void defer(const std::function<void()>& task) {
+        Posted p;
+        p.client = 0;
+        p.framed = false;
+        p.close = false;
+        p.task = task;
+        { std::lock_guard<std::mutex> lock(m_postMutex); m_posted.push_back(p); }
+        wake();
+    }
+    // Make run() return; any thread
+    void stop() { m_stop = true; wake(); }
+
+private:
+    enum { kReadSize = 64 * 1024 };
+
+    // A queued reply: the line or payload as posted, written as pieces,
+    // a frame as the header of each chunk followed by the chunk
+    struct Outgoing {
+        std::string data;
+        bool framed;
+        size_t pos;       // of data written
+        size_t chunkEnd;  // end of the chunk being written
+        char head[Frame::kHeaderSize];
+        size_t headLeft;  // header bytes still to write before data[pos]
+
+        Outgoing(std::string&& payload, bool isFrame)
+            : data(std::move(payload)), framed(isFrame), pos(0), chunkEnd(data.size()), headLeft(0) {
+            if (framed) nextChunk();
+        }
+
+        bool done() const { return headLeft == 0 && pos == data.size(); }
+        // Next bytes to write, n of them
+        const char* piece(size_t& n) const {
+            if (headLeft) { n = headLeft; return head + Frame::kHeaderSize - headLeft; }
+            n = chunkEnd - pos;
+            return data.data() + pos;
+        }
+        // n bytes of piece() written
+        void advance(size_t n) {
+            if (headLeft) { headLeft -= n; return; }
+            pos += n;
+            if (framed && pos == chunkEnd && pos < data.size()) nextChunk();
+        }
+#ifndef _WIN32
+        // The header and chunk left to write as up to two iovecs; false if
+        // more chunks follow, so nothing after this reply may be gathered
+        bool pieces(iovec* iov, int max, int& n) const {
+            if (headLeft && n < max) {
+                iov[n].iov_base = (void*)(head + Frame::kHeaderSize - headLeft);
+                iov[n++].iov_len = headLeft;
+            }
+            if (chunkEnd > pos && n < max) {
+                iov[n].iov_base = (void*)(data.data() + pos);
+                iov[n++].iov_len = chunkEnd - pos;
+            }
+            return chunkEnd == data.size() && n < max;
+        }
+#endif
+
+    private:
+        void nextChunk() {
+            uint32_t h = Frame::chunk(data.size(), pos);
+            Frame::header(head, h);
+            headLeft = Frame::kHeaderSize;
+            chunkEnd = pos + (h & ~Frame::kMore);
+        }
+    };
+
+public:
+
+#ifdef _WIN32
+    bool listen() {
+        // Named pipes only; the socket transports are served on Linux
+        if (m_addr.kind != TransportAddress::Pipe) return false;
+        m_wake = CreateEventA(NULL, FALSE, FALSE, NULL);
+        if (!m_wake) return false;
+        for (int i = 0; i < m_maxClients; i++) {
+            Instance* in = new Instance();
+            in->pipe = CreateNamedPipeA(m_addr.path.c_str(),
+                PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED,
+                PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT,
+                m_maxClients,  // max instances
+                kReadSize, kReadSize,  // out/in buffer sizes
+                0,             // default timeout
+                NULL);
+            in->rd.hEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+            in->wr.hEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+            m_inst.push_back(in);
+            if (in->pipe == INVALID_HANDLE_VALUE || !in->rd.hEvent || !in->wr.hEvent) return false;
+            waitClient(in);
+        }
+        return true;
+    }
+
+    void run(const RequestHandler& onRequest, const SessionHandler& onSession = SessionHandler()) {
+        HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+        DWORD n = 0;
+        handles[n++] = m_wake;
+        for (size_t i = 0; i < m_inst.size(); i++) {
+            handles[n++] = m_inst[i]->rd.hEvent;
+            handles[n++] = m_inst[i]->wr.hEvent;
+        }
+        while (!m_stop) {
+            DWORD w = WaitForMultipleObjects(n, handles, FALSE, INFINITE);
+            if (w == WAIT_FAILED) break;
+            DWORD idx = w - WAIT_OBJECT_0;
+            if (idx == 0) { deliverPosted(); continue; }
+            Instance* in = m_inst[(idx - 1) / 2];
+            if ((idx - 1) % 2 == 0) onRead(in, onRequest, onSession);
+            else onWritten(in, onSession);
+        }
+        // Write what was answered up to stop(), e.g. the reply to SHUTDOWN
+        deliverPosted();
+        for (size_t i = 0; i < m_inst.size(); i++) {
+            Instance* in = m_inst[i];
+            while (in->writing) {
+                DWORD n = 0;
+                BOOL ok = GetOverlappedResult(in->pipe, &in->wr, &n, TRUE);
+                in->writing = false;
+                if (ok) { written(in, n); startWrite(in); }
+            }
+        }
+    }
+
+    void close() {
+        for (size_t i = 0; i < m_inst.size(); i++) {
+            Instance* in = m_inst[i];
+            if (in->pipe != INVALID_HANDLE_VALUE) {
+                CancelIo(in->pipe);
+                DisconnectNamedPipe(in->pipe);
+                CloseHandle(in->pipe);
+            }
+            if (in->rd.hEvent) CloseHandle(in->rd.hEvent);
+            if (in->wr.hEvent) CloseHandle(in->wr.hEvent);
+            delete in;
+        }
+        m_inst.clear();
+        if (m_wake) { CloseHandle(m_wake); m_wake = NULL; }
+    }
+
+    // Switch client to frames for the requests after the current one;
+    // from the request handler (event loop thread)
+    void setBinary(int client, bool binary = true) {
+        for (size_t i = 0; i < m_inst.size(); i++)
+            if (m_inst[i]->id == client) m_inst[i]->binary = binary;
+    }
+    bool isBinary(int client) const {
+        for (size_t i = 0; i < m_inst.size(); i++)
+            if (m_inst[i]->id == client) return m_inst[i]->binary;
+        return false;
+    }
+
+private:
+    struct Instance {
+        HANDLE pipe;
+        OVERLAPPED rd, wr;        // read (and connect) / write operations
+        bool connecting, connected, reading, writing, closing, binary;
+        int id;                   // client id, 0 while no client
+        char buf[kReadSize];
+        std::string in;
+        std::deque<Outgoing> out; // front() is being written
+        Instance() : pipe(INVALID_HANDLE_VALUE), connecting(false), connected(false), reading(false),
+                     writing(false), closing(false), binary(false), id(0) {
+            memset(&rd, 0, sizeof(rd));
+            memset(&wr, 0, sizeof(wr));
+        }
+    };
+
+    void wake() { if (m_wake) SetEvent(m_wake); }
+
+    // Let the next client connect to this instance
+    void waitClient(Instance* in) {
+        in->id = 0;
+        in->in.clear();
+        in->out.clear();
+        in->closing = false;
+        in->binary = false;
+        ResetEvent(in->rd.hEvent);
+        BOOL done = ConnectNamedPipe(in->pipe, &in->rd);
+        DWORD err = done ? 0 : GetLastError();
+        // A client that connected in between completes at once
+        in->connected = done || err == ERROR_PIPE_CONNECTED;
+        in->connecting = in->connected || err == ERROR_IO_PENDING;
+        if (in->connected) SetEvent(in->rd.hEvent);
+    }
+
+    void startRead(Instance* in) {
+        in->reading = true;
+        if (!ReadFile(in->pipe, in->buf, sizeof(in->buf), NULL, &in->rd)) {
+            DWORD err = GetLastError();
+            if (err != ERROR_IO_PENDING && err != ERROR_MORE_DATA) { in->reading = false; SetEvent(in->rd.hEvent); }
+        }
+    }
+
+    // Write the next piece of the front reply; its buffer stays in place
+    // until the write completes (deque elements do not move on push_back)
+    void startWrite(Instance* in) {
+        if (in->writing || in->out.empty()) return;
+        size_t n = 0;
+        const char* piece = in->out.front().piece(n);
+        in->writing = true;
+        if (!WriteFile(in->pipe, piece, (DWORD)n, NULL, &in->wr) &&
+            GetLastError() != ERROR_IO_PENDING) {
+            in->writing = false;
+            in->out.clear();
+            in->closing = true;
+            SetEvent(in->rd.hEvent); // the read side notices the broken pipe
+        }
+    }
+
+    void written(Instance* in, DWORD n) {
+        if (in->out.empty()) return;
+        in->out.front().advance(n);
+        if (in->out.front().done()) in->out.pop_front();
+    }
+
+    void onRead(Instance* in, const RequestHandler& onRequest, const SessionHandler& onSession) {
+        DWORD n = 0;
+        BOOL ok = GetOverlappedResult(in->pipe, &in->rd, &n, FALSE);
+        DWORD err = ok ? 0 : GetLastError();
+        ResetEvent(in->rd.hEvent);
+        if (in->connecting) {
+            in->connecting = false;
+            if (!ok && !in->connected) { DisconnectNamedPipe(in->pipe); waitClient(in); return; }
+            in->id = m_nextId++;
+            m_clients++;
+            if (onSession) onSession(in->id, true);
+            startRead(in);
+            return;
+        }
+        if (!in->reading || (!ok && err != ERROR_MORE_DATA)) { drop(in, onSession); return; }
+        in->reading = false;
+        in->in.append(in->buf, n);
+        if (ok) {
+            // Whole message received: the requests in it, a last line
+            // without '\n' included
+            int id = in->id;
+            std::string msg;
+            size_t pos = 0;
+            bool bad = false;
+            for (;;) {
+                bool binary = in->binary;
+                if (!nextRequest(in->in, pos, binary, msg, bad)) {
+                    if (bad || binary || pos == in->in.size()) break;
+                    msg.assign(in->in, pos, std::string::npos);
+                    pos = in->in.size();
+                    while (!msg.empty() && msg.back() == '\r') msg.pop_back();
+                }
+                onRequest(id, msg, replyTo(id, binary));
+            }
+            if (bad) { drop(in, onSession); return; }
+            in->in.erase(0, pos);
+        }
+        if (in->id) startRead(in);
+    }
+
+    void onWritten(Instance* in, const SessionHandler& onSession) {
+        DWORD n = 0;
+        BOOL ok = GetOverlappedResult(in->pipe, &in->wr, &n, FALSE);
+        ResetEvent(in->wr.hEvent);
+        in->writing = false;
+        if (!ok) { drop(in, onSession); return; }
+        written(in, n);
+        if (in->out.empty() && in->closing) { drop(in, onSession); return; }
+        startWrite(in);
+    }
+
+    void drop(Instance* in, const SessionHandler& onSession) {
+        if (in->id == 0) return;
+        int id = in->id;
+        CancelIo(in->pipe);
+        DWORD n = 0;
+        if (in->reading) GetOverlappedResult(in->pipe, &in->rd, &n, TRUE);
+        if (in->writing) GetOverlappedResult(in->pipe, &in->wr, &n, TRUE);
+        in->reading = in->writing = false;
+        ResetEvent(in->wr.hEvent);
+        DisconnectNamedPipe(in->pipe);
+        m_clients--;
+        if (onSession) onSession(id, false);
+        waitClient(in);
+    }
+
+    void deliverPosted() {
+        std::deque<Posted> posted;
+        { std::lock_guard<std::mutex> lock(m_postMutex); posted.swap(m_posted); }
+        for (size_t p = 0; p < posted.size(); p++) {
+            if (posted[p].task) { posted[p].task(); continue; }
+            for (size_t i = 0; i < m_inst.size(); i++) {
+                Instance* in = m_inst[i];
+                if (in->id != posted[p].client) continue;
+                if (posted[p].close) {
+                    in->closing = true;
+                    if (!in->writing && in->out.empty()) { CancelIo(in->pipe); SetEvent(in->rd.hEvent); }
+                } else {
+                    in->out.emplace_back(std::move(posted[p].data), posted[p].framed);
+                    startWrite(in);
+                }
+            }
+        }
+    }
+
+    std::vector<Instance*> m_inst;
+    HANDLE m_wake;
+#else
+    bool listen() {
+        if (!m_addr.valid()) return false;
+        if (m_addr.kind == TransportAddress::Tcp) {
+            sockaddr_in addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons((unsigned short)m_addr.port);
+            if (inet_pton(AF_INET, m_addr.host.c_str(), &addr.sin_addr) != 1) return false;
+            m_listenFd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (m_listenFd < 0) return false;
+            int one = 1;
+            setsockopt(m_listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            if (::bind(m_listenFd, (sockaddr*)&addr, sizeof(addr)) < 0) return false;
+        } else {
+            std::string path = m_addr.socketPath();
+            m_listenFd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (m_listenFd < 0) return false;
+            sockaddr_un addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sun_family = AF_UNIX;
+            strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+            ::unlink(path.c_str());
+            if (::bind(m_listenFd, (sockaddr*)&addr, sizeof(addr)) < 0) return false;
+            m_socketPath = path;
+        }
+        if (::listen(m_listenFd, m_maxClients) < 0) return false;
+        m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+        m_wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (m_epollFd < 0 || m_wakeFd < 0) return false;
+        return watch(m_listenFd, kListenTag, EPOLLIN) && watch(m_wakeFd, kWakeTag, EPOLLIN);
+    }
+
+    void run(const RequestHandler& onRequest, const SessionHandler& onSession = SessionHandler()) {
+        epoll_event ev[32];
+        while (!m_stop) {
+            int n = epoll_wait(m_epollFd, ev, 32, -1);
+            if (n < 0) { if (errno == EINTR) continue; break; }
+            for (int k = 0; k < n && !m_stop; k++) {
+                int tag = (int)ev[k].data.u64;
+                if (tag == kListenTag) acceptClients(onSession);
+                else if (tag == kWakeTag) deliverPosted(onSession);
+                else {
+                    std::map<int, Conn*>::iterator it = m_conns.find(tag);
+                    if (it == m_conns.end()) continue;
+                    Conn* c = it->second;
+                    if (ev[k].events & (EPOLLIN | EPOLLHUP | EPOLLERR | EPOLLRDHUP)) onReadable(c, onRequest, onSession);
+                    if (m_conns.count(tag) && (ev[k].events & EPOLLOUT)) flush(c, onSession);
+                }
+            }
+        }
+        // Write what was answered up to stop(), e.g. the reply to SHUTDOWN
+        deliverPosted(onSession);
+    }
+
+    void close() {
+        for (std::map<int, Conn*>::iterator it = m_conns.begin(); it != m_conns.end(); ++it) {
+            ::close(it->second->fd);
+            delete it->second;
+        }
+        m_conns.clear();
+        if (m_listenFd >= 0) { ::close(m_listenFd); m_listenFd = -1; }
+        if (!m_socketPath.empty()) { ::unlink(m_socketPath.c_str()); m_socketPath.clear(); }
+        if (m_epollFd >= 0) { ::close(m_epollFd); m_epollFd = -1; }
+        if (m_wakeFd >= 0) { ::close(m_wakeFd); m_wakeFd = -1; }
+    }
+
+    // Switch client to frames for the requests after the current one;
+    // from the request handler (event loop thread)
+    void setBinary(int client, bool binary = true) {
+        std::map<int, Conn*>::iterator it = m_conns.find(client);
+        if (it != m_conns.end()) it->second->binary = binary;
+    }
+    bool isBinary(int client) const {
+        std::map<int, Conn*>::const_iterator it = m_conns.find(client);
+        return it != m_conns.end() && it->second->binary;
+    }
+
+private:
+    enum { kListenTag = -1, kWakeTag = -2, kMaxPieces = 64 };
+    struct Conn {
+        int fd, id;
+        bool closing, binary;
+        std::string in;
+        std::deque<Outgoing> out;
+    };
+
+    void wake() {
+        if (m_wakeFd < 0) return;
+        uint64_t one = 1;
+        ssize_t r = ::write(m_wakeFd, &one, sizeof(one));
+        (void)r;
+    }
+
+    bool watch(int fd, int tag, uint32_t events, int op = EPOLL_CTL_ADD) {
+        epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = events;
+        ev.data.u64 = (uint64_t)(int64_t)tag;
+        return epoll_ctl(m_epollFd, op, fd, &ev) == 0;
+    }
+
+    void acceptClients(const SessionHandler& onSession) {
+        for (;;) {
+            int fd = accept4(m_listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) return;
+            if ((int)m_conns.size() >= m_maxClients) { ::close(fd); continue; }
+            if (m_addr.kind == TransportAddress::Tcp) {
+                // Replies are short lines: do not hold them back for coalescing
+                int one = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            }
+            Conn* c = new Conn();
+            c->fd = fd;
+            c->id = m_nextId++;
+            c->closing = false;
+            c->binary = false;
+            m_conns[c->id] = c;
+            watch(fd, c->id, EPOLLIN | EPOLLRDHUP);
+            m_clients++;
+            if (onSession) onSession(c->id, true);
+        }
+    }
+
+    void onReadable(Conn* c, const RequestHandler& onRequest, const SessionHandler& onSession) {
+        char buf[kReadSize];
+        bool eof = false;
+        for (;;) {
+            ssize_t r = ::read(c->fd, buf, sizeof(buf));
+            if (r > 0) { c->in.append(buf, (size_t)r); continue; }
+            if (r == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) eof = true;
+            if (r < 0 && errno == EINTR) continue;
+            break;
+        }
+        int id = c->id;
+        std::string msg;
+        size_t pos = 0;
+        bool bad = false;
+        while (nextRequest(c->in, pos, c->binary, msg, bad)) {
+            onRequest(id, msg, replyTo(id, c->binary));
+            if (!m_conns.count(id)) return;
+        }
+        c->in.erase(0, pos);
+        if (eof || bad) drop(c, onSession);
+    }
+
+    // Write the queued pieces, several replies per call, as far as the
+    // socket takes them
+    void flush(Conn* c, const SessionHandler& onSession) {
+        while (!c->out.empty()) {
+            iovec iov[kMaxPieces];
+            int n = 0;
+            for (std::deque<Outgoing>::iterator it = c->out.begin(); it != c->out.end(); ++it)
+                if (!it->pieces(iov, kMaxPieces, n)) break;
+            msghdr mh;
+            memset(&mh, 0, sizeof(mh));
+            mh.msg_iov = iov;
+            mh.msg_iovlen = n;
+            ssize_t w = ::sendmsg(c->fd, &mh, MSG_NOSIGNAL);
+            if (w > 0) {
+                size_t left = (size_t)w;
+                while (left > 0) {
+                    size_t len = 0;
+                    c->out.front().piece(len);
+                    size_t k = len < left ? len : left;
+                    c->out.front().advance(k);
+                    left -= k;
+                    if (c->out.front().done()) c->out.pop_front();
+                }
+                continue;
+            }
+            if (w < 0 && errno == EINTR) continue;
+            if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            drop(c, onSession);
+            return;
+        }
+        if (c->out.empty() && c->closing) { drop(c, onSession); return; }
+        watch(c->fd, c->id, EPOLLIN | EPOLLRDHUP | (c->out.empty() ? 0 : (uint32_t)EPOLLOUT), EPOLL_CTL_MOD);
+    }
+
+    void drop(Conn* c, const SessionHandler& onSession) {
+        int id = c->id;
+        epoll_ctl(m_epollFd, EPOLL_CTL_DEL, c->fd, NULL);
+        ::close(c->fd);
+        m_conns.erase(id);
+        delete c;
+        m_clients--;
+        if (onSession) onSession(id, false);
+    }
+
+    void deliverPosted(const SessionHandler& onSession) {
+        uint64_t count;
+        while (::read(m_wakeFd, &count, sizeof(count)) > 0) {}
+        std::deque<Posted> posted;
+        { std::lock_guard<std::mutex> lock(m_postMutex); posted.swap(m_posted); }
+        for (size_t p = 0; p < posted.size(); p++) {
+            if (posted[p].task) { posted[p].task(); continue; }
+            std::map<int, Conn*>::iterator it = m_conns.find(posted[p].client);
+            if (it == m_conns.end()) continue;
+            Conn* c = it->second;
+            if (posted[p].close) c->closing = true;
+            else c->out.emplace_back(std::move(posted[p].data), posted[p].framed);
+            flush(c, onSession);
+        }
+    }
+
+    int m_listenFd, m_epollFd, m_wakeFd;
+    std::string m_socketPath;  // Unix-domain socket to remove on close
+    std::map<int, Conn*> m_conns;
+#endif
+
+    struct Posted {
+        int client;
+        std::string data;  // reply line or frame payload
+        bool framed, close;
+        std::function<void()> task;  // defer()
+    };
+
+    // Next whole request at offset pos of buf, pos moved past it: a '\n'
+    // terminated line, or a message of frames on a binary connection; bad
+    // on a runaway request. The caller drops what was taken at the end.
+    static bool nextRequest(const std::string& buf, size_t& pos, bool binary, std::string& msg, bool& bad) {
+        bad = false;
+        if (binary) return Frame::take(buf, pos, msg, bad);
+        size_t end = buf.find('\n', pos);
+        if (end == std::string::npos) {
+            bad = buf.size() - pos > Frame::kMaxPayload;
+            return false;
+        }
+        msg.assign(buf, pos, end - pos);
+        pos = end + 1;
+        if (!msg.empty() && msg.back() == '\r') msg.pop_back();
+        return true;
+    }
+
+    // Reply in the framing the request came in
+    Reply replyTo(int id, bool binary) {
+        if (binary) return [this, id](const std::string& r) { sendFrame(id, r); };
+        return [this, id](const std::string& r) { send(id, r); };
+    }
+
+    void post(int client, std::string&& data, bool framed, bool close) {
+        Posted p;
+        p.client = client;
+        p.data = std::move(data);
+        p.framed = framed;
+        p.close = close;
+        { std::lock_guard<std::mutex> lock(m_postMutex); m_posted.push_back(std::move(p)); }
+        wake();
+    }
+
+    TransportAddress m_addr;
+    int m_maxClients;
+    int m_nextId;
+    std::atomic<int> m_clients;
+    std::atomic<bool> m_stop;
+    std::mutex m_postMutex;
+    std::deque<Posted> m_posted;
+};
@@ -3,8 +3,9 @@
 #ifdef _WIN32
 #include <windows.h>
 #include <string>
+#include "ipc/Transport.h"
 
-class NamedPipeClient {
+class NamedPipeClient : public ClientTransport {
 public:
     explicit NamedPipeClient(const std::string& pipeName)
         : m_pipeName(pipeName), m_hPipe(INVALID_HANDLE_VALUE) {}
@@ -13,46 +14,66 @@ public:
         disconnect();
     }
 
-    bool connect(unsigned long timeoutMs = 5000) {
+    bool connect(unsigned long timeoutMs = 5000) override {
         std::string name = m_pipeName.empty() ? std::string("\\\\.\\pipe\\XRayService") : m_pipeName;
-        DWORD waited = 0;
-        const DWORD step = 100;
-        while (waited < timeoutMs) {
+        disconnect();
+        DWORD start = GetTickCount();
+        DWORD delay = kRetryFirstMs;
+        for (;;) {
             m_hPipe = CreateFileA(name.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
             if (m_hPipe != INVALID_HANDLE_VALUE) {
                 DWORD mode = PIPE_READMODE_MESSAGE;
                 SetNamedPipeHandleState(m_hPipe, &mode, NULL, NULL);
                 return true;
             }
-            if (GetLastError() != ERROR_PIPE_BUSY) break;
-            if (!WaitNamedPipeA(name.c_str(), step)) break;
-            waited += step;
+            // Every instance busy, or no pipe while the service (re)starts
+            DWORD err = GetLastError();
+            if (err != ERROR_PIPE_BUSY && err != ERROR_FILE_NOT_FOUND) return false;
+            DWORD waited = GetTickCount() - start;
+            if (waited >= timeoutMs) return false;
+            DWORD wait = delay < timeoutMs - waited ? delay : (DWORD)(timeoutMs - waited);
+            if (err == ERROR_PIPE_BUSY) WaitNamedPipeA(name.c_str(), wait);
+            else Sleep(wait);
+            delay = delay * 2 < (DWORD)kRetryMaxMs ? delay * 2 : (DWORD)kRetryMaxMs;
         }
-        return false;
     }
 
-    void disconnect() {
+    void disconnect() override {
         if (m_hPipe != INVALID_HANDLE_VALUE) {
             CloseHandle(m_hPipe);
             m_hPipe = INVALID_HANDLE_VALUE;
         }
+        m_in.clear();
+        m_inPos = 0;
     }
 
-    bool call(const std::string& requestLine, std::string& responseLine) {
-        if (m_hPipe == INVALID_HANDLE_VALUE) return false;
-        std::string line = requestLine;
-        if (line.empty() || line.back() != '\n') line.push_back('\n');
+    bool isConnected() const override { return m_hPipe != INVALID_HANDLE_VALUE; }
+
+protected:
+    bool writeAll(const std::string& data) override {
         DWORD written = 0;
-        if (!WriteFile(m_hPipe, line.data(), (DWORD)line.size(), &written, NULL)) return false;
-        // Read a single message (server replies per-request)
-        char buffer[4096];
-        DWORD read = 0;
-        if (!ReadFile(m_hPipe, buffer, sizeof(buffer)-1, &read, NULL)) return false;
-        buffer[read] = '\0';
-        responseLine.assign(buffer, buffer + read);
-        // Trim trailing newlines\r\n
-        while (!responseLine.empty() && (responseLine.back() == '\n' || responseLine.back() == '\r')) responseLine.pop_back();
-        return true;
+        return WriteFile(m_hPipe, data.data(), (DWORD)data.size(), &written, NULL) && written == data.size();
+    }
+
+    bool readSome(long timeoutMs) override {
+        if (m_hPipe == INVALID_HANDLE_VALUE) return false;
+        if (timeoutMs >= 0) {
+            // Wait for data without blocking in ReadFile
+            DWORD start = GetTickCount(), avail = 0;
+            for (;;) {
+                if (!PeekNamedPipe(m_hPipe, NULL, 0, NULL, &avail, NULL)) return false;
+                if (avail > 0) break;
+                if ((long)(GetTickCount() - start) >= timeoutMs) return true;
+                Sleep(5);
+            }
+        }
+        // A message longer than the read comes in parts (ERROR_MORE_DATA)
+        HANDLE pipe = m_hPipe;
+        return readInto([pipe](char* dest, size_t max) -> long {
+            DWORD read = 0;
+            if (!ReadFile(pipe, dest, (DWORD)max, &read, NULL) && GetLastError() != ERROR_MORE_DATA) return -1;
+            return (long)read;
+        }) >= 0;
     }
 
 private:
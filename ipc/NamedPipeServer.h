@@ -30,11 +30,16 @@ public:
 
     bool readLine(std::string& line) {
         if (m_hPipe == INVALID_HANDLE_VALUE) return false;
+        // One message, in parts if longer than the buffer (ERROR_MORE_DATA)
         char buffer[4096];
-        DWORD read = 0;
-        if (!ReadFile(m_hPipe, buffer, sizeof(buffer)-1, &read, NULL)) return false;
-        buffer[read] = '\0';
-        line.assign(buffer, buffer + read);
+        line.clear();
+        for (;;) {
+            DWORD read = 0;
+            BOOL ok = ReadFile(m_hPipe, buffer, sizeof(buffer), &read, NULL);
+            if (!ok && GetLastError() != ERROR_MORE_DATA) return false;
+            line.append(buffer, read);
+            if (ok) break;
+        }
         // trim CRLF
         while (!line.empty() && (line.back() == '\n' || line.back() == '\r')) line.pop_back();
         return true;
@@ -0,0 +1,105 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include "ipc/MultiPipeServer.h"
+
+// Request tags and BATCH on top of a server's text request handler.
+//   @<id>|<request>        the reply comes back as @<id>|<reply>, so a
+//                          client may send many requests without waiting
+//                          and match the replies, which complete in any order
+//   BATCH|<req>;<req>;...  runs the requests one after the other, each
+//                          once the previous one is answered, and replies
+//                          once: OK|<n>;<reply>;<reply>;... or, from the
+//                          first request answered ERR, ERR|<index>;... with
+//                          the rest ERR|skipped
+// A BATCH may be tagged; its requests may not be tags or batches
+// (ERR|nested), nor EXEC (ERR|exec_in_batch): a program separates its
+// statements with ';' too, so it would be cut into requests.
+class RequestPipeline {
+public:
+    typedef MultiPipeServer::RequestHandler Handler;
+    typedef MultiPipeServer::Reply Reply;
+
+    static Handler wrap(MultiPipeServer& server, const Handler& handler) {
+        return [&server, handler](int client, const std::string& line, const Reply& reply) {
+            if (!line.empty() && line[0] == '@') {
+                size_t bar = line.find('|');
+                std::string tag = line.substr(0, bar == std::string::npos ? line.size() : bar) + "|";
+                Reply tagged = [reply, tag](const std::string& r) { reply(tag + r); };
+                if (bar == std::string::npos) { tagged("ERR|empty"); return; }
+                dispatch(server, handler, client, line.substr(bar + 1), tagged);
+                return;
+            }
+            dispatch(server, handler, client, line, reply);
+        };
+    }
+
+private:
+    struct Batch {
+        MultiPipeServer* server;
+        Handler handler;
+        int client;
+        Reply reply;
+        std::vector<std::string> requests, replies;
+        int failed;  // index of the first ERR reply, -1 if none
+    };
+
+    static void dispatch(MultiPipeServer& server, const Handler& handler, int client,
+                         const std::string& line, const Reply& reply) {
+        if (line.compare(0, 6, "BATCH|") != 0) { handler(client, line, reply); return; }
+        std::shared_ptr<Batch> b = std::make_shared<Batch>();
+        b->server = &server;
+        b->handler = handler;
+        b->client = client;
+        b->reply = reply;
+        b->failed = -1;
+        size_t start = 6;
+        while (start <= line.size()) {
+            size_t semi = line.find(';', start);
+            if (semi == std::string::npos) semi = line.size();
+            std::string req = line.substr(start, semi - start);
+            if (!req.empty()) b->requests.push_back(req);
+            start = semi + 1;
+        }
+        for (size_t k = 0; k < b->requests.size(); k++) {
+            const std::string& req = b->requests[k];
+            if (req[0] == '@' || req.compare(0, 5, "BATCH") == 0) { reply("ERR|nested"); return; }
+            if (isExec(req)) { reply("ERR|exec_in_batch"); return; }
+        }
+        if (b->requests.empty()) { reply("ERR|empty"); return; }
+        step(b);
+    }
+
+    // EXEC|..., also addressed #<tube>|EXEC|...; not EXEC_STATUS or EXEC_ABORT
+    static bool isExec(const std::string& req) {
+        size_t start = 0;
+        if (req[0] == '#') {
+            start = req.find('|');
+            if (start == std::string::npos) return false;
+            start++;
+        }
+        return req.compare(start, 4, "EXEC") == 0 && (req.size() == start + 4 || req[start + 4] == '|');
+    }
+
+    static void step(const std::shared_ptr<Batch>& b) {
+        size_t k = b->replies.size();
+        if (k == b->requests.size() || b->failed >= 0) { finish(b); return; }
+        b->handler(b->client, b->requests[k], [b](const std::string& r) {
+            // The next request runs on the event loop thread, also when this
+            // one was answered by a tube's command queue
+            b->server->defer([b, r]() {
+                if (r.compare(0, 3, "ERR") == 0 && b->failed < 0) b->failed = (int)b->replies.size();
+                b->replies.push_back(r);
+                step(b);
+            });
+        });
+    }
+
+    static void finish(const std::shared_ptr<Batch>& b) {
+        std::string out = b->failed < 0 ? "OK|" + std::to_string(b->replies.size()) : "ERR|" + std::to_string(b->failed);
+        for (size_t k = 0; k < b->requests.size(); k++)
+            out += ";" + (k < b->replies.size() ? b->replies[k] : std::string("ERR|skipped"));
+        b->reply(out);
+    }
+};
@@ -0,0 +1,118 @@
+#pragma once
+
+#ifndef _WIN32
+#include <string>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "ipc/Transport.h"
+
+// Client of the XRay service over a Unix-domain or TCP stream socket,
+// the Linux counterpart of NamedPipeClient. A pipe address connects to
+// the Unix-domain socket the service listens on in its place.
+class SocketClient : public ClientTransport {
+public:
+    explicit SocketClient(const std::string& address)
+        : m_addr(TransportAddress::parse(address)), m_fd(-1) {}
+
+    ~SocketClient() {
+        disconnect();
+    }
+
+    bool connect(unsigned long timeoutMs = 5000) override {
+        disconnect();
+        if (!m_addr.valid()) return false;
+        unsigned long waited = 0;
+        unsigned long delay = kRetryFirstMs;
+        for (;;) {
+            if (tryConnect()) return true;
+            // Not listening (yet), e.g. while the service restarts
+            if (errno != ECONNREFUSED && errno != ENOENT && errno != EAGAIN) return false;
+            if (waited >= timeoutMs) return false;
+            unsigned long wait = delay < timeoutMs - waited ? delay : timeoutMs - waited;
+            usleep(wait * 1000);
+            waited += wait;
+            delay = delay * 2 < (unsigned long)kRetryMaxMs ? delay * 2 : (unsigned long)kRetryMaxMs;
+        }
+    }
+
+    void disconnect() override {
+        if (m_fd >= 0) {
+            ::close(m_fd);
+            m_fd = -1;
+        }
+        m_in.clear();
+        m_inPos = 0;
+    }
+
+    bool isConnected() const override { return m_fd >= 0; }
+
+protected:
+    bool writeAll(const std::string& data) override {
+        size_t off = 0;
+        while (off < data.size()) {
+            ssize_t w = ::send(m_fd, data.data() + off, data.size() - off, MSG_NOSIGNAL);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) return false;
+            off += (size_t)w;
+        }
+        return true;
+    }
+
+    bool readSome(long timeoutMs) override {
+        if (m_fd < 0) return false;
+        if (timeoutMs >= 0) {
+            pollfd pfd = { m_fd, POLLIN, 0 };
+            int n;
+            do { n = ::poll(&pfd, 1, (int)timeoutMs); } while (n < 0 && errno == EINTR);
+            if (n < 0) return false;
+            if (n == 0) return true;
+        }
+        int fd = m_fd;
+        long r;
+        do {
+            r = readInto([fd](char* dest, size_t max) { return (long)::recv(fd, dest, max, 0); });
+        } while (r < 0 && errno == EINTR);
+        return r > 0;
+    }
+
+private:
+    bool tryConnect() {
+        if (m_addr.kind == TransportAddress::Tcp) {
+            sockaddr_in addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons((unsigned short)m_addr.port);
+            if (inet_pton(AF_INET, m_addr.host.c_str(), &addr.sin_addr) != 1) { errno = EINVAL; return false; }
+            m_fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (m_fd < 0) return false;
+            int one = 1;
+            setsockopt(m_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            if (::connect(m_fd, (sockaddr*)&addr, sizeof(addr)) == 0) return true;
+        } else {
+            sockaddr_un addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sun_family = AF_UNIX;
+            strncpy(addr.sun_path, m_addr.socketPath().c_str(), sizeof(addr.sun_path) - 1);
+            m_fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (m_fd < 0) return false;
+            if (::connect(m_fd, (sockaddr*)&addr, sizeof(addr)) == 0) return true;
+        }
+        int err = errno;
+        ::close(m_fd);
+        m_fd = -1;
+        errno = err;
+        return false;
+    }
+
+    TransportAddress m_addr;
+    int m_fd;
+};
+
+#endif // !_WIN32
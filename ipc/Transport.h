@@ -0,0 +1,300 @@
+#pragma once
+#include <string>
+#include <cstdlib>
+#include <stdint.h>
+#include <functional>
+#include <vector>
+
+// Address of the XRay service endpoint. Every transport carries the same
+// '\n' terminated request/reply lines, so only the address changes:
+//   \\.\pipe\<name> or pipe:<name>  named pipe; on Linux the Unix-domain
+//                                   socket /tmp/<name>.sock
+//   unix:<path>                     Unix-domain socket (Linux)
+//   tcp:<port> or tcp:<host>:<port> TCP, host defaults to 127.0.0.1 (Linux)
+// An empty address is the default pipe \\.\pipe\XRayService.
+struct TransportAddress {
+    enum Kind { Pipe, Unix, Tcp };
+
+    Kind kind;
+    std::string path;  // pipe name or socket path
+    std::string host;
+    int port;
+
+    TransportAddress() : kind(Pipe), port(0) {}
+
+    static TransportAddress parse(const std::string& address) {
+        TransportAddress a;
+        if (address.compare(0, 4, "tcp:") == 0) {
+            std::string rest = address.substr(4);
+            size_t colon = rest.rfind(':');
+            a.kind = Tcp;
+            a.host = colon == std::string::npos ? std::string("127.0.0.1") : rest.substr(0, colon);
+            a.port = std::atoi(colon == std::string::npos ? rest.c_str() : rest.c_str() + colon + 1);
+            if (a.host.empty() || a.host == "localhost") a.host = "127.0.0.1";
+        } else if (address.compare(0, 5, "unix:") == 0) {
+            a.kind = Unix;
+            a.path = address.substr(5);
+        } else {
+            std::string name = address.compare(0, 5, "pipe:") == 0 ? address.substr(5) : address;
+            if (name.empty()) name = "XRayService";
+            a.path = name.find('\\') == std::string::npos && name.find('/') == std::string::npos
+                ? "\\\\.\\pipe\\" + name : name;
+        }
+        return a;
+    }
+
+    bool valid() const {
+        if (kind == Tcp) return port > 0 && port < 65536;
+        return !path.empty();
+    }
+
+    // Unix-domain socket path standing in for a named pipe off Windows:
+    // \\.\pipe\<name> -> /tmp/<name>.sock; a name with '/' is a path already
+    std::string socketPath() const {
+        if (kind == Unix || path.find('/') != std::string::npos) return path;
+        size_t slash = path.find_last_of('\\');
+        return "/tmp/" + (slash == std::string::npos ? path : path.substr(slash + 1)) + ".sock";
+    }
+
+    std::string str() const {
+        if (kind == Tcp) return "tcp:" + host + ":" + std::to_string(port);
+        if (kind == Unix) return "unix:" + path;
+        return path;
+    }
+};
+
+// Framing of the binary protocol (ipc/XRayProtocol.h), used on a
+// connection after INIT negotiated it: a little-endian uint32 payload
+// length, then the payload. No frame carries more than kMaxPayload: a
+// longer message (up to kMaxMessage) goes as a run of frames with kMore
+// set in the length, the last one without, which the reader joins.
+struct Frame {
+    enum { kHeaderSize = 4, kMaxPayload = 1 << 20, kMaxMessage = 1 << 28 };
+    enum : uint32_t { kMore = 0x80000000u };
+
+    static void header(char* out, uint32_t n) {
+        out[0] = (char)(n & 0xff);
+        out[1] = (char)((n >> 8) & 0xff);
+        out[2] = (char)((n >> 16) & 0xff);
+        out[3] = (char)(n >> 24);
+    }
+    static uint32_t length(const char* in) {
+        const unsigned char* p = (const unsigned char*)in;
+        return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+
+    // Length field of the frame carrying payload bytes [off, ...)
+    static uint32_t chunk(size_t size, size_t off) {
+        size_t n = size - off;
+        return n > kMaxPayload ? (uint32_t)kMaxPayload | kMore : (uint32_t)n;
+    }
+
+    static void append(std::string& out, const std::string& payload) {
+        size_t off = 0;
+        do {
+            uint32_t h = chunk(payload.size(), off);
+            char len[kHeaderSize];
+            header(len, h);
+            out.append(len, kHeaderSize);
+            out.append(payload, off, h & ~kMore);
+            off += h & ~kMore;
+        } while (off < payload.size());
+    }
+
+    // Next whole message at offset pos of buf to payload, pos moved past
+    // it; false while it is incomplete or, with bad set, if it claims more
+    // than the limits. The frames are checked first, so a message still
+    // arriving is not copied.
+    static bool take(const std::string& buf, size_t& pos, std::string& payload, bool& bad) {
+        bad = false;
+        size_t end = pos, total = 0;
+        for (;;) {
+            if (buf.size() - end < kHeaderSize) return false;
+            uint32_t h = length(buf.data() + end);
+            size_t n = h & ~kMore;
+            total += n;
+            if (n > kMaxPayload || total > kMaxMessage) { bad = true; return false; }
+            if (buf.size() - end - kHeaderSize < n) return false;
+            end += kHeaderSize + n;
+            if (!(h & kMore)) break;
+        }
+        payload.clear();
+        payload.reserve(total);
+        for (size_t p = pos; p < end; p += kHeaderSize + (length(buf.data() + p) & ~kMore))
+            payload.append(buf, p + kHeaderSize, length(buf.data() + p) & ~kMore);
+        pos = end;
+        return true;
+    }
+
+    static bool take(std::string& buf, std::string& payload, bool& bad) {
+        size_t pos = 0;
+        if (!take(buf, pos, payload, bad)) return false;
+        buf.erase(0, pos);
+        return true;
+    }
+};
+
+// Client end of one connection to the service: one request line out,
+// one reply line back, or one frame each way once binary. Messages the
+// service pushes on its own (SUBSCRIBE updates: lines starting EVT|,
+// frames with kPushBit in their op) may arrive in between; they go to the
+// push handler, while waiting for a reply or in waitPush. The platform
+// classes only move bytes. AsyncClient (ipc/AsyncClient.h) drives one
+// from a receive thread instead, with many requests in flight.
+class ClientTransport {
+public:
+    typedef std::function<void(const std::string&)> PushHandler;
+    enum { kPushBit = 0x8000 };  // in the leading uint16 op of a frame
+    // connect() retries a service that is not listening, waiting
+    // kRetryFirstMs first and doubling up to kRetryMaxMs
+    enum { kRetryFirstMs = 10, kRetryMaxMs = 250 };
+
+    ClientTransport() : m_inPos(0), m_binary(false), m_nextTag(1) {}
+    virtual ~ClientTransport() {}
+    virtual bool connect(unsigned long timeoutMs = 5000) = 0;
+    virtual void disconnect() = 0;
+    virtual bool isConnected() const = 0;
+
+    void setPushHandler(const PushHandler& handler) { m_onPush = handler; }
+    // Frames instead of lines from now on, for waitPush
+    void setBinary(bool binary) { m_binary = binary; }
+
+    bool call(const std::string& requestLine, std::string& responseLine) {
+        if (!isConnected()) return false;
+        std::string line = requestLine;
+        if (line.empty() || line.back() != '\n') line.push_back('\n');
+        return write(line) && nextReply(false, responseLine);
+    }
+
+    // Send all requests at once, tagged @<id>|, and collect their replies,
+    // which the service may complete in any order: one round trip for N.
+    // Untagged replies (a service without tags) fill the slots in order
+    bool callPipelined(const std::vector<std::string>& requests, std::vector<std::string>& responses) {
+        if (!isConnected()) return false;
+        unsigned long first = m_nextTag;
+        m_nextTag += requests.size();
+        std::string out;
+        for (size_t i = 0; i < requests.size(); i++)
+            out += "@" + std::to_string(first + i) + "|" + requests[i] + "\n";
+        responses.assign(requests.size(), std::string());
+        std::vector<bool> got(requests.size(), false);
+        if (!write(out)) return false;
+        size_t pending = requests.size();
+        while (pending > 0) {
+            std::string line;
+            if (!nextReply(false, line)) return false;
+            size_t slot = requests.size(), bar = line.find('|');
+            if (line.size() > 1 && line[0] == '@' && bar != std::string::npos) {
+                unsigned long tag = std::strtoul(line.c_str() + 1, 0, 10);
+                if (tag >= first && tag < first + requests.size()) slot = tag - first;
+                line.erase(0, bar + 1);
+            } else {
+                for (slot = 0; slot < requests.size() && got[slot]; slot++) {}
+            }
+            if (slot >= requests.size() || got[slot]) continue;  // not one of these
+            responses[slot] = line;
+            got[slot] = true;
+            pending--;
+        }
+        return true;
+    }
+
+    bool callFrame(const std::string& request, std::string& response) {
+        if (!isConnected()) return false;
+        std::string frame;
+        Frame::append(frame, request);
+        return write(frame) && nextReply(true, response);
+    }
+
+    // Hand pushed messages to the push handler for up to timeoutMs
+    // (returns at the first one); false if the connection is gone
+    bool waitPush(long timeoutMs) {
+        std::string msg;
+        for (;;) {
+            bool bad = false;
+            while (take(m_binary, msg, bad)) {
+                if (isPush(m_binary, msg)) { if (m_onPush) m_onPush(msg); return true; }
+            }
+            if (bad) { disconnect(); return false; }
+            if (!isConnected()) return false;
+            size_t before = m_in.size();
+            if (!readSome(timeoutMs)) { disconnect(); return false; }
+            if (m_in.size() == before) return true;  // timed out
+        }
+    }
+
+    static bool isPush(bool binary, const std::string& msg) {
+        if (!binary) return msg.compare(0, 4, "EVT|") == 0;
+        return msg.size() >= 2 && (((unsigned char)msg[1] << 8) & kPushBit);
+    }
+
+protected:
+    // Send all of data; false if the connection broke. It may run on
+    // another thread than readSome, so it leaves disconnecting to the caller
+    virtual bool writeAll(const std::string& data) = 0;
+    // Append what arrives to m_in, waiting up to timeoutMs for it (-1:
+    // until something does); false if the connection broke
+    virtual bool readSome(long timeoutMs) = 0;
+
+    // Read up to kReadSize bytes straight into the tail of m_in with
+    // read(dest, max), which returns the count or < 0
+    template <class ReadFn>
+    long readInto(ReadFn read) {
+        size_t old = m_in.size();
+        m_in.resize(old + kReadSize);
+        long r = read(&m_in[old], (size_t)kReadSize);
+        m_in.resize(old + (r > 0 ? (size_t)r : 0));
+        return r;
+    }
+
+    enum { kReadSize = 64 * 1024 };
+    std::string m_in;  // received; handed out up to m_inPos
+    size_t m_inPos;
+
+private:
+    friend class AsyncClient;
+
+    bool write(const std::string& data) {
+        if (writeAll(data)) return true;
+        disconnect();
+        return false;
+    }
+
+    bool take(bool binary, std::string& msg, bool& bad) {
+        bad = false;
+        bool got;
+        if (binary) {
+            got = Frame::take(m_in, m_inPos, msg, bad);
+        } else {
+            size_t pos = m_in.find('\n', m_inPos);
+            got = pos != std::string::npos;
+            if (got) {
+                msg.assign(m_in, m_inPos, pos - m_inPos);
+                m_inPos = pos + 1;
+                while (!msg.empty() && msg.back() == '\r') msg.pop_back();
+            }
+        }
+        // Drop what was handed out once it is all of the buffer or most of it
+        if (m_inPos == m_in.size() || (m_inPos > kReadSize && m_inPos * 2 > m_in.size())) {
+            m_in.erase(0, m_inPos);
+            m_inPos = 0;
+        }
+        return got;
+    }
+
+    // Next message that is not a push
+    bool nextReply(bool binary, std::string& reply) {
+        for (;;) {
+            bool bad = false;
+            while (take(binary, reply, bad)) {
+                if (!isPush(binary, reply)) return true;
+                if (m_onPush) m_onPush(reply);
+            }
+            if (bad || !readSome(-1)) { disconnect(); return false; }
+        }
+    }
+
+    PushHandler m_onPush;
+    bool m_binary;
+    unsigned long m_nextTag;  // of callPipelined requests
+};
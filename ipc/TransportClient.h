@@ -0,0 +1,21 @@
+#pragma once
+#include <string>
+#include "ipc/Transport.h"
+#ifdef _WIN32
+#include "ipc/NamedPipeClient.h"
+#else
+#include "ipc/SocketClient.h"
+#endif
+
+// Client transport for an address (see TransportAddress), 0 if this
+// platform cannot reach it. The caller owns it.
+inline ClientTransport* createClientTransport(const std::string& address) {
+    TransportAddress a = TransportAddress::parse(address);
+    if (!a.valid()) return 0;
+#ifdef _WIN32
+    if (a.kind != TransportAddress::Pipe) return 0;
+    return new NamedPipeClient(a.path);
+#else
+    return new SocketClient(address);
+#endif
+}
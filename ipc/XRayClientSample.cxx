@@ -1,77 +1,100 @@
-#ifdef _WIN32
-#include <windows.h>
-#endif
 #include <cstdio>
+#include <cstdlib>
+#include <memory>
 #include <string>
-#include "ipc/NamedPipeClient.h"
+#include <vector>
+#include "ipc/TransportClient.h"
+#include "ipc/AsyncClient.h"
 
 // Simple standalone sample demonstrating how another process (GUI) can
 // connect to the XRayService (implemented in main.cxx) and activate the MiniX.
 // Build separately or integrate into your GUI project.
 // Steps:
-// 1. Ensure XRayService process is running (launch compiled main.exe)
-// 2. Run this sample; it will INIT, enumerate devices, select first, set HV & current, power ON, then read status.
+// 1. Ensure XRayService process is running (launch compiled main.exe). XRAY_PIPE_NAME
+//    selects the endpoint: pipe name, unix:<path> or tcp:[host:]port (ipc/Transport.h)
+// 2. Run this sample; it will INIT, enumerate devices, select first, set HV & current, power ON, then read status,
+//    watch pushed state updates for a while and read the tubes asynchronously meanwhile.
 // 3. Power OFF before exit.
 
-static bool send(NamedPipeClient &cli, const std::string &req, std::string &resp) {
+static bool send(ClientTransport &cli, const std::string &req, std::string &resp) {
     if (!cli.call(req, resp)) { std::printf("Request failed: %s\n", req.c_str()); return false; }
     std::printf("REQ: %s\nRESP: %s\n", req.c_str(), resp.c_str());
     return true;
 }
 
 int main() {
-#ifndef _WIN32
-    std::fprintf(stderr, "Windows only sample.\n");
-    return 1;
-#else
     const char *pipeEnv = std::getenv("XRAY_PIPE_NAME");
     std::string pipeName = pipeEnv && pipeEnv[0] ? pipeEnv : "\\\\.\\pipe\\XRayService";
 
-    NamedPipeClient client(pipeName);
-    if (!client.connect(3000)) {
-        std::fprintf(stderr, "Could not connect to pipe %s\n", pipeName.c_str());
+    std::unique_ptr<ClientTransport> transport(createClientTransport(pipeName));
+    if (!transport || !transport->connect(3000)) {
+        std::fprintf(stderr, "Could not connect to %s\n", pipeName.c_str());
         return 2;
     }
+    ClientTransport &client = *transport;
 
     std::string resp;
 
     // 1. INIT (optionally pass a serial number you want to bind to)
     send(client, "INIT|", resp); // empty serial => auto-select first device
 
-    // 2. Enumerate devices
-    send(client, "GET_DEVICE_LIST", resp);
-    send(client, "GET_DEVICE_COUNT", resp);
+    // 2. Enumerate devices and query the first serial number: pipelined,
+    // all three requests go out at once and cost one round trip
+    std::vector<std::string> reqs, resps;
+    reqs.push_back("GET_DEVICE_LIST");
+    reqs.push_back("GET_DEVICE_COUNT");
+    reqs.push_back("GET_DEVICE_SERIAL|0");
+    if (client.callPipelined(reqs, resps))
+        for (size_t i = 0; i < reqs.size(); i++) std::printf("REQ: %s\nRESP: %s\n", reqs[i].c_str(), resps[i].c_str());
 
-    // 3. Optionally query first device serial number
-    send(client, "GET_DEVICE_SERIAL|0", resp);
-
-    // 4. Select device index 0
+    // 3. Select device index 0
     send(client, "SET_DEVICE|0", resp);
 
-    // 5. Set desired HV (kV) and current (uA) and apply together
-    // Option A: single combined command path
-    send(client, "SET_VOLTAGE|40.0", resp);   // 40 kV example
-    send(client, "SET_CURRENT|200.0", resp);  // 200 uA example
-    send(client, "SET_HV_I", resp);           // commits HV+Current (if enabled)
+    // 4. Set desired HV (kV) and current (uA) and apply together.
+    // BATCH runs them in order and answers once: OK|3;OK;OK;OK
+    send(client, "BATCH|SET_VOLTAGE|40.0;SET_CURRENT|200.0;SET_HV_I", resp);
 
-    // 6. Power ON (this triggers SetXRayState on server side which also performs HVOn logic)
+    // 5. Power ON (this triggers SetXRayState on server side which also performs HVOn logic)
     // Format: SET_POWER|<on/off>|<VoltageToSet>|<CurrentToSet>
     send(client, "SET_POWER|1|40.0|200.0", resp);
 
-    // 7. Read current state metrics
+    // 6. Read current state metrics
     send(client, "GET_STATE", resp);
     send(client, "READ_DATA", resp);
 
-    // 8. Print status (server side will log details)
+    // 7. Print status (server side will log details)
     send(client, "PRINT_STATUS", resp);
 
-    // 9. Power OFF before exit
+    // 8. Watch the state for two seconds without polling: after SUBSCRIBE
+    // the service pushes EVT|<seq>|<field>=<value>|... lines with the
+    // changed fields (at most every 100 ms here)
+    client.setPushHandler([](const std::string &evt) { std::printf("PUSH: %s\n", evt.c_str()); });
+    send(client, "SUBSCRIBE|100", resp);
+    for (int i = 0; i < 20; i++) client.waitPush(100);
+
+    // 9. Without waiting for each reply: AsyncClient keeps requests in
+    // flight on this connection, from any thread, while its receive thread
+    // hands the replies to futures or callbacks and the updates, still
+    // coming, to the push handler
+    {
+        AsyncClient async(client);
+        async.setPushHandler([](const std::string &evt) { std::printf("PUSH: %s\n", evt.c_str()); });
+        if (async.start()) {
+            std::future<std::string> tube0 = async.call("#0|READ_DATA");
+            std::future<std::string> tube1 = async.call("#1|READ_DATA");
+            std::future<std::string> all = async.call("READ_ALL");
+            std::printf("TUBE 0: %s\nTUBE 1: %s\nALL: %s\n", tube0.get().c_str(), tube1.get().c_str(), all.get().c_str());
+            async.stop();
+        }
+    }
+    send(client, "UNSUBSCRIBE", resp);
+
+    // 10. Power OFF before exit
     send(client, "SET_POWER|0|40.0|200.0", resp);
 
-    // 10. Shutdown service (optional - normally service keeps running)
+    // 11. Shutdown service (optional - normally service keeps running)
     // send(client, "SHUTDOWN", resp);
 
     client.disconnect();
     return 0;
-#endif
 }
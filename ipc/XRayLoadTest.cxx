@@ -0,0 +1,107 @@
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <algorithm>
+#include <memory>
+#include "ipc/TransportClient.h"
+#include "ipc/XRayProtocol.h"
+
+// Load generator for the XRayService (main.cxx), e.g. on Linux against
+// the MiniX simulation. Each of <clients> threads opens its own connection,
+// binds with INIT| and sends <request> back to back for <seconds>; the
+// request rate and latency percentiles are printed at the end.
+// Usage: XRayLoadTest [address] [clients] [seconds] [request] [bin]
+//   address as in ipc/Transport.h, default $XRAY_PIPE_NAME or the default pipe
+//   request defaults to GET_STATE (answered without touching the tube)
+//   bin negotiates the binary protocol (ipc/XRayProtocol.h): GET_STATE and
+//   READ_DATA go as their binary ops, other requests as XRayOpText
+
+typedef std::chrono::steady_clock Clock;
+
+struct Worker {
+    std::vector<double> latencyUs;
+    long errors;
+    bool connected;
+    Worker() : errors(0), connected(false) {}
+};
+
+static void work(const std::string& address, const std::string& request, bool binary,
+                 Clock::time_point end, std::atomic<bool>& go, Worker& w) {
+    std::unique_ptr<ClientTransport> cli(createClientTransport(address));
+    std::string resp;
+    std::string init = binary ? "INIT||PROTO|" + std::to_string((int)kXRayProtoVersion) : "INIT|";
+    if (!cli || !cli->connect(3000) || !cli->call(init, resp)) return;
+    if (binary && resp.find("|PROTO|") == std::string::npos) {
+        std::fprintf(stderr, "Service does not speak the binary protocol: %s\n", resp.c_str());
+        return;
+    }
+    w.connected = true;
+    uint16_t op = request == "GET_STATE" ? XRayOpGetState : request == "READ_DATA" ? XRayOpReadData : XRayOpText;
+    uint32_t id = 0;
+    while (!go.load()) std::this_thread::yield();
+    while (Clock::now() < end) {
+        Clock::time_point t0 = Clock::now();
+        if (binary) {
+            std::string req = op == XRayOpText ? XRayEncode(op, 0, ++id, request.data(), request.size())
+                                               : XRayEncode(op, 0, ++id);
+            XRayMsgHeader h;
+            const char* body;
+            size_t size;
+            if (!cli->callFrame(req, resp)) { w.errors++; break; }
+            if (!XRayDecode(resp, h, body, size) || h.id != id || h.status != XRayStatusOk) w.errors++;
+        } else {
+            if (!cli->call(request, resp)) { w.errors++; break; }
+            if (resp.compare(0, 2, "OK") != 0) w.errors++;
+        }
+        w.latencyUs.push_back(std::chrono::duration<double, std::micro>(Clock::now() - t0).count());
+    }
+    cli->disconnect();
+}
+
+int main(int argc, char** argv) {
+    const char* pipeEnv = std::getenv("XRAY_PIPE_NAME");
+    std::string address = argc > 1 && argv[1][0] ? argv[1] : (pipeEnv && pipeEnv[0] ? pipeEnv : "\\\\.\\pipe\\XRayService");
+    int clients = argc > 2 ? std::atoi(argv[2]) : 4;
+    double seconds = argc > 3 ? std::atof(argv[3]) : 5;
+    std::string request = argc > 4 ? argv[4] : "GET_STATE";
+    bool binary = argc > 5 && std::string(argv[5]) == "bin";
+    if (clients < 1) clients = 1;
+
+    std::vector<Worker> workers(clients);
+    std::vector<std::thread> threads;
+    std::atomic<bool> go(false);
+    // Connections are set up first; the load starts for all at once
+    Clock::time_point start = Clock::now() + std::chrono::milliseconds(200);
+    Clock::time_point end = start + std::chrono::microseconds((long long)(seconds * 1e6));
+    for (int i = 0; i < clients; i++)
+        threads.push_back(std::thread(work, address, request, binary, end, std::ref(go), std::ref(workers[i])));
+    std::this_thread::sleep_until(start);
+    go = true;
+    for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+
+    std::vector<double> all;
+    long errors = 0;
+    int connected = 0;
+    for (size_t i = 0; i < workers.size(); i++) {
+        all.insert(all.end(), workers[i].latencyUs.begin(), workers[i].latencyUs.end());
+        errors += workers[i].errors;
+        connected += workers[i].connected ? 1 : 0;
+    }
+    if (all.empty()) {
+        std::fprintf(stderr, "No request completed on %s (%d of %d clients connected)\n",
+                     address.c_str(), connected, clients);
+        return 2;
+    }
+    std::sort(all.begin(), all.end());
+    double elapsed = std::chrono::duration<double>(end - start).count();
+    std::printf("%s: %d client(s), %s%s, %.1f s\n", address.c_str(), connected, request.c_str(),
+                binary ? " (binary)" : "", elapsed);
+    std::printf("  %zu requests, %.0f req/s, %ld errors\n", all.size(), all.size() / elapsed, errors);
+    std::printf("  latency us: p50 %.0f  p90 %.0f  p99 %.0f  max %.0f\n", all[all.size() / 2],
+                all[all.size() * 9 / 10], all[all.size() * 99 / 100], all.back());
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,136 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+// Binary protocol of the XRay service, for high-rate pollers.
+// A client asks for it in its handshake, INIT|<serial>|PROTO|<version>;
+// a server that speaks it answers OK|<serial>|PROTO|<version it picked>
+// and from then on both ends exchange frames (see Frame in Transport.h)
+// instead of lines. A plain OK|<serial> (older service, or version 0)
+// means the connection stays on the text protocol.
+// Every frame holds a fixed-layout XRayMsgHeader and the body of its op,
+// in the little-endian layout of the x86/x64 hosts on both ends.
+// XRayOpText carries any text command line and its reply line, so the
+// whole command set stays reachable on a binary connection.
+// After XRayOpSubscribe the service pushes XRayOpEvent frames on its own,
+// with the update sequence number as id: an XRayMsgEvent followed by one
+// float per changed value field, in XRayMsgState order.
+// Version 2: the status of a request may address a tube of the service
+// (1 + its index; 0 is the tube INIT bound), and XRayOpReadAll.
+// Version 3: XRayOpGetStateIfChanged, for pollers of the state version.
+// Version 4: EXEC|<program>|STREAM sent as XRayOpText pushes XRayOpExecRecord
+// frames, their text body as the EVT| lines of a text client without EVT|.
+// Version 5: XRayOpGetState and XRayOpReadData replies end with the
+// XRayMsgVersion of the state, as XRayOpGetStateIfChanged ones do.
+enum { kXRayProtoVersion = 5 };
+
+enum XRayOp_t {
+    XRayOpPing = 1,      // no body, reply with no body
+    XRayOpGetState,      // no body, reply XRayMsgState (last snapshot) and
+                         // from version 5 XRayMsgVersion
+    XRayOpReadData,      // no body, reply XRayMsgState (fresh reading) and
+                         // from version 5 XRayMsgVersion
+    XRayOpSetPower,      // XRayMsgSetpoints, reply with no body
+    XRayOpSetSetpoints,  // XRayMsgSetpoints (power ignored), reply with no body
+    XRayOpText,          // text command line, reply text reply line
+    XRayOpSubscribe,     // XRayMsgSubscribe, reply with no body, then events
+    XRayOpUnsubscribe,   // no body, reply with no body
+    XRayOpReadAll,       // no body, reply one XRayMsgState per tube (fresh readings)
+    XRayOpGetStateIfChanged, // XRayMsgVersion known, reply XRayMsgState and
+                             // XRayMsgVersion, or XRayStatusUnchanged with no body
+    XRayOpEvent = 0x8001, // pushed, not requested (ClientTransport::kPushBit)
+    XRayOpExecRecord     // pushed, text EXEC|<k>|<record> or EXEC|END|<summary>
+};
+
+// Changed fields of an XRayOpEvent (as XRayTelemetryHub::Field_t)
+enum XRayField_t {
+    XRayFieldPower = 1 << 0,
+    XRayFieldVoltageToSet = 1 << 1,
+    XRayFieldActualVoltage = 1 << 2,
+    XRayFieldCurrentToSet = 1 << 3,
+    XRayFieldActualCurrent = 1 << 4,
+    XRayFieldActualPower = 1 << 5,
+    XRayFieldTemperature = 1 << 6
+};
+
+enum XRayStatus_t {
+    XRayStatusOk = 0,
+    XRayStatusError,     // failed, e.g. malformed body
+    XRayStatusUnknown,   // unknown op
+    XRayStatusRevoked,   // dropped by a later HV off
+    XRayStatusNoInst,    // no tube bound, or no such tube
+    XRayStatusUnchanged, // state still at the version asked about
+    XRayStatusDenied     // read-only session, or another client holds the lease
+};
+
+#pragma pack(push, 1)
+struct XRayMsgHeader {
+    uint16_t op;
+    uint16_t status;     // XRayStatus_t in replies; in requests 0 or 1 + tube index
+    uint32_t id;         // echoed in the reply
+};
+
+struct XRayMsgSetpoints {
+    uint8_t power;
+    uint8_t reserved[3];
+    float voltage;       // kV
+    float current;       // uA
+};
+
+struct XRayMsgState {
+    uint8_t power;
+    uint8_t reserved[3];
+    float voltageToSet, actualVoltage;
+    float currentToSet, actualCurrent;
+    float actualPower, temperature;
+};
+
+struct XRayMsgVersion {
+    uint64_t version;        // XRay::GetStateVersion of the state
+};
+
+struct XRayMsgSubscribe {
+    uint32_t minIntervalMs;  // 0: every change
+};
+
+struct XRayMsgEvent {
+    uint8_t changed;         // XRayField_t mask
+    uint8_t power;           // valid with XRayFieldPower
+    uint8_t reserved[2];
+};
+#pragma pack(pop)
+
+static_assert(sizeof(XRayMsgHeader) == 8, "XRayMsgHeader layout");
+static_assert(sizeof(XRayMsgSetpoints) == 12, "XRayMsgSetpoints layout");
+static_assert(sizeof(XRayMsgState) == 28, "XRayMsgState layout");
+static_assert(sizeof(XRayMsgVersion) == 8, "XRayMsgVersion layout");
+static_assert(sizeof(XRayMsgEvent) == 4, "XRayMsgEvent layout");
+
+// Frame payload of one message
+inline std::string XRayEncode(uint16_t op, uint16_t status, uint32_t id, const void* body = 0, size_t size = 0) {
+    XRayMsgHeader h;
+    h.op = op;
+    h.status = status;
+    h.id = id;
+    std::string msg((const char*)&h, sizeof(h));
+    if (size) msg.append((const char*)body, size);
+    return msg;
+}
+
+// Header and body of a frame payload; false if it is too short
+inline bool XRayDecode(const std::string& msg, XRayMsgHeader& h, const char*& body, size_t& size) {
+    if (msg.size() < sizeof(h)) return false;
+    memcpy(&h, msg.data(), sizeof(h));
+    body = msg.data() + sizeof(h);
+    size = msg.size() - sizeof(h);
+    return true;
+}
+
+// Fixed-layout body; false unless it is exactly a T
+template <class T>
+inline bool XRayBody(const char* body, size_t size, T& out) {
+    if (size != sizeof(T)) return false;
+    memcpy(&out, body, sizeof(T));
+    return true;
+}
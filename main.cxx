@@ -2,133 +2,51 @@
 #include <windows.h>
 #endif
 #include <string>
-#include <vector>
 #include <cstdio>
 #include <cstdlib>
 
-#include "ipc/NamedPipeServer.h"
+#include "ipc/MultiPipeServer.h"
 #include "hwdrivers/XRay.h"
-
-static void split(const std::string& s, char delim, std::vector<std::string>& out) {
-  out.clear();
-  size_t start = 0;
-  while (start <= s.size()) {
-    size_t pos = s.find(delim, start);
-    if (pos == std::string::npos) { out.push_back(s.substr(start)); break; }
-    out.push_back(s.substr(start, pos - start));
-    start = pos + 1;
-  }
-}
+#include "hwdrivers/XRayManager.h"
+#include "hwdrivers/XRayCommandDispatcher.h"
 
 int main() {
-#ifndef _WIN32
-  std::fprintf(stderr, "XRayService supported only on Windows.\n");
-  return 1;
-#else
+  // Endpoint: XRAY_PIPE_NAME=<address>, a pipe name or unix:<path> or
+  // tcp:[<host>:]<port> (see ipc/Transport.h). On Linux the default pipe
+  // is served on /tmp/XRayService.sock, against the MiniX simulation
   const char* pipeEnv = std::getenv("XRAY_PIPE_NAME");
   std::string pipeName = pipeEnv && pipeEnv[0] ? std::string(pipeEnv) : std::string("\\\\.\\pipe\\XRayService");
-  NamedPipeServer server(pipeName);
+  // Simultaneous clients (pipe instances): XRAY_MAX_CLIENTS=<n>, default 8
+  const char* maxEnv = std::getenv("XRAY_MAX_CLIENTS");
+  MultiPipeServer server(pipeName, maxEnv && std::atoi(maxEnv) > 0 ? std::atoi(maxEnv) : 8);
   if (!server.listen()) {
-    std::fprintf(stderr, "Failed to create named pipe: %s\n", pipeName.c_str());
+    std::fprintf(stderr, "Failed to listen on %s\n", server.name().c_str());
     return 2;
   }
-  std::printf("XRayService listening on %s\n", pipeName.c_str());
-  if (!server.accept()) {
-    std::fprintf(stderr, "Failed to accept named pipe client.\n");
-    return 3;
-  }
+  std::printf("XRayService listening on %s\n", server.name().c_str());
 
-  XRay* xr = nullptr;
-  bool running = true;
-  while (running) {
-    std::string line;
-    if (!server.readLine(line)) break;
-    std::vector<std::string> tok; split(line, '|', tok);
-    if (tok.empty()) { server.writeLine("ERR|empty"); continue; }
-    const std::string& cmd = tok[0];
+  // Every enumerated tube is brought up once and shared by all clients;
+  // each client is bound to one by INIT or addresses one per request
+  // (#<tube>|, see XRayCommandDispatcher). Commands that touch the
+  // hardware go through the tube's command queue and are answered when
+  // they complete, so the event loop never waits on a tube and read-only
+  // clients are served while another one controls.
+  XRayManager manager;
+  // Optional background acquisition: XRAY_ACQ_PERIOD_MS=<period>
+  const char* acqEnv = std::getenv("XRAY_ACQ_PERIOD_MS");
+  if (acqEnv && std::atoi(acqEnv) > 0)
+    for (int i = 0; i < manager.GetNTubes(); i++) manager.GetTube(i)->StartAcquisition(std::atoi(acqEnv));
+  XRayCommandDispatcher dispatcher(server, &manager);
 
-    if (cmd == "INIT") {
-      if (xr) { delete xr; xr = nullptr; }
-      // Always connect to first device (device 0), ignoring serial number parameter
-      xr = new XRay(nullptr);
-      // Return the serial number of the connected device
-      const char* serial = xr ? xr->GetSerialNumber() : "";
-      char buf[128];
-      std::snprintf(buf, sizeof(buf), "OK|%s", serial);
-      server.writeLine(buf);
-    } else if (cmd == "SET_POWER") {
-      if (!xr) { server.writeLine("ERR|noinst"); continue; }
-      int p = (tok.size() >= 2) ? std::atoi(tok[1].c_str()) : 0;
-      if (tok.size() >= 3) xr->SetXRayVoltage((Float_t)std::atof(tok[2].c_str()));
-      if (tok.size() >= 4) xr->SetXRayCurrent((Float_t)std::atof(tok[3].c_str()));
-      xr->SetXRayState(p ? kTRUE : kFALSE);
-      server.writeLine("OK");
-    } else if (cmd == "SET_VOLTAGE") {
-      if (!xr) { server.writeLine("ERR|noinst"); continue; }
-      if (tok.size() >= 2) xr->SetXRayVoltage((Float_t)std::atof(tok[1].c_str()));
-      server.writeLine("OK");
-    } else if (cmd == "SET_CURRENT") {
-      if (!xr) { server.writeLine("ERR|noinst"); continue; }
-      if (tok.size() >= 2) xr->SetXRayCurrent((Float_t)std::atof(tok[1].c_str()));
-      server.writeLine("OK");
-    } else if (cmd == "SET_HV_I") {
-      if (!xr) { server.writeLine("ERR|noinst"); continue; }
-      xr->SetXRayHVAndCurrent();
-      server.writeLine("OK");
-    } else if (cmd == "READ_DATA") {
-      if (!xr) { server.writeLine("ERR|noinst"); continue; }
-      xr->ReadXRayData();
-      XRay::XRayState st = xr->GetXRayState();
-      char buf[256];
-      std::snprintf(buf, sizeof(buf), "OK|%d|%f|%f|%f|%f|%f|%f", st.Power ? 1 : 0, st.VoltageToSet, st.ActualVoltage, st.CurrentToSet, st.ActualCurrent, st.ActualPower, st.Temperature);
-      server.writeLine(buf);
-    } else if (cmd == "GET_STATE") {
-      if (!xr) { server.writeLine("ERR|noinst"); continue; }
-      XRay::XRayState st = xr->GetXRayState();
-      char buf[256];
-      std::snprintf(buf, sizeof(buf), "OK|%d|%f|%f|%f|%f|%f|%f", st.Power ? 1 : 0, st.VoltageToSet, st.ActualVoltage, st.CurrentToSet, st.ActualCurrent, st.ActualPower, st.Temperature);
-      server.writeLine(buf);
-    } else if (cmd == "PRINT_STATUS") {
-      if (!xr) { server.writeLine("ERR|noinst"); continue; }
-      xr->PrintStatus();
-      server.writeLine("OK");
-    } else if (cmd == "GET_DEVICE_LIST") {
-      if (!xr) { server.writeLine("ERR|noinst"); continue; }
-      xr->GetDeviceList();
-      server.writeLine("OK");
-    } else if (cmd == "GET_DEVICE_COUNT") {
-      if (!xr) { server.writeLine("ERR|noinst"); continue; }
-      long c = xr->GetDeviceCount();
-      char buf[64]; std::snprintf(buf, sizeof(buf), "OK|%ld", c);
-      server.writeLine(buf);
-    } else if (cmd == "GET_DEVICE_SERIAL") {
-      if (!xr) { server.writeLine("ERR|noinst"); continue; }
-      long idx = (tok.size() >= 2) ? std::atol(tok[1].c_str()) : 0;
-      char serial[256] = {0};
-      long ret = xr->GetDeviceSerialNumberByIndex(idx, serial);
-      char buf[320]; std::snprintf(buf, sizeof(buf), "OK|%ld|%s", ret, serial);
-      server.writeLine(buf);
-    } else if (cmd == "SET_DEVICE") {
-      if (!xr) { server.writeLine("ERR|noinst"); continue; }
-      long idx = (tok.size() >= 2) ? std::atol(tok[1].c_str()) : 0;
-      xr->SetDevice(idx);
-      server.writeLine("OK");
-    } else if (cmd == "EXEC") {
-      if (!xr) { server.writeLine("ERR|noinst"); continue; }
-      std::string arg = (tok.size() >= 2) ? tok[1] : std::string();
-      std::string res;
-      xr->ExecCommand(arg, &res);
-      server.writeLine(std::string("OK|") + res);
-    } else if (cmd == "SHUTDOWN") {
-      server.writeLine("OK");
-      running = false;
-    } else {
-      server.writeLine("ERR|unknown");
-    }
-  }
+  server.run([&](int client, const std::string& msg, const MultiPipeServer::Reply& reply) {
+    dispatcher.Handle(client, msg, reply);
+  }, [&](int client, bool connected) {
+    dispatcher.Connected(client, connected);
+    std::printf("Client %d %s, %d connected\n", client, connected ? "connected" : "disconnected", server.clientCount());
+  });
 
-  if (xr) delete xr;
+  // Pending commands are revoked and answered before the server goes away
+  dispatcher.Stop();
   server.close();
   return 0;
-#endif
 }